@@ -4,24 +4,65 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 CONFIG += c++11
 
+# 运行统计读取进程的内存峰值
+win32: LIBS += -lpsapi
+
 # You can make your code fail to compile if it uses deprecated APIs.
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    checkpoint.cpp \
+    coverage.cpp \
+    differentialrunner.cpp \
     expression.cpp \
+    expressioncache.cpp \
+    expressionpool.cpp \
+    headlessrunner.cpp \
+    inputqueue.cpp \
     main.cpp \
     mainwindow.cpp \
+    nativecompiler.cpp \
+    optimizer.cpp \
+    outputbuffer.cpp \
+    outputview.cpp \
+    programanalysis.cpp \
+    programgenerator.cpp \
     programmanager.cpp \
+    programstore.cpp \
+    registervm.cpp \
     runtimecontext.cpp \
-    statement.cpp
+    statement.cpp \
+    symboltable.cpp \
+    systemutils.cpp \
+    tracejit.cpp \
+    tracerecorder.cpp
 
 HEADERS += \
+    checkpoint.h \
+    coverage.h \
+    differentialrunner.h \
     expression.h \
+    expressioncache.h \
+    expressionpool.h \
+    headlessrunner.h \
+    inputqueue.h \
     mainwindow.h \
+    nativecompiler.h \
+    optimizer.h \
+    outputbuffer.h \
+    outputview.h \
+    programanalysis.h \
+    programgenerator.h \
     programmanager.h \
+    programstore.h \
+    registervm.h \
     runtimecontext.h \
-    statement.h
+    statement.h \
+    symboltable.h \
+    systemutils.h \
+    tracejit.h \
+    tracerecorder.h
 
 FORMS += \
     mainwindow.ui
@@ -0,0 +1,11 @@
+10 LET N = 0
+20 FOR I = 2147483640 TO 2147483647
+30 LET N = N + 1
+40 NEXT I
+50 PRINT N
+60 PRINT I
+70 FOR J = -2147483640 TO -2147483648 STEP -3
+80 LET N = N + 1
+90 NEXT J
+100 PRINT N
+110 PRINT J
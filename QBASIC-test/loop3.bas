@@ -0,0 +1,9 @@
+10 GOSUB 100
+20 PRINT J
+30 GOSUB 100
+40 PRINT J
+50 END
+100 LET J = 0
+110 LET J = J + 1
+120 IF J < 3 THEN 110
+130 RETURN
\ No newline at end of file
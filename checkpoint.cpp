@@ -0,0 +1,212 @@
+#include "checkpoint.h"
+
+#include "systemutils.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static const char CHECKPOINT_MAGIC[] = "QBCKPT01";
+static const size_t CHECKPOINT_MAGIC_LENGTH = 8;
+
+std::string Checkpoint::encode() const
+{
+    std::string out(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LENGTH);
+    writeString(out, source);
+
+    writeNumber(out, statements);
+    writeNumber(out, outputBytes);
+    writeNumber(out, jumps);
+    writeNumber(out, runMillis);
+    writeNumber(out, writeCnt);
+    writeNumber(out, evalCnt);
+    writeNumber(out, pos);
+    writeNumber(out, returnStack.size());
+    for (size_t returnPos : returnStack)
+        writeNumber(out, returnPos);
+
+    writeNumber(out, paused);
+    writeNumber(out, waitingForInput);
+    if (waitingForInput)
+    {
+        writeNumber(out, inputLineIndex);
+        writeString(out, inputVarName);
+    }
+
+    writeNumber(out, variables.size());
+    for (const auto& variable : variables)
+    {
+        writeString(out, variable.name);
+        writeNumber(out, variable.defined);
+        writeNumber(out, variable.value);
+        writeNumber(out, variable.useCnt);
+        writeNumber(out, variable.array.size());
+        for (int value : variable.array)
+            writeNumber(out, value);
+    }
+
+    writeNumber(out, statementStates.size());
+    for (int state : statementStates)
+        writeNumber(out, state);
+    return out;
+}
+
+// 每个数至少占一个字节，个数超过剩余字节数的文件一定是坏的，不必按它分配内存
+bool Checkpoint::decode(const std::string& data)
+{
+    if (data.size() < CHECKPOINT_MAGIC_LENGTH || data.compare(0, CHECKPOINT_MAGIC_LENGTH, CHECKPOINT_MAGIC) != 0)
+        return false;
+
+    size_t offset = CHECKPOINT_MAGIC_LENGTH;
+    long long value, cnt;
+    if (!readString(data, offset, source))
+        return false;
+
+    long long* counters[] = {&statements, &outputBytes, &jumps, &runMillis, &writeCnt, &evalCnt};
+    for (long long* counter : counters)
+    {
+        if (!readNumber(data, offset, *counter))
+            return false;
+    }
+    if (!readNumber(data, offset, value) || value < 0)
+        return false;
+    pos = value;
+
+    if (!readNumber(data, offset, cnt) || cnt < 0 || cnt > (long long)(data.size() - offset))
+        return false;
+    returnStack.clear();
+    for (long long i = 0; i < cnt; i++)
+    {
+        if (!readNumber(data, offset, value) || value < 0)
+            return false;
+        returnStack.push_back(value);
+    }
+
+    if (!readNumber(data, offset, value))
+        return false;
+    paused = value != 0;
+    if (!readNumber(data, offset, value))
+        return false;
+    waitingForInput = value != 0;
+    inputVarName.clear();
+    if (waitingForInput)
+    {
+        if (!readNumber(data, offset, value) || !readString(data, offset, inputVarName))
+            return false;
+        inputLineIndex = value;
+    }
+
+    if (!readNumber(data, offset, cnt) || cnt < 0 || cnt > (long long)(data.size() - offset))
+        return false;
+    variables.assign(cnt, Variable());
+    for (auto& variable : variables)
+    {
+        long long defined, varValue, useCnt, arraySize;
+        if (!readString(data, offset, variable.name) || !readNumber(data, offset, defined)
+            || !readNumber(data, offset, varValue) || !readNumber(data, offset, useCnt)
+            || !readNumber(data, offset, arraySize) || arraySize < 0
+            || arraySize > (long long)(data.size() - offset))
+            return false;
+        variable.defined = defined != 0;
+        variable.value = varValue;
+        variable.useCnt = useCnt;
+        variable.array.resize(arraySize);
+        for (int& element : variable.array)
+        {
+            if (!readNumber(data, offset, value))
+                return false;
+            element = value;
+        }
+    }
+
+    if (!readNumber(data, offset, cnt) || cnt < 0 || cnt > (long long)(data.size() - offset))
+        return false;
+    statementStates.resize(cnt);
+    for (int& state : statementStates)
+    {
+        if (!readNumber(data, offset, value))
+            return false;
+        state = value;
+    }
+    return offset == data.size();
+}
+
+bool Checkpoint::load(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return decode(data);
+}
+
+// 先写到临时文件再原子地替换，任何时候中断，文件中都是上一个或这一个完整的检查点
+bool Checkpoint::write(const std::string& fileName, const std::string& data)
+{
+    std::string partialFile = fileName + ".part";
+    std::ofstream file(partialFile, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write(data.data(), data.size());
+    file.close();
+    if (!file)
+    {
+        std::remove(partialFile.c_str());
+        return false;
+    }
+
+    return replaceFile(partialFile, fileName);
+}
+
+void Checkpoint::writeVarint(std::string& out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+void Checkpoint::writeNumber(std::string& out, long long value)
+{
+    writeVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void Checkpoint::writeString(std::string& out, const std::string& str)
+{
+    writeVarint(out, str.size());
+    out += str;
+}
+
+bool Checkpoint::readVarint(const std::string& data, size_t& offset, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && offset < data.size(); shift += 7)
+    {
+        uint8_t byte = data[offset++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool Checkpoint::readNumber(const std::string& data, size_t& offset, long long& value)
+{
+    uint64_t encoded;
+    if (!readVarint(data, offset, encoded))
+        return false;
+    value = (long long)(encoded >> 1) ^ -(long long)(encoded & 1);
+    return true;
+}
+
+bool Checkpoint::readString(const std::string& data, size_t& offset, std::string& str)
+{
+    uint64_t length;
+    if (!readVarint(data, offset, length) || length > data.size() - offset)
+        return false;
+    str.assign(data, offset, length);
+    offset += length;
+    return true;
+}
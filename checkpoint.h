@@ -0,0 +1,61 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/*
+ * 运行状态的检查点文件：
+ *   "QBCKPT01"，程序源码长度（varint）和源码，之后全部是zigzag编码的varint：
+ *   已执行语句数、已输出字节数、跳转次数、运行毫秒数、变量写入次数、求值节点数，
+ *   下一条语句的位置，返回栈深度和各层位置，
+ *   是否暂停，是否在等待输入（是则接着INPUT的行号和变量名），
+ *   变量个数和每个变量（名字、是否定义、值、使用次数、数组长度和元素），
+ *   语句状态的个数和内容（按Statement::saveState的布局依次排列）。
+ * 字符串写成长度加内容。变量按名字保存，恢复时重新驻留，不依赖ID的分配顺序；
+ * 位置是语句在程序中的下标，恢复时先按文件中的源码重建程序。
+ */
+class Checkpoint
+{
+public:
+    struct Variable
+    {
+        std::string name;
+        bool defined = false;
+        int value = 0;
+        int useCnt = 0;
+        std::vector<int> array;
+    };
+
+    std::string source;
+    long long statements = 0;
+    long long outputBytes = 0;
+    long long jumps = 0;
+    long long runMillis = 0;
+    long long writeCnt = 0;
+    long long evalCnt = 0;
+    size_t pos = 0;
+    std::vector<size_t> returnStack;
+    bool paused = false;
+    bool waitingForInput = false;
+    int inputLineIndex = -1;
+    std::string inputVarName;
+    std::vector<Variable> variables;
+    std::vector<int> statementStates;
+
+    std::string encode() const;
+    bool decode(const std::string& data);
+    bool load(const std::string& fileName);
+    static bool write(const std::string& fileName, const std::string& data);
+
+private:
+    static void writeVarint(std::string& out, uint64_t value);
+    static void writeNumber(std::string& out, long long value);
+    static void writeString(std::string& out, const std::string& str);
+    static bool readVarint(const std::string& data, size_t& offset, uint64_t& value);
+    static bool readNumber(const std::string& data, size_t& offset, long long& value);
+    static bool readString(const std::string& data, size_t& offset, std::string& str);
+};
+
+#endif // CHECKPOINT_H
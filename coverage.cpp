@@ -0,0 +1,176 @@
+#include "coverage.h"
+
+#include "programmanager.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+// 同一个行号出现多次时和加载程序一样以后出现的为准
+void Coverage::addRun(const std::string& sourceFile, const std::vector<std::string>& source, const ProgramManager& pm)
+{
+    std::map<int, int> sourceLines = mapSourceLines(source);
+    std::map<int, LineCounts>& lines = files[sourceFile];
+
+    for (const auto& executionCnt : pm.getExecutionCnts())
+    {
+        auto it = sourceLines.find(executionCnt.first);
+        if (it != sourceLines.end())
+            lines[it->second].hits += executionCnt.second;
+    }
+    for (const auto& branchCnt : pm.getBranchCnts())
+    {
+        auto it = sourceLines.find(branchCnt.lineIndex);
+        if (it == sourceLines.end())
+            continue;
+        LineCounts& counts = lines[it->second];
+        counts.branch = true;
+        counts.taken += branchCnt.trueCnt;
+        counts.notTaken += branchCnt.falseCnt;
+    }
+}
+
+void Coverage::merge(const Coverage& other)
+{
+    for (const auto& file : other.files)
+    {
+        std::map<int, LineCounts>& lines = files[file.first];
+        for (const auto& line : file.second)
+        {
+            LineCounts& counts = lines[line.first];
+            counts.hits += line.second.hits;
+            counts.branch = counts.branch || line.second.branch;
+            counts.taken += line.second.taken;
+            counts.notTaken += line.second.notTaken;
+        }
+    }
+}
+
+// 读入已有的跟踪文件并累加；只认SF、DA、BRDA和end_of_record，其余记录（TN、LF、BRH等）忽略
+bool Coverage::load(const std::string& fileName)
+{
+    std::ifstream fin(fileName);
+    if (!fin)
+        return false;
+
+    std::map<int, LineCounts>* lines = nullptr;
+    std::string line;
+    std::vector<std::string> fields;
+    while (std::getline(fin, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.compare(0, 3, "SF:") == 0)
+        {
+            lines = &files[line.substr(3)];
+            continue;
+        }
+        if (line == "end_of_record")
+        {
+            lines = nullptr;
+            continue;
+        }
+
+        bool isLine = line.compare(0, 3, "DA:") == 0;
+        bool isBranch = line.compare(0, 5, "BRDA:") == 0;
+        if (!isLine && !isBranch)
+            continue;
+        if (!lines || !parseRecord(line.substr(isLine ? 3 : 5), fields))
+            return false;
+
+        int lineNumber = atoi(fields[0].c_str());
+        if (isLine && fields.size() >= 2)
+        {
+            (*lines)[lineNumber].hits += atoll(fields[1].c_str());
+        }
+        else if (isBranch && fields.size() == 4 && (fields[2] == "0" || fields[2] == "1"))
+        {
+            LineCounts& counts = (*lines)[lineNumber];
+            long long taken = fields[3] == "-" ? 0 : atoll(fields[3].c_str());
+            counts.branch = true;
+            (fields[2] == "0" ? counts.taken : counts.notTaken) += taken;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+bool Coverage::write(const std::string& fileName) const
+{
+    std::ofstream fout(fileName, std::ios::trunc);
+    if (!fout)
+        return false;
+    fout << toLcov();
+    return (bool)fout;
+}
+
+std::string Coverage::toLcov() const
+{
+    std::ostringstream out;
+    for (const auto& file : files)
+    {
+        int linesHit = 0, branches = 0, branchesHit = 0;
+        out << "TN:\n" << "SF:" << file.first << "\n";
+        for (const auto& line : file.second)
+        {
+            const LineCounts& counts = line.second;
+            if (!counts.branch)
+                continue;
+            const long long taken[] = {counts.taken, counts.notTaken};
+            for (int branch = 0; branch < 2; branch++)
+            {
+                out << "BRDA:" << line.first << ",0," << branch << ",";
+                if (counts.hits > 0)
+                    out << taken[branch];
+                else
+                    out << "-";
+                out << "\n";
+                branches++;
+                branchesHit += taken[branch] > 0;
+            }
+        }
+        out << "BRF:" << branches << "\n" << "BRH:" << branchesHit << "\n";
+        for (const auto& line : file.second)
+        {
+            out << "DA:" << line.first << "," << line.second.hits << "\n";
+            linesHit += line.second.hits > 0;
+        }
+        out << "LF:" << file.second.size() << "\n" << "LH:" << linesHit << "\n" << "end_of_record\n";
+    }
+    return out.str();
+}
+
+// BASIC行号 -> 文件行号；只有行号的一行会删除之前的同号行
+std::map<int, int> Coverage::mapSourceLines(const std::vector<std::string>& source)
+{
+    std::map<int, int> res;
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        const char* text = source[i].c_str();
+        char* end;
+        long lineIndex = strtol(text, &end, 10);
+        if (end == text)
+            continue;
+        bool onlyNumber = true;
+        for (const char* ch = end; *ch; ch++)
+            onlyNumber = onlyNumber && isspace((unsigned char)*ch);
+        if (onlyNumber)
+            res.erase(lineIndex);
+        else
+            res[lineIndex] = i + 1;
+    }
+    return res;
+}
+
+// 逗号分隔的字段，至少两个
+bool Coverage::parseRecord(const std::string& line, std::vector<std::string>& fields)
+{
+    fields.clear();
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ','))
+        fields.push_back(field);
+    return fields.size() >= 2;
+}
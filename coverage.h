@@ -0,0 +1,44 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+class ProgramManager;
+
+/*
+ * 行覆盖和分支覆盖，按lcov的跟踪文件格式读写：
+ *   SF:源文件  DA:行,执行次数  BRDA:行,0,分支,次数  ...  end_of_record
+ * 行号是语句在.bas文件中的行号（从1开始），不是BASIC的行号；
+ * IF语句记为两个分支，0是条件成立（跳转），1是不成立，所在行没有执行过时次数写成"-"。
+ * 计数可以累加：多次运行、多个线程各自收集的结果和已有的跟踪文件都能合并。
+ */
+class Coverage
+{
+public:
+    struct LineCounts
+    {
+        long long hits = 0;
+        bool branch = false;
+        long long taken = 0;
+        long long notTaken = 0;
+    };
+
+private:
+    // 源文件 -> 文件行号 -> 计数
+    std::map<std::string, std::map<int, LineCounts>> files;
+
+public:
+    void addRun(const std::string& sourceFile, const std::vector<std::string>& source, const ProgramManager& pm);
+    void merge(const Coverage& other);
+    bool load(const std::string& fileName);
+    bool write(const std::string& fileName) const;
+    std::string toLcov() const;
+
+private:
+    static std::map<int, int> mapSourceLines(const std::vector<std::string>& source);
+    static bool parseRecord(const std::string& line, std::vector<std::string>& fields);
+};
+
+#endif // COVERAGE_H
@@ -0,0 +1,190 @@
+#include "differentialrunner.h"
+
+#include "inputqueue.h"
+#include "runtimecontext.h"
+#include "statement.h"
+#include "symboltable.h"
+
+#include <thread>
+
+DifferentialRunner::DifferentialRunner(const std::vector<std::string>& source, const std::vector<int>& inputs,
+                                       const ProgramManager::ExecutionLimits& limits,
+                                       ProgramManager::EngineType engine)
+    : source(source), inputs(inputs), limits(limits), engine(engine) {}
+
+DifferentialRunner::Result DifferentialRunner::run()
+{
+    ProgramManager referencePm(nullptr);
+    ProgramManager optimizedPm(nullptr);
+    EngineRun reference = {&referencePm, {}};
+    EngineRun optimized = {&optimizedPm, {}};
+
+    // 解析时会驻留变量名，放在主线程里依次完成
+    prepare(reference, ProgramManager::REFERENCE_ENGINE);
+    prepare(optimized, engine);
+
+    std::thread referenceThread(execute, &reference);
+    std::thread optimizedThread(execute, &optimized);
+    referenceThread.join();
+    optimizedThread.join();
+
+    Result res = compareOutput(reference, optimized);
+    if (res.agree)
+        res = compareExecutionCnts(reference, optimized);
+    if (res.agree)
+        res = compareVariables(reference, optimized);
+    return res;
+}
+
+void DifferentialRunner::prepare(EngineRun& run, ProgramManager::EngineType engine)
+{
+    run.pm->setOutputCapture(&run.output);
+    run.pm->setEngine(engine);
+    run.pm->setExecutionLimits(limits);
+    QStringList lines;
+    for (const auto& line : source)
+        lines.append(QString::fromStdString(line).trimmed());
+    run.pm->addCommands(lines);
+    run.pm->analyzeCode();
+    run.pm->getInputQueue()->pushAll(inputs);
+}
+
+void DifferentialRunner::execute(EngineRun* run)
+{
+    run->pm->runCode();
+    if (run->pm->isRunning())
+        run->pm->stopRunning();
+}
+
+// 运行时错误也经过输出，出错的位置和原因同样会被比较
+DifferentialRunner::Result DifferentialRunner::compareOutput(const EngineRun& reference, const EngineRun& optimized)
+{
+    Result res;
+    size_t cnt = std::min(reference.output.size(), optimized.output.size());
+    for (size_t i = 0; i < cnt; i++)
+    {
+        const auto& expected = reference.output[i];
+        const auto& actual = optimized.output[i];
+        if (expected.lineIndex != actual.lineIndex || expected.text != actual.text)
+        {
+            res.agree = false;
+            res.lineIndex = expected.lineIndex;
+            res.reason = "Output \"" + actual.text + "\" at line " + std::to_string(actual.lineIndex)
+                         + ", expected \"" + expected.text + "\"";
+            return res;
+        }
+    }
+
+    if (reference.output.size() != optimized.output.size())
+    {
+        const EngineRun& longer = reference.output.size() > cnt ? reference : optimized;
+        res.agree = false;
+        res.lineIndex = longer.output[cnt].lineIndex;
+        res.reason = std::string(&longer == &reference ? "Missing" : "Extra") + " output \""
+                     + longer.output[cnt].text + "\"";
+    }
+    return res;
+}
+
+DifferentialRunner::Result DifferentialRunner::compareExecutionCnts(const EngineRun& reference, const EngineRun& optimized)
+{
+    Result res;
+    std::vector<std::pair<int, int>> expected = reference.pm->getExecutionCnts();
+    std::vector<std::pair<int, int>> actual = optimized.pm->getExecutionCnts();
+    for (size_t i = 0; i < expected.size() && i < actual.size(); i++)
+    {
+        if (expected[i].second != actual[i].second)
+        {
+            res.agree = false;
+            res.lineIndex = expected[i].first;
+            res.reason = "Executed " + std::to_string(actual[i].second) + " times, expected "
+                         + std::to_string(expected[i].second);
+            return res;
+        }
+    }
+
+    // 同一行执行次数相同也可能走错了分支，IF的两个分支和NEXT的回跳、退出次数分别比较
+    std::vector<ProgramManager::BranchCnt> expectedBranches = reference.pm->getBranchCnts();
+    std::vector<ProgramManager::BranchCnt> actualBranches = optimized.pm->getBranchCnts();
+    for (size_t i = 0; i < expectedBranches.size() && i < actualBranches.size(); i++)
+    {
+        const auto& expectedCnt = expectedBranches[i];
+        const auto& actualCnt = actualBranches[i];
+        if (expectedCnt.trueCnt != actualCnt.trueCnt || expectedCnt.falseCnt != actualCnt.falseCnt)
+        {
+            res.agree = false;
+            res.lineIndex = expectedCnt.lineIndex;
+            res.reason = "Condition held " + std::to_string(actualCnt.trueCnt) + " and failed "
+                         + std::to_string(actualCnt.falseCnt) + " times, expected "
+                         + std::to_string(expectedCnt.trueCnt) + " and " + std::to_string(expectedCnt.falseCnt);
+            return res;
+        }
+    }
+
+    std::vector<ProgramManager::LoopCnt> expectedLoops = reference.pm->getLoopCnts();
+    std::vector<ProgramManager::LoopCnt> actualLoops = optimized.pm->getLoopCnts();
+    for (size_t i = 0; i < expectedLoops.size() && i < actualLoops.size(); i++)
+    {
+        const auto& expectedCnt = expectedLoops[i];
+        const auto& actualCnt = actualLoops[i];
+        if (expectedCnt.loopCnt != actualCnt.loopCnt || expectedCnt.exitCnt != actualCnt.exitCnt)
+        {
+            res.agree = false;
+            res.lineIndex = expectedCnt.lineIndex;
+            res.reason = "Looped " + std::to_string(actualCnt.loopCnt) + " and exited "
+                         + std::to_string(actualCnt.exitCnt) + " times, expected "
+                         + std::to_string(expectedCnt.loopCnt) + " and " + std::to_string(expectedCnt.exitCnt);
+            return res;
+        }
+    }
+    return res;
+}
+
+DifferentialRunner::Result DifferentialRunner::compareVariables(const EngineRun& reference, const EngineRun& optimized)
+{
+    Result res;
+    const RuntimeContext* expected = reference.pm->getContext();
+    const RuntimeContext* actual = optimized.pm->getContext();
+    size_t varCnt = std::max(expected->getVarValues().size(), actual->getVarValues().size());
+    static const std::vector<int> noArray;
+
+    for (size_t varId = 0; varId < varCnt; varId++)
+    {
+        int expectedValue, actualValue;
+        bool expectedDefined = expected->findVarValue(varId, expectedValue);
+        bool actualDefined = actual->findVarValue(varId, actualValue);
+        const std::vector<int>& expectedArray =
+            varId < expected->getArrayValues().size() ? expected->getArrayValues()[varId] : noArray;
+        const std::vector<int>& actualArray =
+            varId < actual->getArrayValues().size() ? actual->getArrayValues()[varId] : noArray;
+        const std::string& name = SymbolTable::instance().nameOf(varId);
+
+        if (expectedDefined != actualDefined || (expectedDefined && expectedValue != actualValue))
+        {
+            res.agree = false;
+            res.reason = "Variable '" + name + "' is "
+                         + (actualDefined ? std::to_string(actualValue) : std::string("undefined")) + ", expected "
+                         + (expectedDefined ? std::to_string(expectedValue) : std::string("undefined"));
+        }
+        else if (expectedArray != actualArray)
+        {
+            res.agree = false;
+            res.reason = "Array '" + name + "' differs";
+        }
+        // 语法树上显示的使用次数也要一致
+        else if (expected->getVarUseCnt(varId) != actual->getVarUseCnt(varId))
+        {
+            res.agree = false;
+            res.reason = "Variable '" + name + "' is used " + std::to_string(actual->getVarUseCnt(varId))
+                         + " times, expected " + std::to_string(expected->getVarUseCnt(varId));
+        }
+
+        if (!res.agree)
+        {
+            // 变量值不同时无法知道是哪一次赋值出错，报告第一条给它赋值的语句
+            res.lineIndex = reference.pm->findDefiningLine(varId);
+            return res;
+        }
+    }
+    return res;
+}
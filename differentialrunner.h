@@ -0,0 +1,50 @@
+#ifndef DIFFERENTIALRUNNER_H
+#define DIFFERENTIALRUNNER_H
+
+#include <string>
+#include <vector>
+#include "programmanager.h"
+
+/*
+ * 对拍：同一个程序分别在基准引擎和待测引擎上运行（各占一个线程），
+ * 依次比较输出、每一行的计数（执行次数、IF的分支次数和NEXT的回跳、退出次数）和最终的变量值，
+ * 报告最先出现差异的行。
+ */
+class DifferentialRunner
+{
+public:
+    struct Result
+    {
+        bool agree = true;
+        // 无法定位到具体行时为-1
+        int lineIndex = -1;
+        std::string reason;
+    };
+
+private:
+    struct EngineRun
+    {
+        ProgramManager* pm;
+        std::vector<ProgramManager::OutputRecord> output;
+    };
+
+    std::vector<std::string> source;
+    std::vector<int> inputs;
+    ProgramManager::ExecutionLimits limits;
+    ProgramManager::EngineType engine;
+
+public:
+    DifferentialRunner(const std::vector<std::string>& source, const std::vector<int>& inputs,
+                       const ProgramManager::ExecutionLimits& limits,
+                       ProgramManager::EngineType engine = ProgramManager::OPTIMIZING_ENGINE);
+    Result run();
+
+private:
+    void prepare(EngineRun& run, ProgramManager::EngineType engine);
+    static void execute(EngineRun* run);
+    static Result compareOutput(const EngineRun& reference, const EngineRun& optimized);
+    static Result compareExecutionCnts(const EngineRun& reference, const EngineRun& optimized);
+    static Result compareVariables(const EngineRun& reference, const EngineRun& optimized);
+};
+
+#endif // DIFFERENTIALRUNNER_H
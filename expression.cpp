@@ -1,8 +1,10 @@
 #include "expression.h"
 
 #include "runtimecontext.h"
+#include "symboltable.h"
 
 #include <stack>
+#include <cstdio>
 #include <QDebug>
 
 Expression* Expression::newExpFromStr(const std::string& expStr)
@@ -28,6 +30,19 @@ Expression* Expression::newExpFromStr(const std::string& expStr)
                 break;
             }
 
+            case ARRAY_NAME:
+            {
+                if (expStack.empty())
+                {
+                    throw "Incomplete expression";
+                }
+
+                Expression* index = expStack.top();
+                expStack.pop();
+                expStack.push(new IndexExp(token.value, index));
+                break;
+            }
+
             case OPERATION:
             {
                 if (expStack.size() < 2)
@@ -163,8 +178,12 @@ std::vector<Expression::Token> Expression::tokenize(const std::string& expStr)
                 currentToken += expStr[i];
                 i++;
             }
+            // 紧跟左括号的标识符是数组名
+            size_t next = i;
+            while (next < len && std::isspace(expStr[next]))
+                next++;
             i--;
-            tokens.push_back( {IDENTIFIER, currentToken} );
+            tokens.push_back( {next < len && expStr[next] == '(' ? ARRAY_NAME : IDENTIFIER, currentToken} );
             currentToken.clear();
             continue;
         }
@@ -203,6 +222,10 @@ std::vector<Expression::Token> Expression::infixToPostfix(const std::vector<Expr
             res.push_back(token);
             break;
 
+        case ARRAY_NAME:
+            stack.push(token);
+            break;
+
         case OPERATION:
             if (value == "(")
             {
@@ -222,6 +245,12 @@ std::vector<Expression::Token> Expression::infixToPostfix(const std::vector<Expr
                 }
 
                 stack.pop();
+
+                if (!stack.empty() && stack.top().type == ARRAY_NAME)
+                {
+                    res.push_back(stack.top());
+                    stack.pop();
+                }
             }
             else // operation
             {
@@ -290,31 +319,98 @@ int Expression::getOperationPrecedence(const OperationType opType)
 }
 
 
+std::string Expression::getSyntaxTree(int indent) const
+{
+    std::string res;
+    writeSyntaxTree(res, indent);
+    return res;
+}
+
+void Expression::appendNumber(std::string& out, long long value)
+{
+    char buf[24];
+    int len = snprintf(buf, sizeof(buf), "%lld", value);
+    out.append(buf, len);
+}
+
+
 ConstantExp::ConstantExp(const int value)
     : value(value) {}
 
 int ConstantExp::getValue(RuntimeContext* context) const
 {
+    context->countEval();
     return value;
 }
 
-std::string ConstantExp::getSyntaxTree(int indent) const
+void ConstantExp::writeSyntaxTree(std::string& out, int indent) const
 {
-    return std::string(indent, ' ') + std::to_string(value);
+    out.append(indent, ' ');
+    appendNumber(out, value);
 }
 
+void ConstantExp::collectIdentifiers(std::vector<int>& varIds) const {}
+
 
 IdentifierExp::IdentifierExp(const std::string name)
-    : name(name) {}
+    : varId(SymbolTable::instance().intern(name)) {}
 
 int IdentifierExp::getValue(RuntimeContext* context) const
 {
-    return context->getVarValue(name);
+    context->countEval();
+    return context->getVarValue(varId);
+}
+
+void IdentifierExp::writeSyntaxTree(std::string& out, int indent) const
+{
+    out.append(indent, ' ');
+    out += SymbolTable::instance().nameOf(varId);
 }
 
-std::string IdentifierExp::getSyntaxTree(int indent) const
+void IdentifierExp::collectIdentifiers(std::vector<int>& varIds) const
 {
-    return std::string(indent, ' ') + name;
+    varIds.push_back(varId);
+}
+
+
+IndexExp::IndexExp(const std::string name, Expression* indexExp)
+    : varId(SymbolTable::instance().intern(name)), indexExp(indexExp) {}
+
+IndexExp::~IndexExp()
+{
+    if (indexExp) delete indexExp;
+}
+
+int IndexExp::getValue(RuntimeContext* context) const
+{
+    context->countEval();
+    int index = indexExp->getValue(context);
+    if (hoistedCheck && *hoistedCheck)
+        return context->getArrayValueUnchecked(varId, index);
+    return context->getArrayValue(varId, index);
+}
+
+void IndexExp::setValue(RuntimeContext* context, const int value) const
+{
+    int index = indexExp->getValue(context);
+    if (hoistedCheck && *hoistedCheck)
+        context->setArrayValueUnchecked(varId, index, value);
+    else
+        context->setArrayValue(varId, index, value);
+}
+
+void IndexExp::writeSyntaxTree(std::string& out, int indent) const
+{
+    out.append(indent, ' ');
+    out += SymbolTable::instance().nameOf(varId);
+    out += "()\n";
+    indexExp->writeSyntaxTree(out, indent + 4);
+}
+
+void IndexExp::collectIdentifiers(std::vector<int>& varIds) const
+{
+    varIds.push_back(varId);
+    indexExp->collectIdentifiers(varIds);
 }
 
 
@@ -328,6 +424,21 @@ CompoundExp::~CompoundExp()
 }
 
 int CompoundExp::getValue(RuntimeContext* context) const
+{
+    context->countEval();
+    if (cacheSlot < 0)
+        return evaluate(context);
+
+    int value;
+    if (context->getCachedValue(cacheSlot, value))
+        return value;
+
+    value = evaluate(context);
+    context->setCachedValue(cacheSlot, value);
+    return value;
+}
+
+int CompoundExp::evaluate(RuntimeContext* context) const
 {
     int leftValue = leftExp->getValue(context);
     int rightValue = rightExp->getValue(context);
@@ -350,31 +461,37 @@ int CompoundExp::getValue(RuntimeContext* context) const
     }
 }
 
-std::string CompoundExp::getSyntaxTree(int indent) const
+void CompoundExp::writeSyntaxTree(std::string& out, int indent) const
 {
-    std::string res = std::string(indent, ' ');
+    out.append(indent, ' ');
     switch (operation) {
-    case ADD: res += "+"; break;
-    case SUB: res += "-"; break;
-    case MUL: res += "*"; break;
-    case DIV: res += "/"; break;
-    case MOD: res += "MOD"; break;
-    case POW: res += "**"; break;
+    case ADD: out += "+"; break;
+    case SUB: out += "-"; break;
+    case MUL: out += "*"; break;
+    case DIV: out += "/"; break;
+    case MOD: out += "MOD"; break;
+    case POW: out += "**"; break;
     }
-    res += "\n";
-    res += leftExp->getSyntaxTree(indent + 4) + "\n";
-    res += rightExp->getSyntaxTree(indent + 4);
-    return res;
+    out += "\n";
+    leftExp->writeSyntaxTree(out, indent + 4);
+    out += "\n";
+    rightExp->writeSyntaxTree(out, indent + 4);
+}
+
+void CompoundExp::collectIdentifiers(std::vector<int>& varIds) const
+{
+    leftExp->collectIdentifiers(varIds);
+    rightExp->collectIdentifiers(varIds);
 }
 
-int CompoundExp::basicDivide(const int a, const int b) const
+int CompoundExp::basicDivide(const int a, const int b)
 {
     if (b == 0)
         throw "Division by zero";
     return a / b;
 }
 
-int CompoundExp::basicMod(const int a, const int b) const
+int CompoundExp::basicMod(const int a, const int b)
 {
     if (b == 0)
         throw "Mod by zero";
@@ -384,7 +501,7 @@ int CompoundExp::basicMod(const int a, const int b) const
     return res;
 }
 
-int CompoundExp::basicPower(const int a, const int b) const
+int CompoundExp::basicPower(const int a, const int b)
 {
     if (b < 0)
         throw "Power with negative exponent";
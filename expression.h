@@ -24,6 +24,7 @@ public:
     {
         NUMBER = 1,
         IDENTIFIER,
+        ARRAY_NAME,
         OPERATION,
         LPAREN,
         RPAREN,
@@ -39,12 +40,18 @@ public:
     };
 
 public:
+    // 在ExpressionPool中对应的节点，-1表示未加入
+    int poolIndex = -1;
+
     virtual ~Expression() = default;
 
     virtual int getValue(RuntimeContext* context) const = 0;
-    virtual std::string getSyntaxTree(int indent = 0) const = 0;
+    std::string getSyntaxTree(int indent = 0) const;
+    virtual void writeSyntaxTree(std::string& out, int indent) const = 0;
+    virtual void collectIdentifiers(std::vector<int>& varIds) const = 0;
 
     static Expression* newExpFromStr(const std::string& exprStr);
+    static void appendNumber(std::string& out, long long value);
 
 private:
     static std::vector<Token> tokenize(const std::string& exprStr);
@@ -61,18 +68,39 @@ public:
 
     ConstantExp(const int value);
     int getValue(RuntimeContext* context) const override;
-    std::string getSyntaxTree(int indent) const override;
+    void writeSyntaxTree(std::string& out, int indent) const override;
+    void collectIdentifiers(std::vector<int>& varIds) const override;
 };
 
 
 class IdentifierExp : public Expression
 {
 public:
-    std::string name;
+    // 变量名在构造时驻留，运行时只用ID
+    int varId;
 
     IdentifierExp(const std::string name);
     int getValue(RuntimeContext* context) const override;
-    std::string getSyntaxTree(int indent) const override;
+    void writeSyntaxTree(std::string& out, int indent) const override;
+    void collectIdentifiers(std::vector<int>& varIds) const override;
+};
+
+
+// 数组元素A(i)，数组存放在RuntimeContext的连续存储中
+class IndexExp : public Expression
+{
+public:
+    int varId;
+    Expression* indexExp;
+    // 由Optimizer在循环入口能证明下标范围时指向该FOR的检查结果，为真时跳过边界检查
+    const bool* hoistedCheck = nullptr;
+
+    IndexExp(const std::string name, Expression* indexExp);
+    ~IndexExp();
+    int getValue(RuntimeContext* context) const override;
+    void setValue(RuntimeContext* context, const int value) const;
+    void writeSyntaxTree(std::string& out, int indent) const override;
+    void collectIdentifiers(std::vector<int>& varIds) const override;
 };
 
 
@@ -82,16 +110,22 @@ public:
     Expression* leftExp;
     Expression* rightExp;
     OperationType operation;
+    // 公共子表达式缓存槽，由Optimizer分配，-1表示不缓存
+    int cacheSlot = -1;
 
     CompoundExp(Expression* leftExp, Expression* rightExp, const OperationType operation);
     ~CompoundExp();
     int getValue(RuntimeContext* context) const override;
-    std::string getSyntaxTree(int indent) const override;
+    void writeSyntaxTree(std::string& out, int indent) const override;
+    void collectIdentifiers(std::vector<int>& varIds) const override;
+
+    // 与寄存器虚拟机共用，保证两种执行方式的除法和取模语义一致
+    static int basicDivide(const int a, const int b);
+    static int basicMod(const int a, const int b);
+    static int basicPower(const int a, const int b);
 
 private:
-    int basicDivide(const int a, const int b) const;
-    int basicMod(const int a, const int b) const;
-    int basicPower(const int a, const int b) const;
+    int evaluate(RuntimeContext* context) const;
 };
 
 
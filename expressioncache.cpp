@@ -0,0 +1,40 @@
+#include "expressioncache.h"
+
+#include "expression.h"
+
+ExpressionCache::ExpressionCache(size_t capacity) : capacity(capacity) {}
+
+ExpressionCache::~ExpressionCache()
+{
+    clear();
+}
+
+// 解析出错时与Expression::newExpFromStr一样抛出异常，不缓存
+Expression* ExpressionCache::get(const std::string& text)
+{
+    auto it = index.find(text);
+    if (it != index.end())
+    {
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->expression;
+    }
+
+    Expression* expression = Expression::newExpFromStr(text);
+    if (entries.size() == capacity)
+    {
+        index.erase(entries.back().text);
+        delete entries.back().expression;
+        entries.pop_back();
+    }
+    entries.push_front( {text, expression} );
+    index[text] = entries.begin();
+    return expression;
+}
+
+void ExpressionCache::clear()
+{
+    for (auto& entry : entries)
+        delete entry.expression;
+    entries.clear();
+    index.clear();
+}
@@ -0,0 +1,34 @@
+#ifndef EXPRESSIONCACHE_H
+#define EXPRESSIONCACHE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+class Expression;
+
+// 按源码缓存解析好的表达式，超过容量时淘汰最久未使用的一个；缓存持有表达式
+class ExpressionCache
+{
+private:
+    static const size_t DEFAULT_CAPACITY = 64;
+
+    struct Entry
+    {
+        std::string text;
+        Expression* expression;
+    };
+
+    size_t capacity;
+    // 最近使用的在前
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+public:
+    ExpressionCache(size_t capacity = DEFAULT_CAPACITY);
+    ~ExpressionCache();
+    Expression* get(const std::string& text);
+    void clear();
+};
+
+#endif // EXPRESSIONCACHE_H
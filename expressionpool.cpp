@@ -0,0 +1,260 @@
+#include "expressionpool.h"
+
+#include "expression.h"
+#include "runtimecontext.h"
+#include "symboltable.h"
+
+const uint32_t ExpressionPool::NO_NODE;
+
+ExpressionPool::ExpressionPool(bool specialize)
+    : specialize(specialize) {}
+
+// 先序加入整棵树，返回根节点下标；树上每个节点的poolIndex随之更新
+uint32_t ExpressionPool::add(Expression* expression)
+{
+    uint32_t node = kinds.size();
+    kinds.push_back(CONSTANT);
+    operands.push_back(0);
+    rights.push_back(NO_NODE);
+    expression->poolIndex = node;
+
+    if (ConstantExp* constantExp = dynamic_cast<ConstantExp*>(expression))
+    {
+        operands[node] = constantExp->value;
+    }
+    else if (IdentifierExp* identifierExp = dynamic_cast<IdentifierExp*>(expression))
+    {
+        kinds[node] = IDENTIFIER;
+        operands[node] = identifierExp->varId;
+    }
+    else if (IndexExp* indexExp = dynamic_cast<IndexExp*>(expression))
+    {
+        kinds[node] = INDEX;
+        operands[node] = indexExp->varId;
+        if (indexExp->hoistedCheck)
+        {
+            rights[node] = hoistedChecks.size();
+            hoistedChecks.push_back(indexExp->hoistedCheck);
+        }
+        add(indexExp->indexExp);
+    }
+    else if (CompoundExp* compoundExp = dynamic_cast<CompoundExp*>(expression))
+    {
+        int operation = compoundExp->operation - Expression::ADD;
+        kinds[node] = ADD + operation;
+        operands[node] = compoundExp->cacheSlot;
+        add(compoundExp->leftExp);
+        uint32_t right = add(compoundExp->rightExp);
+        rights[node] = right;
+        if (specialize)
+            kinds[node] = SPECIALIZED + (operation * OPERAND_SHAPE_CNT + shapeOf(node + 1)) * OPERAND_SHAPE_CNT
+                          + shapeOf(right);
+    }
+    return node;
+}
+
+// 全部加入之后释放数组多余的容量，池的大小只与节点数有关
+void ExpressionPool::compact()
+{
+    kinds.shrink_to_fit();
+    operands.shrink_to_fit();
+    rights.shrink_to_fit();
+    hoistedChecks.shrink_to_fit();
+}
+
+// 与各表达式类的getValue逐节点对应：计数、缓存和边界检查的行为都相同
+int ExpressionPool::evaluate(uint32_t node, RuntimeContext* context) const
+{
+    context->countEval();
+    switch (kinds[node])
+    {
+        case CONSTANT:
+            return operands[node];
+        case IDENTIFIER:
+            return context->getVarValue(operands[node]);
+        case INDEX:
+        {
+            int index = evaluate(node + 1, context);
+            if (isCheckHoisted(node))
+                return context->getArrayValueUnchecked(operands[node], index);
+            return context->getArrayValue(operands[node], index);
+        }
+        default:
+            break;
+    }
+    if (kinds[node] >= SPECIALIZED)
+        return specializedEvaluators[kinds[node] - SPECIALIZED](*this, node, context);
+
+    int cacheSlot = operands[node];
+    if (cacheSlot < 0)
+        return combine(node, context);
+
+    int value;
+    if (context->getCachedValue(cacheSlot, value))
+        return value;
+
+    value = combine(node, context);
+    context->setCachedValue(cacheSlot, value);
+    return value;
+}
+
+// 对应IndexExp::setValue，node必须是数组节点
+void ExpressionPool::store(uint32_t node, RuntimeContext* context, const int value) const
+{
+    int index = evaluate(node + 1, context);
+    if (isCheckHoisted(node))
+        context->setArrayValueUnchecked(operands[node], index, value);
+    else
+        context->setArrayValue(operands[node], index, value);
+}
+
+void ExpressionPool::writeSyntaxTree(uint32_t node, std::string& out, int indent) const
+{
+    out.append(indent, ' ');
+    switch (operationOf(kinds[node]))
+    {
+        case CONSTANT:
+            Expression::appendNumber(out, operands[node]);
+            return;
+        case IDENTIFIER:
+            out += SymbolTable::instance().nameOf(operands[node]);
+            return;
+        case INDEX:
+            out += SymbolTable::instance().nameOf(operands[node]);
+            out += "()\n";
+            writeSyntaxTree(node + 1, out, indent + 4);
+            return;
+        case ADD: out += "+"; break;
+        case SUB: out += "-"; break;
+        case MUL: out += "*"; break;
+        case DIV: out += "/"; break;
+        case MOD: out += "MOD"; break;
+        case POW: out += "**"; break;
+    }
+    out += "\n";
+    writeSyntaxTree(node + 1, out, indent + 4);
+    out += "\n";
+    writeSyntaxTree(rights[node], out, indent + 4);
+}
+
+int ExpressionPool::combine(uint32_t node, RuntimeContext* context) const
+{
+    int leftValue = evaluate(node + 1, context);
+    int rightValue = evaluate(rights[node], context);
+
+    try
+    {
+        switch (kinds[node])
+        {
+            case ADD: return leftValue + rightValue;
+            case SUB: return leftValue - rightValue;
+            case MUL: return leftValue * rightValue;
+            case DIV: return CompoundExp::basicDivide(leftValue, rightValue);
+            case MOD: return CompoundExp::basicMod(leftValue, rightValue);
+            case POW: return CompoundExp::basicPower(leftValue, rightValue);
+        }
+    }
+    catch (const char* errMsg)
+    {
+        context->throwError(errMsg);
+    }
+    return 0;
+}
+
+bool ExpressionPool::isCheckHoisted(uint32_t node) const
+{
+    return rights[node] != NO_NODE && *hoistedChecks[rights[node]];
+}
+
+ExpressionPool::OperandShape ExpressionPool::shapeOf(uint32_t node) const
+{
+    if (kinds[node] == CONSTANT)
+        return CONSTANT_OPERAND;
+    if (kinds[node] == IDENTIFIER)
+        return VARIABLE_OPERAND;
+    return GENERIC_OPERAND;
+}
+
+uint8_t ExpressionPool::operationOf(uint8_t kind)
+{
+    if (kind < SPECIALIZED)
+        return kind;
+    return ADD + (kind - SPECIALIZED) / (OPERAND_SHAPE_CNT * OPERAND_SHAPE_CNT);
+}
+
+// 常量和变量操作数就地读取，计数与evaluate相同
+template <int SHAPE>
+int ExpressionPool::readOperand(uint32_t node, RuntimeContext* context) const
+{
+    if (SHAPE == CONSTANT_OPERAND)
+    {
+        context->countEval();
+        return operands[node];
+    }
+    if (SHAPE == VARIABLE_OPERAND)
+    {
+        context->countEval();
+        return context->getVarValue(operands[node]);
+    }
+    return evaluate(node, context);
+}
+
+// 与evaluate中运算节点的部分逐步对应，节点本身已经计数
+template <int OP, int LEFT, int RIGHT>
+int ExpressionPool::evaluateSpecialized(const ExpressionPool& pool, uint32_t node, RuntimeContext* context)
+{
+    int cacheSlot = pool.operands[node];
+    int value = 0;
+    if (cacheSlot >= 0 && context->getCachedValue(cacheSlot, value))
+        return value;
+
+    int leftValue = pool.readOperand<LEFT>(node + 1, context);
+    int rightValue = pool.readOperand<RIGHT>(pool.rights[node], context);
+    switch (OP)
+    {
+        case ADD: value = leftValue + rightValue; break;
+        case SUB: value = leftValue - rightValue; break;
+        case MUL: value = leftValue * rightValue; break;
+        default:
+            try
+            {
+                if (OP == DIV)
+                    value = CompoundExp::basicDivide(leftValue, rightValue);
+                else if (OP == MOD)
+                    value = CompoundExp::basicMod(leftValue, rightValue);
+                else
+                    value = CompoundExp::basicPower(leftValue, rightValue);
+            }
+            catch (const char* errMsg)
+            {
+                context->throwError(errMsg);
+            }
+            break;
+    }
+
+    if (cacheSlot >= 0)
+        context->setCachedValue(cacheSlot, value);
+    return value;
+}
+
+// 按种类的编号顺序排列：运算、左操作数形式、右操作数形式
+#define SPECIALIZED_BY_RIGHT(OP, LEFT) \
+    &ExpressionPool::evaluateSpecialized<OP, LEFT, GENERIC_OPERAND>, \
+    &ExpressionPool::evaluateSpecialized<OP, LEFT, CONSTANT_OPERAND>, \
+    &ExpressionPool::evaluateSpecialized<OP, LEFT, VARIABLE_OPERAND>
+#define SPECIALIZED_BY_OPERANDS(OP) \
+    SPECIALIZED_BY_RIGHT(OP, GENERIC_OPERAND), \
+    SPECIALIZED_BY_RIGHT(OP, CONSTANT_OPERAND), \
+    SPECIALIZED_BY_RIGHT(OP, VARIABLE_OPERAND)
+
+const ExpressionPool::Evaluator ExpressionPool::specializedEvaluators[] = {
+    SPECIALIZED_BY_OPERANDS(ADD),
+    SPECIALIZED_BY_OPERANDS(SUB),
+    SPECIALIZED_BY_OPERANDS(MUL),
+    SPECIALIZED_BY_OPERANDS(DIV),
+    SPECIALIZED_BY_OPERANDS(MOD),
+    SPECIALIZED_BY_OPERANDS(POW)
+};
+
+#undef SPECIALIZED_BY_OPERANDS
+#undef SPECIALIZED_BY_RIGHT
@@ -0,0 +1,80 @@
+#ifndef EXPRESSIONPOOL_H
+#define EXPRESSIONPOOL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Expression;
+class RuntimeContext;
+
+/*
+ * 整个程序的表达式按结构数组存放：每个节点占种类、操作数和右孩子下标三个数组中的同一格，
+ * 节点按先序排列，左孩子（数组的下标表达式）总是紧跟在父节点之后，右孩子用32位下标引用。
+ * 操作数对常量是值，对变量和数组是变量ID，对运算是公共子表达式缓存槽；
+ * 数组节点的右孩子位置存放边界检查外提结果的下标。
+ * 表达式树仍是程序的原始形式，池在优化之后从树生成，树上的poolIndex指回池中的节点。
+ * 池是树之外的第二份表示，内存只增不减：每个节点多占9字节。poolIndex使运算节点由32字节变为40字节，
+ * 但在glibc中两者都按48字节分配，实际没有增加。4万行、约130万个节点的程序，加载后堆上约53MB，
+ * 池再增加约11MB；QBASIC-test中的程序差别不到1KB。池换来的是求值时连续的访存，而不是更少的内存。
+ * 开启特化时运算节点的种类还记下左右操作数是常量、变量还是其他表达式，求值时按种类直接调用
+ * 为这种组合生成的函数：运算在编译期确定，常量和变量操作数就地读取，不再经过evaluate分派。
+ */
+class ExpressionPool
+{
+public:
+    static const uint32_t NO_NODE = UINT32_MAX;
+
+private:
+    // 特化的运算节点种类为SPECIALIZED + ((运算 - ADD) * 3 + 左操作数形式) * 3 + 右操作数形式
+    typedef enum : uint8_t
+    {
+        CONSTANT = 0,
+        IDENTIFIER,
+        INDEX,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        POW,
+        SPECIALIZED
+    } NodeKind;
+
+    typedef enum
+    {
+        GENERIC_OPERAND = 0,
+        CONSTANT_OPERAND,
+        VARIABLE_OPERAND,
+        OPERAND_SHAPE_CNT
+    } OperandShape;
+
+    typedef int (*Evaluator)(const ExpressionPool& pool, uint32_t node, RuntimeContext* context);
+    static const Evaluator specializedEvaluators[];
+
+    bool specialize;
+    std::vector<uint8_t> kinds;
+    std::vector<int32_t> operands;
+    std::vector<uint32_t> rights;
+    std::vector<const bool*> hoistedChecks;
+
+public:
+    explicit ExpressionPool(bool specialize = true);
+    uint32_t add(Expression* expression);
+    void compact();
+    int evaluate(uint32_t node, RuntimeContext* context) const;
+    void store(uint32_t node, RuntimeContext* context, const int value) const;
+    void writeSyntaxTree(uint32_t node, std::string& out, int indent) const;
+
+private:
+    int combine(uint32_t node, RuntimeContext* context) const;
+    bool isCheckHoisted(uint32_t node) const;
+    OperandShape shapeOf(uint32_t node) const;
+    static uint8_t operationOf(uint8_t kind);
+    template <int SHAPE>
+    int readOperand(uint32_t node, RuntimeContext* context) const;
+    template <int OP, int LEFT, int RIGHT>
+    static int evaluateSpecialized(const ExpressionPool& pool, uint32_t node, RuntimeContext* context);
+};
+
+#endif // EXPRESSIONPOOL_H
@@ -0,0 +1,627 @@
+#include "headlessrunner.h"
+
+#include "programmanager.h"
+#include "inputqueue.h"
+#include "tracerecorder.h"
+#include "differentialrunner.h"
+#include "programgenerator.h"
+#include "coverage.h"
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <QFile>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QDir>
+#include <QFileInfo>
+
+HeadlessRunner::HeadlessRunner(const QStringList& args)
+    : args(args) {}
+
+// 在创建QApplication之前判断，其余参数（如-style、-platform）留给Qt处理
+bool HeadlessRunner::isHeadlessCommand(int argc, char* argv[])
+{
+    static const char* const commands[] = {
+        "--run", "--replay", "--diff", "--fuzz", "--bench", "--resume", "--batch", "--coverage"
+    };
+    for (int i = 1; i < argc; i++)
+    {
+        for (const char* command : commands)
+        {
+            if (strcmp(argv[i], command) == 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+int HeadlessRunner::exec()
+{
+    QString programFile, inputFile, traceFile, metricsFile, replayFile, diffFile, benchFile, resumeFile, batchFile;
+    std::vector<long long> seekSteps;
+    int fuzzCnt = 0;
+    int repeatCnt = 1;
+    int jobCnt = 0;
+    bool engineSet = false;
+    bool checkpointIntervalSet = false;
+    unsigned int seed = 1;
+
+    for (int i = 1; i < (int)args.size(); i++)
+    {
+        const QString& arg = args[i];
+        if (i + 1 >= (int)args.size())
+        {
+            printUsage();
+            return 1;
+        }
+
+        if (arg == "--run")
+            programFile = args[++i];
+        else if (arg == "--input")
+            inputFile = args[++i];
+        else if (arg == "--trace")
+            traceFile = args[++i];
+        else if (arg == "--metrics")
+            metricsFile = args[++i];
+        else if (arg == "--replay")
+            replayFile = args[++i];
+        else if (arg == "--resume")
+            resumeFile = args[++i];
+        else if (arg == "--checkpoint")
+            checkpointFile = args[++i];
+        else if (arg == "--coverage")
+            coverageFile = args[++i];
+        else if (arg == "--batch")
+            batchFile = args[++i];
+        else if (arg == "--seek")
+        {
+            bool ok;
+            long long step = args[++i].toLongLong(&ok);
+            if (!ok || step < 1)
+            {
+                std::cerr << "Invalid step: " << args[i].toStdString() << std::endl;
+                return 1;
+            }
+            seekSteps.push_back(step);
+        }
+        else if (arg == "--diff")
+            diffFile = args[++i];
+        else if (arg == "--bench")
+            benchFile = args[++i];
+        else if (arg == "--engine")
+        {
+            if (!parseEngine(args[++i], engine))
+            {
+                std::cerr << "Unknown engine: " << args[i].toStdString() << std::endl;
+                return 1;
+            }
+            engineSet = true;
+        }
+        else if (arg == "--fuzz" || arg == "--seed" || arg == "--repeat" || arg == "--checkpoint-interval"
+                 || arg == "--jobs")
+        {
+            bool ok;
+            int value = args[++i].toInt(&ok);
+            if (!ok || value < 1)
+            {
+                std::cerr << "Invalid number: " << args[i].toStdString() << std::endl;
+                return 1;
+            }
+            if (arg == "--fuzz")
+                fuzzCnt = value;
+            else if (arg == "--seed")
+                seed = value;
+            else if (arg == "--checkpoint-interval")
+            {
+                checkpointInterval = value;
+                checkpointIntervalSet = true;
+            }
+            else if (arg == "--jobs")
+                jobCnt = value;
+            else
+                repeatCnt = value;
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    bool runOptions = !traceFile.isEmpty() || !metricsFile.isEmpty() || !checkpointFile.isEmpty();
+    bool replayOptions = !seekSteps.empty();
+    int modeCnt = !programFile.isEmpty() + !replayFile.isEmpty() + !diffFile.isEmpty() + (fuzzCnt > 0)
+                  + !benchFile.isEmpty() + !resumeFile.isEmpty() + !batchFile.isEmpty();
+
+    if ((checkpointFile.isEmpty() && checkpointIntervalSet) || (batchFile.isEmpty() && jobCnt > 0)
+        || (!coverageFile.isEmpty() && programFile.isEmpty() && batchFile.isEmpty()))
+    {
+        printUsage();
+        return 1;
+    }
+    if (modeCnt == 1 && !programFile.isEmpty() && !replayOptions)
+        return run(programFile, inputFile, traceFile, metricsFile);
+    if (modeCnt == 1 && !batchFile.isEmpty() && inputFile.isEmpty() && !runOptions && !replayOptions)
+        return batch(batchFile, jobCnt);
+    if (modeCnt == 1 && !resumeFile.isEmpty() && traceFile.isEmpty() && !replayOptions)
+        return resume(resumeFile, inputFile, metricsFile);
+    if (modeCnt == 1 && !replayFile.isEmpty() && inputFile.isEmpty() && !runOptions && !engineSet)
+        return replay(replayFile, seekSteps);
+    if (modeCnt == 1 && !diffFile.isEmpty() && !runOptions && !replayOptions)
+        return diff(diffFile, inputFile);
+    if (modeCnt == 1 && fuzzCnt > 0 && inputFile.isEmpty() && !runOptions && !replayOptions)
+        return fuzz(fuzzCnt, seed);
+    if (modeCnt == 1 && !benchFile.isEmpty() && !runOptions && !replayOptions && !engineSet)
+        return bench(benchFile, inputFile, repeatCnt);
+
+    printUsage();
+    return 1;
+}
+
+int HeadlessRunner::run(const QString& programFile, const QString& inputFile, const QString& traceFile,
+                        const QString& metricsFile)
+{
+    QStringList lines;
+    if (!readLines(programFile, lines))
+        return 1;
+
+    ProgramManager pm(nullptr);
+    pm.setEngine(engine);
+    pm.addCommands(lines);
+
+    if (!inputFile.isEmpty() && !pm.getInputQueue()->loadFromFile(inputFile))
+    {
+        std::cerr << "Cannot open " << inputFile.toStdString() << std::endl;
+        return 1;
+    }
+
+    pm.analyzeCode();
+    if (!traceFile.isEmpty())
+        pm.setTracePath(traceFile.toStdString());
+    if (!checkpointFile.isEmpty())
+        pm.setCheckpointPath(checkpointFile.toStdString(), checkpointInterval);
+    pm.runCode();
+
+    // 覆盖计数在停止之前收集，没有运行完的程序也记下已经执行的部分
+    bool coverageWritten = true;
+    if (!coverageFile.isEmpty())
+    {
+        std::vector<std::string> source;
+        for (const QString& line : lines)
+            source.push_back(line.toStdString());
+        Coverage coverage;
+        coverage.addRun(QFileInfo(programFile).absoluteFilePath().toStdString(), source, pm);
+        coverageWritten = writeCoverage(coverage, coverageFile);
+    }
+    int res = finish(pm, metricsFile);
+    return coverageWritten ? res : 1;
+}
+
+// 从检查点继续运行，可以同时继续保存新的检查点
+int HeadlessRunner::resume(const QString& resumeFile, const QString& inputFile, const QString& metricsFile)
+{
+    ProgramManager pm(nullptr);
+    pm.setEngine(engine);
+    if (!inputFile.isEmpty() && !pm.getInputQueue()->loadFromFile(inputFile))
+    {
+        std::cerr << "Cannot open " << inputFile.toStdString() << std::endl;
+        return 1;
+    }
+
+    if (!checkpointFile.isEmpty())
+        pm.setCheckpointPath(checkpointFile.toStdString(), checkpointInterval);
+    if (!pm.resumeCheckpoint(resumeFile.toStdString()))
+        return 1;
+    // 没有界面时无法再发出CONT，暂停时保存的检查点直接继续运行
+    if (pm.isPaused())
+        pm.resume();
+    return finish(pm, metricsFile);
+}
+
+// 没有界面，输入不够时不会再有新的输入
+int HeadlessRunner::finish(ProgramManager& pm, const QString& metricsFile)
+{
+    bool finished = !pm.isRunning();
+    if (!finished)
+        pm.stopRunning();
+    if (!metricsFile.isEmpty() && !writeMetrics(pm, metricsFile))
+        return 1;
+    return finished ? 0 : 1;
+}
+
+// LIST中的相对路径相对于LIST所在的目录，#开头的行是注释。
+// 程序在主线程里依次读入和解析，运行分给各个线程，每个线程把覆盖计数收集到自己的Coverage中，
+// 全部结束后再合并，运行期间线程之间不共享可写的数据
+int HeadlessRunner::batch(const QString& listFile, int jobCnt)
+{
+    struct BatchRun
+    {
+        QString programFile;
+        QString inputFile;
+        std::vector<std::string> source;
+        std::unique_ptr<ProgramManager> pm;
+        std::vector<ProgramManager::OutputRecord> messages;
+        bool finished = false;
+        bool failed = false;
+    };
+
+    QStringList entries;
+    if (!readLines(listFile, entries))
+        return 1;
+
+    std::vector<QStringList> fieldsList;
+    for (const QString& entry : entries)
+    {
+        QStringList fields = entry.split(' ', Qt::SkipEmptyParts);
+        if (fields.isEmpty() || fields[0].startsWith('#'))
+            continue;
+        if (fields.size() > 2)
+        {
+            std::cerr << "Invalid batch entry: " << entry.toStdString() << std::endl;
+            return 1;
+        }
+        fieldsList.push_back(fields);
+    }
+
+    // 输出捕获记录的是地址，先定好所有运行再逐个准备
+    QDir listDir = QFileInfo(listFile).absoluteDir();
+    std::vector<BatchRun> runs(fieldsList.size());
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        BatchRun& run = runs[i];
+        run.programFile = listDir.absoluteFilePath(fieldsList[i][0]);
+        if (fieldsList[i].size() > 1)
+            run.inputFile = listDir.absoluteFilePath(fieldsList[i][1]);
+
+        QStringList lines;
+        std::vector<int> inputs;
+        if (!readLines(run.programFile, lines) || !readInputs(run.inputFile, inputs))
+            return 1;
+        for (const QString& line : lines)
+            run.source.push_back(line.toStdString());
+
+        // 程序的输出不显示，只留下警告和运行时错误
+        run.pm.reset(new ProgramManager(nullptr));
+        run.pm->setEngine(engine);
+        run.pm->setOutputMuted(true);
+        run.pm->setOutputCapture(&run.messages);
+        run.pm->addCommands(lines);
+        run.pm->getInputQueue()->pushAll(inputs);
+        run.pm->analyzeCode();
+    }
+
+    if (jobCnt == 0)
+        jobCnt = std::thread::hardware_concurrency();
+    jobCnt = std::max(1, std::min(jobCnt, (int)runs.size()));
+    std::vector<Coverage> coverages(jobCnt);
+    std::atomic<size_t> nextRun(0);
+    bool collectCoverage = !coverageFile.isEmpty();
+
+    auto work = [&runs, &coverages, &nextRun, collectCoverage](int job) {
+        size_t i;
+        while ((i = nextRun++) < runs.size())
+        {
+            BatchRun& run = runs[i];
+            run.pm->runCode();
+            run.finished = !run.pm->isRunning();
+            if (collectCoverage)
+                coverages[job].addRun(run.programFile.toStdString(), run.source, *run.pm);
+            if (!run.finished)
+                run.pm->stopRunning();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int job = 1; job < jobCnt; job++)
+        workers.emplace_back(work, job);
+    work(0);
+    for (auto& worker : workers)
+        worker.join();
+
+    // 运行时错误也会让程序停下，单独报告
+    int finishedCnt = 0;
+    for (BatchRun& run : runs)
+    {
+        for (const auto& message : run.messages)
+            run.failed = run.failed || message.text.compare(0, 15, "[Runtime Error]") == 0;
+
+        std::cout << "[Batch] " << run.programFile.toStdString();
+        if (!run.inputFile.isEmpty())
+            std::cout << " < " << run.inputFile.toStdString();
+        std::cout << ": " << (run.failed ? "runtime error" : run.finished ? "finished" : "did not finish") << ", "
+                  << run.pm->getMetrics().statements << " statements" << std::endl;
+        for (const auto& message : run.messages)
+            std::cout << "  " << message.text << std::endl;
+        finishedCnt += run.finished && !run.failed;
+    }
+    std::cout << "[Batch] " << finishedCnt << " of " << runs.size() << " programs finished" << std::endl;
+
+    if (collectCoverage)
+    {
+        for (int job = 1; job < jobCnt; job++)
+            coverages[0].merge(coverages[job]);
+        if (!writeCoverage(coverages[0], coverageFile))
+            return 1;
+    }
+    return finishedCnt == (int)runs.size() ? 0 : 1;
+}
+
+bool HeadlessRunner::writeMetrics(const ProgramManager& pm, const QString& metricsFile)
+{
+    std::string json = pm.getMetrics().toJson();
+    if (metricsFile == "-")
+    {
+        std::cout << json;
+        return true;
+    }
+
+    std::ofstream fout(metricsFile.toStdString());
+    if (!fout)
+    {
+        std::cerr << "Cannot open " << metricsFile.toStdString() << std::endl;
+        return false;
+    }
+    fout << json;
+    return true;
+}
+
+// 已有的跟踪文件先读入再累加，多次运行的结果合并在同一个文件中
+bool HeadlessRunner::writeCoverage(const Coverage& coverage, const QString& coverageFile)
+{
+    Coverage total;
+    if (QFile::exists(coverageFile) && !total.load(coverageFile.toStdString()))
+    {
+        std::cerr << "Cannot read coverage " << coverageFile.toStdString() << std::endl;
+        return false;
+    }
+    total.merge(coverage);
+    if (!total.write(coverageFile.toStdString()))
+    {
+        std::cerr << "Cannot open " << coverageFile.toStdString() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int HeadlessRunner::replay(const QString& traceFile, const std::vector<long long>& seekSteps)
+{
+    TraceReader reader;
+    if (!reader.open(traceFile.toStdString()))
+    {
+        std::cerr << "Cannot read trace " << traceFile.toStdString() << std::endl;
+        return 1;
+    }
+
+    ProgramManager pm(nullptr);
+    loadSource(pm, reader.getSource());
+    pm.getInputQueue()->pushAll(reader.getInputs());
+    pm.setTraceReader(&reader);
+
+    if (seekSteps.empty())
+    {
+        pm.runCode();
+        if (pm.isRunning())
+            pm.stopRunning();
+        if (!reader.isFinished())
+        {
+            std::cout << "[Replay] Stopped at step " << reader.getStep() << " before the end of the trace" << std::endl;
+            return 1;
+        }
+        std::cout << "[Replay] " << reader.getStep() << " steps matched the trace" << std::endl;
+        return 0;
+    }
+
+    pm.setOutputMuted(true);
+    for (long long step : seekSteps)
+    {
+        pm.seekTrace(step);
+        if (!pm.isPaused())
+        {
+            std::cout << "[Replay] Trace has only " << reader.getStep() << " steps" << std::endl;
+            pm.setTraceReader(nullptr);
+            return 1;
+        }
+    }
+    pm.setTraceReader(nullptr);
+    pm.stopRunning();
+    return 0;
+}
+
+int HeadlessRunner::diff(const QString& programFile, const QString& inputFile)
+{
+    QStringList lines;
+    std::vector<int> inputs;
+    if (!readLines(programFile, lines) || !readInputs(inputFile, inputs))
+        return 1;
+
+    std::vector<std::string> source;
+    for (const QString& line : lines)
+        source.push_back(line.toStdString());
+
+    // 开启死循环检测时不会使用虚拟机和轨迹编译，待测引擎实际上没有运行，对拍时不开启
+    ProgramManager::ExecutionLimits limits;
+    DifferentialRunner::Result res = DifferentialRunner(source, inputs, limits, engine).run();
+    printDiffResult(res);
+    return res.agree ? 0 : 1;
+}
+
+// 随机程序可能是死循环，两个引擎在同一个语句数上停下
+int HeadlessRunner::fuzz(int programCnt, unsigned int seed)
+{
+    ProgramManager::ExecutionLimits limits;
+    limits.maxStatements = FUZZ_STATEMENT_LIMIT;
+    ProgramGenerator generator(seed);
+
+    for (int i = 0; i < programCnt; i++)
+    {
+        std::vector<std::string> source = generator.generate(FUZZ_PROGRAM_SIZE);
+        DifferentialRunner::Result res = DifferentialRunner(source, {}, limits, engine).run();
+        if (!res.agree)
+        {
+            std::cout << "[Diff] Program #" << i + 1 << " (seed " << seed << "):" << std::endl;
+            for (const auto& line : source)
+                std::cout << line << std::endl;
+            printDiffResult(res);
+            return 1;
+        }
+    }
+
+    std::cout << "[Diff] Engines agree on " << programCnt << " random programs" << std::endl;
+    return 0;
+}
+
+// 每个引擎各用一个新的ProgramManager，只计运行时间，不含解析和分析；
+// 第0次运行不计时，原生代码在这一次编译并缓存下来。
+// generic一项是表达式池不特化运算节点的optimizing，与optimizing对比可以看出特化的收益
+int HeadlessRunner::bench(const QString& programFile, const QString& inputFile, int repeatCnt)
+{
+    QStringList lines;
+    std::vector<int> inputs;
+    if (!readLines(programFile, lines) || !readInputs(inputFile, inputs))
+        return 1;
+
+    struct BenchEngine
+    {
+        const char* name;
+        ProgramManager::EngineType engine;
+        bool specializeNodes;
+    };
+    const BenchEngine engines[] = {
+        {"reference", ProgramManager::REFERENCE_ENGINE, true},
+        {"generic", ProgramManager::OPTIMIZING_ENGINE, false},
+        {"optimizing", ProgramManager::OPTIMIZING_ENGINE, true},
+        {"vm", ProgramManager::REGISTER_VM_ENGINE, true},
+        {"native", ProgramManager::NATIVE_ENGINE, true}
+    };
+
+    double referenceMillis = 0;
+    for (const auto& entry : engines)
+    {
+        qint64 totalNsecs = 0;
+        long long statements = 0;
+        for (int i = 0; i <= repeatCnt; i++)
+        {
+            ProgramManager pm(nullptr);
+            pm.setEngine(entry.engine);
+            pm.setOutputMuted(true);
+            pm.setNodeSpecialization(entry.specializeNodes);
+            pm.addCommands(lines);
+            pm.getInputQueue()->pushAll(inputs);
+            pm.analyzeCode();
+
+            QElapsedTimer timer;
+            timer.start();
+            pm.runCode();
+            if (i > 0)
+                totalNsecs += timer.nsecsElapsed();
+
+            if (pm.isRunning())
+            {
+                pm.stopRunning();
+                std::cerr << "Program did not finish: not enough input" << std::endl;
+                return 1;
+            }
+            statements = pm.getMetrics().statements;
+        }
+
+        double millis = totalNsecs / 1e6 / repeatCnt;
+        if (entry.engine == ProgramManager::REFERENCE_ENGINE)
+            referenceMillis = millis;
+        std::cout << "[Bench] " << entry.name << ": " << std::fixed << std::setprecision(3) << millis << " ms, "
+                  << (long long)(millis > 0 ? statements * 1000 / millis : 0) << " statements/s, "
+                  << std::setprecision(2) << (millis > 0 ? referenceMillis / millis : 0) << "x" << std::endl;
+    }
+    return 0;
+}
+
+bool HeadlessRunner::readLines(const QString& fileName, QStringList& lines)
+{
+    QFile file(fileName);
+    QTextStream fin(&file);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        std::cerr << "Cannot open " << fileName.toStdString() << std::endl;
+        return false;
+    }
+
+    while (!fin.atEnd())
+        lines.append(fin.readLine().trimmed());
+    file.close();
+    return true;
+}
+
+// 没有指定输入文件时输入为空
+bool HeadlessRunner::readInputs(const QString& inputFile, std::vector<int>& inputs)
+{
+    if (inputFile.isEmpty())
+        return true;
+
+    InputQueue queue;
+    if (!queue.loadFromFile(inputFile))
+    {
+        std::cerr << "Cannot open " << inputFile.toStdString() << std::endl;
+        return false;
+    }
+    int value;
+    while (queue.pop(value))
+        inputs.push_back(value);
+    return true;
+}
+
+bool HeadlessRunner::parseEngine(const QString& name, ProgramManager::EngineType& engine)
+{
+    if (name == "optimizing")
+        engine = ProgramManager::OPTIMIZING_ENGINE;
+    else if (name == "reference")
+        engine = ProgramManager::REFERENCE_ENGINE;
+    else if (name == "vm")
+        engine = ProgramManager::REGISTER_VM_ENGINE;
+    else if (name == "native")
+        engine = ProgramManager::NATIVE_ENGINE;
+    else
+        return false;
+    return true;
+}
+
+void HeadlessRunner::printDiffResult(const DifferentialRunner::Result& res)
+{
+    if (res.agree)
+        std::cout << "[Diff] Engines agree" << std::endl;
+    else if (res.lineIndex == -1)
+        std::cout << "[Diff] Engines diverge: " << res.reason << std::endl;
+    else
+        std::cout << "[Diff] Engines diverge at line " << res.lineIndex << ": " << res.reason << std::endl;
+}
+
+void HeadlessRunner::loadSource(ProgramManager& pm, const std::string& source)
+{
+    std::stringstream in(source);
+    std::string line;
+    QStringList lines;
+    while (std::getline(in, line))
+        lines.append(QString::fromStdString(line).trimmed());
+    pm.addCommands(lines);
+    pm.analyzeCode();
+}
+
+void HeadlessRunner::printUsage()
+{
+    std::cerr << "Usage:\n"
+              << "  MiniBasic --run FILE [--input FILE] [--trace FILE] [--metrics FILE] [--engine ENGINE]\n"
+              << "                  [--checkpoint FILE [--checkpoint-interval N]] [--coverage FILE]\n"
+              << "  MiniBasic --batch LIST [--jobs N] [--engine ENGINE] [--coverage FILE]\n"
+              << "  MiniBasic --resume FILE [--input FILE] [--metrics FILE] [--engine ENGINE]\n"
+              << "                     [--checkpoint FILE [--checkpoint-interval N]]\n"
+              << "  MiniBasic --replay FILE [--seek STEP ...]\n"
+              << "  MiniBasic --diff FILE [--input FILE] [--engine ENGINE]\n"
+              << "  MiniBasic --fuzz COUNT [--seed SEED] [--engine ENGINE]\n"
+              << "  MiniBasic --bench FILE [--input FILE] [--repeat N]\n"
+              << "ENGINE is optimizing (default), reference, vm or native" << std::endl;
+}
@@ -0,0 +1,64 @@
+#ifndef HEADLESSRUNNER_H
+#define HEADLESSRUNNER_H
+
+#include <QString>
+#include <QStringList>
+#include "differentialrunner.h"
+#include "programmanager.h"
+
+class Coverage;
+
+/*
+ * 无界面运行：
+ *   --run FILE [--input FILE] [--trace FILE] [--metrics FILE]
+ *                                              运行程序，可选地记录执行轨迹，结束后把运行统计写成JSON（FILE为-时写到标准输出）
+ *   --batch LIST [--jobs N]                    LIST每行是一个程序和可选的输入文件，用N个线程并行运行，只报告结果
+ *   --resume FILE [--input FILE] [--metrics FILE]
+ *                                              从检查点继续运行
+ *   --replay FILE [--seek N ...]               按轨迹重新执行并逐步校验，或定位到第N步后显示变量
+ *   --diff FILE [--input FILE]                 在基准引擎和优化引擎上对拍
+ *   --fuzz COUNT [--seed SEED]                 生成COUNT个随机程序逐个对拍，遇到第一个不一致的程序时输出它
+ *   --bench FILE [--input FILE] [--repeat N]   在每个引擎上各运行N次，比较用时
+ * --engine optimizing|reference|vm|native 指定--run使用的引擎，或--diff/--fuzz中与基准引擎对拍的引擎
+ * --checkpoint FILE [--checkpoint-interval N] 在--run和--resume中每执行N条语句把运行状态保存到FILE
+ * --coverage FILE 在--run和--batch结束后把行覆盖和分支覆盖按lcov格式累加到FILE
+ */
+class HeadlessRunner
+{
+private:
+    static const int FUZZ_PROGRAM_SIZE = 30;
+    static const long long FUZZ_STATEMENT_LIMIT = 10000;
+    static const int DEFAULT_CHECKPOINT_INTERVAL = 1000000;
+
+    QStringList args;
+    ProgramManager::EngineType engine = ProgramManager::OPTIMIZING_ENGINE;
+    QString checkpointFile;
+    int checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL;
+    QString coverageFile;
+
+public:
+    HeadlessRunner(const QStringList& args);
+    int exec();
+    static bool isHeadlessCommand(int argc, char* argv[]);
+
+private:
+    int run(const QString& programFile, const QString& inputFile, const QString& traceFile,
+            const QString& metricsFile);
+    int resume(const QString& resumeFile, const QString& inputFile, const QString& metricsFile);
+    int finish(ProgramManager& pm, const QString& metricsFile);
+    int batch(const QString& listFile, int jobCnt);
+    int replay(const QString& traceFile, const std::vector<long long>& seekSteps);
+    int diff(const QString& programFile, const QString& inputFile);
+    int fuzz(int programCnt, unsigned int seed);
+    int bench(const QString& programFile, const QString& inputFile, int repeatCnt);
+    static bool readLines(const QString& fileName, QStringList& lines);
+    static bool readInputs(const QString& inputFile, std::vector<int>& inputs);
+    static bool parseEngine(const QString& name, ProgramManager::EngineType& engine);
+    static void printDiffResult(const DifferentialRunner::Result& res);
+    static void loadSource(ProgramManager& pm, const std::string& source);
+    static bool writeMetrics(const ProgramManager& pm, const QString& metricsFile);
+    static bool writeCoverage(const Coverage& coverage, const QString& coverageFile);
+    static void printUsage();
+};
+
+#endif // HEADLESSRUNNER_H
@@ -0,0 +1,61 @@
+#include "inputqueue.h"
+
+#include <QFile>
+#include <QTextStream>
+
+InputQueue::InputQueue(QObject* parent)
+    : QObject(parent) {}
+
+void InputQueue::push(int value)
+{
+    values.push_back(value);
+    emit inputAvailable();
+}
+
+void InputQueue::pushAll(const std::vector<int>& newValues)
+{
+    if (newValues.empty())
+        return;
+    values.insert(values.end(), newValues.begin(), newValues.end());
+    emit inputAvailable();
+}
+
+// 文件中是以空白分隔的整数
+bool InputQueue::loadFromFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+
+    QTextStream fin(&file);
+    std::vector<int> newValues;
+    while (true)
+    {
+        QString token;
+        fin >> token;
+        if (token.isEmpty())
+            break;
+
+        bool ok = false;
+        int value = token.toInt(&ok);
+        if (!ok)
+            return false;
+        newValues.push_back(value);
+    }
+
+    pushAll(newValues);
+    return true;
+}
+
+bool InputQueue::pop(int& value)
+{
+    if (values.empty())
+        return false;
+    value = values.front();
+    values.pop_front();
+    return true;
+}
+
+void InputQueue::clear() { values.clear(); }
+size_t InputQueue::size() const { return values.size(); }
+bool InputQueue::isEmpty() const { return values.empty(); }
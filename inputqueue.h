@@ -0,0 +1,31 @@
+#ifndef INPUTQUEUE_H
+#define INPUTQUEUE_H
+
+#include <deque>
+#include <vector>
+#include <QObject>
+#include <QString>
+
+// INPUT语句的输入来源，可以交互输入，也可以预先从文件或列表中填入
+class InputQueue : public QObject
+{
+    Q_OBJECT
+
+private:
+    std::deque<int> values;
+
+public:
+    InputQueue(QObject* parent = nullptr);
+    void push(int value);
+    void pushAll(const std::vector<int>& newValues);
+    bool loadFromFile(const QString& fileName);
+    bool pop(int& value);
+    void clear();
+    size_t size() const;
+    bool isEmpty() const;
+
+signals:
+    void inputAvailable();
+};
+
+#endif // INPUTQUEUE_H
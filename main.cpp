@@ -1,9 +1,19 @@
 #include "mainwindow.h"
+#include "headlessrunner.h"
 
 #include <QApplication>
+#include <QCoreApplication>
 
 int main(int argc, char *argv[])
 {
+    // 只有带无界面运行的命令时才不启动界面
+    if (HeadlessRunner::isHeadlessCommand(argc, argv))
+    {
+        QCoreApplication a(argc, argv);
+        HeadlessRunner runner(a.arguments());
+        return runner.exec();
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
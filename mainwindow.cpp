@@ -2,8 +2,10 @@
 #include "ui_mainwindow.h"
 
 #include "programmanager.h"
+#include "inputqueue.h"
 
 #include <QFileDialog>
+#include <QScrollBar>
 #include <qmessagebox.h>
 
 MainWindow::MainWindow(QWidget *parent)
@@ -12,34 +14,84 @@ MainWindow::MainWindow(QWidget *parent)
     , pm(new ProgramManager(ui))
 {
     ui->setupUi(this);
+
+    ProgramManager::ExecutionLimits limits;
+    limits.detectInfiniteLoops = true;
+    pm->setExecutionLimits(limits);
+
+    // 语法树在显示出来时才生成，滚动到已生成部分的末尾时接着生成
+    ui->treeDisplay->installEventFilter(this);
+    QScrollBar* treeScrollBar = ui->treeDisplay->verticalScrollBar();
+    connect(treeScrollBar, &QScrollBar::valueChanged, this, [this, treeScrollBar](int value) {
+        if (value >= treeScrollBar->maximum() - treeScrollBar->pageStep())
+            pm->extendSyntaxTree();
+    });
 }
 
 MainWindow::~MainWindow()
 {
+    ui->treeDisplay->removeEventFilter(this);
     delete ui;
     delete pm;
 }
 
+bool MainWindow::eventFilter(QObject* watched, QEvent* event)
+{
+    if (watched == ui->treeDisplay && event->type() == QEvent::Show)
+        pm->showSyntaxTree();
+    return QMainWindow::eventFilter(watched, event);
+}
+
+// 等待输入时，以数字开头但不是整数的一行（如“35 PRINT X”）当作修改程序，其余都是输入
+static bool isProgramEdit(const QString& text)
+{
+    QString trimmed = text.trimmed();
+    bool isNumber = false;
+    trimmed.toInt(&isNumber);
+    return !trimmed.isEmpty() && trimmed[0].isDigit() && !isNumber;
+}
+
+// 等待输入时只接受APPLY、CHECKPOINT和设置断点、监视点的调试命令，其余都当作输入或修改
+static bool isCommandWhileWaiting(const QString& text)
+{
+    QStringList words = text.trimmed().split(' ', Qt::SkipEmptyParts);
+    if (words.isEmpty())
+        return false;
+    QString keyword = words.first().toUpper();
+    return keyword == "APPLY" || keyword == "CHECKPOINT" || keyword == "BREAK" || keyword == "UNBREAK"
+        || keyword == "WATCH" || keyword == "UNWATCH";
+}
+
 void MainWindow::on_cmdLineEdit_editingFinished()
 {
-    QString text = ui->cmdLineEdit->text();
-    if (!pm->isRunning())
-    {
-        ui->CodeDisplay->append(text);
-        pm->addCommand(text);
-        pm->showCode();
-        pm->generateSyntaxTree();
-    }
-    else if (pm->isWaitingForInput())
+    dispatchCommand(ui->cmdLineEdit->text());
+    ui->cmdLineEdit->setText(pm->isWaitingForInput() ? " ? " : "");
+}
+
+// 依次当作调试命令、不带行号的PRINT/LET、INPUT的值处理，都不是时作为对程序的修改
+void MainWindow::dispatchCommand(const QString& text)
+{
+    QString command = text.startsWith(" ? ") ? text.mid(3) : text;
+    if ((!pm->isWaitingForInput() || isCommandWhileWaiting(text)) && pm->runDebugCommand(text))
+        return;
+    if (pm->runImmediate(command))
+        return;
+    if (pm->isWaitingForInput() && !isProgramEdit(command))
     {
-        QString valueStr;
-        if (text.startsWith(" ? "))
-            valueStr = text.mid(3);
-        else
-            valueStr = text;
-        pm->gotInput(valueStr.toInt());
+        pm->getInputQueue()->push(command.toInt());
+        return;
     }
-    ui->cmdLineEdit->setText("");
+    addProgramLine(command);
+}
+
+// 运行中（暂停或等待输入）的修改先进入新版本，APPLY之后才切换执行
+void MainWindow::addProgramLine(QString line)
+{
+    ui->CodeDisplay->append(line);
+    pm->addCommand(line);
+    pm->showCode();
+    if (!pm->isRunning())
+        pm->generateSyntaxTree();
 }
 
 void MainWindow::on_btnLoadCode_clicked()
@@ -65,20 +117,33 @@ void MainWindow::on_btnLoadCode_clicked()
 
     ui->CodeDisplay->clear();
     pm->clearCommand();
-    int lineCount = 0;
+    QStringList lines;
     while (!fin.atEnd())
-    {
-        QString line = fin.readLine().trimmed();
-        lineCount++;
-
-        pm->addCommand(line);
-    }
+        lines.append(fin.readLine().trimmed());
+    pm->addCommands(lines);
 
     pm->showCode();
 
     file.close();
     pm->generateSyntaxTree();
-    ui->textBrowser->clear();
+    ui->outputView->clear();
+    pm->analyzeCode();
+}
+
+void MainWindow::on_btnLoadInput_clicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(
+        this,
+        "加载输入数据",
+        "",
+        "文本文件 (*.txt *.in);;所有文件 (*.*)"
+        );
+
+    if (fileName.isEmpty())
+        return;
+
+    if (!pm->getInputQueue()->loadFromFile(fileName))
+        QMessageBox::warning(this, "错误", "无法读取输入文件: " + fileName);
 }
 
 void MainWindow::on_btnRunCode_clicked()
@@ -86,11 +151,42 @@ void MainWindow::on_btnRunCode_clicked()
     pm->runCode();
 }
 
+void MainWindow::on_btnStep_clicked()
+{
+    pm->step();
+}
+
+void MainWindow::on_btnContinue_clicked()
+{
+    pm->resume();
+}
+
 void MainWindow::on_btnClearCode_clicked()
 {
     ui->CodeDisplay->clear();
-    ui->textBrowser->clear();
+    ui->outputView->clear();
     ui->treeDisplay->clear();
+    ui->varDisplay->clear();
 
     pm->clearCommand();
 }
+
+void MainWindow::on_outputSearchEdit_returnPressed()
+{
+    on_btnOutputFind_clicked();
+}
+
+// 从上一个结果往后找，找到末尾后从头再找
+void MainWindow::on_btnOutputFind_clicked()
+{
+    QString text = ui->outputSearchEdit->text();
+    if (text.isEmpty())
+        return;
+    if (!ui->outputView->findNext(text))
+        ui->statusbar->showMessage("运行结果中没有找到: " + text, 3000);
+}
+
+void MainWindow::on_btnOutputEnd_clicked()
+{
+    ui->outputView->scrollToEnd();
+}
@@ -18,14 +18,26 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+protected:
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
 private slots:
     void on_cmdLineEdit_editingFinished();
     void on_btnLoadCode_clicked();
+    void on_btnLoadInput_clicked();
     void on_btnRunCode_clicked();
     void on_btnClearCode_clicked();
+    void on_btnStep_clicked();
+    void on_btnContinue_clicked();
+    void on_outputSearchEdit_returnPressed();
+    void on_btnOutputFind_clicked();
+    void on_btnOutputEnd_clicked();
 
 private:
     Ui::MainWindow* ui;
     ProgramManager* pm;
+
+    void dispatchCommand(const QString& text);
+    void addProgramLine(QString line);
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,158 @@
+#include "nativecompiler.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLibrary>
+#include <QProcess>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+
+#if defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+NativeCompiler::NativeCompiler() {}
+
+NativeCompiler::~NativeCompiler()
+{
+    if (library)
+    {
+        library->unload();
+        delete library;
+    }
+}
+
+NativeCompiler::Function NativeCompiler::build(const std::string& source, const char* symbol, std::string& error)
+{
+    QString cacheDir;
+    if (!prepareCacheDir(cacheDir, error))
+        return nullptr;
+
+    // 按源码的SHA-256命名，不同的程序不会因散列冲突加载到别人的库
+    QString hash = QString::fromLatin1(QCryptographicHash::hash(QByteArray::fromStdString(source),
+                                                                QCryptographicHash::Sha256).toHex());
+    QString libraryFile = cacheDir + "/" + hash + librarySuffix();
+
+    if (!QFile::exists(libraryFile))
+    {
+        // 源文件和编译结果都用唯一的临时名字，并发的进程和线程编译同一个程序时互不干扰
+        QTemporaryFile sourceFile(cacheDir + "/" + hash + "-XXXXXX.cpp");
+        QTemporaryFile partialFile(cacheDir + "/" + hash + "-XXXXXX.part");
+        if (!sourceFile.open() || !partialFile.open())
+        {
+            error = "Cannot write to " + cacheDir.toStdString();
+            return nullptr;
+        }
+        sourceFile.write(QByteArray::fromStdString(source));
+        sourceFile.close();
+        partialFile.close();
+
+        if (!compile(sourceFile.fileName().toStdString(), partialFile.fileName().toStdString(), error))
+            return nullptr;
+        QFile::setPermissions(partialFile.fileName(), QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner);
+        // 另一个编译者先完成时保留已有的库，临时文件随QTemporaryFile删除
+        if (QFile::rename(partialFile.fileName(), libraryFile))
+            partialFile.setAutoRemove(false);
+    }
+
+    if (!isPrivateFile(libraryFile))
+    {
+        error = "Refusing to load " + libraryFile.toStdString() + ": not owned by the current user or writable by others";
+        return nullptr;
+    }
+
+    library = new QLibrary(libraryFile);
+    if (!library->load())
+    {
+        error = library->errorString().toStdString();
+        delete library;
+        library = nullptr;
+        return nullptr;
+    }
+
+    Function entry = reinterpret_cast<Function>(library->resolve(symbol));
+    if (!entry)
+        error = std::string("Symbol ") + symbol + " not found in " + libraryFile.toStdString();
+    return entry;
+}
+
+// 编译结果缓存在用户自己的缓存目录中（权限0700），不放在所有人都能写的临时目录里
+bool NativeCompiler::prepareCacheDir(QString& cacheDir, std::string& error)
+{
+    QString baseDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (baseDir.isEmpty())
+    {
+        error = "No cache directory for native code";
+        return false;
+    }
+
+    cacheDir = baseDir + "/native";
+    if (!QDir().mkpath(cacheDir)
+        || !QFile::setPermissions(cacheDir, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner))
+    {
+        error = "Cannot create " + cacheDir.toStdString();
+        return false;
+    }
+    if (!isPrivateFile(cacheDir))
+    {
+        error = cacheDir.toStdString() + " is not owned by the current user or is writable by others";
+        return false;
+    }
+    return true;
+}
+
+// 只信任当前用户自己的、其他人不能写的文件和目录；Windows上缓存目录本来就在用户自己的配置目录下
+bool NativeCompiler::isPrivateFile(const QString& fileName)
+{
+    QFileInfo info(fileName);
+    if (!info.exists() || info.isSymLink())
+        return false;
+#if defined(Q_OS_UNIX)
+    if (info.ownerId() != ::getuid() || (info.permissions() & (QFile::WriteGroup | QFile::WriteOther)))
+        return false;
+#endif
+    return true;
+}
+
+bool NativeCompiler::compile(const std::string& sourceFile, const std::string& libraryFile, std::string& error)
+{
+    QString compiler = QString::fromLocal8Bit(qgetenv("CXX"));
+    if (compiler.isEmpty())
+        compiler = "c++";
+
+    // 有符号溢出按补码回绕，与解释执行时的实际结果一致；GNU模式下不处理三字符组
+    QStringList args;
+    args << "-std=gnu++11" << "-O2" << "-fwrapv" << "-shared" << "-fPIC"
+         << "-o" << QString::fromStdString(libraryFile) << QString::fromStdString(sourceFile);
+
+    QProcess process;
+    process.start(compiler, args);
+    if (!process.waitForStarted())
+    {
+        error = "Cannot start " + compiler.toStdString();
+        return false;
+    }
+    process.waitForFinished(-1);
+    if (process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0)
+    {
+        QString output = QString::fromLocal8Bit(process.readAllStandardError());
+        error = compiler.toStdString() + " failed";
+        if (!output.isEmpty())
+            error += ": " + output.split('\n').first().toStdString();
+        return false;
+    }
+    return true;
+}
+
+const char* NativeCompiler::librarySuffix()
+{
+#if defined(Q_OS_WIN)
+    return ".dll";
+#elif defined(Q_OS_MAC)
+    return ".dylib";
+#else
+    return ".so";
+#endif
+}
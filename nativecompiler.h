@@ -0,0 +1,34 @@
+#ifndef NATIVECOMPILER_H
+#define NATIVECOMPILER_H
+
+#include <string>
+
+class QLibrary;
+class QString;
+
+/*
+ * 把生成的C++源码交给本机的编译器（环境变量CXX，默认c++）编译成动态库并加载。
+ * 编译结果按源码的散列值缓存在当前用户私有的缓存目录中，同一个程序再次运行时直接加载，不再调用编译器；
+ * 加载之前检查库文件和目录属于当前用户且其他人不能写。
+ */
+class NativeCompiler
+{
+public:
+    typedef void (*Function)();
+
+private:
+    QLibrary* library = nullptr;
+
+public:
+    NativeCompiler();
+    ~NativeCompiler();
+    Function build(const std::string& source, const char* symbol, std::string& error);
+
+private:
+    static bool prepareCacheDir(QString& cacheDir, std::string& error);
+    static bool isPrivateFile(const QString& fileName);
+    static bool compile(const std::string& sourceFile, const std::string& libraryFile, std::string& error);
+    static const char* librarySuffix();
+};
+
+#endif // NATIVECOMPILER_H
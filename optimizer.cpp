@@ -0,0 +1,251 @@
+#include "optimizer.h"
+
+#include "runtimecontext.h"
+#include "statement.h"
+#include "expression.h"
+#include "programanalysis.h"
+#include "programstore.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+/*
+ * 跨语句的公共子表达式消除与循环不变量外提。
+ *
+ * 以下两类复合表达式会被分配一个缓存槽：
+ *   1. 在整个程序中出现不止一次的表达式（按语法树结构判断是否相同）；
+ *   2. 位于某个GOTO/IF回边构成的循环内，且读到的变量都不在该循环内被LET/INPUT赋值的表达式。
+ * 缓存的值在其读到的任一变量被重新赋值时失效（见RuntimeContext::setVarValue），
+ * 因此即使循环的划分不精确，结果也总是正确的，只影响命中率。
+ * 不可达的语句不会被执行，直接跳过。
+ */
+void Optimizer::eliminateCommonSubexps(const ProgramStore& program,
+                                       const ProgramAnalysis& analysis, RuntimeContext* context)
+{
+    std::vector<int> expLineIndices;
+    std::vector<CompoundExp*> compoundExps;
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        int lineIndex = program.lineIndexAt(pos);
+        std::vector<Expression*> exps;
+        program.statementAt(pos)->collectExpressions(exps);
+
+        size_t oldSize = compoundExps.size();
+        for (auto exp : exps)
+            collectCompoundExps(exp, compoundExps);
+        expLineIndices.resize(compoundExps.size(), lineIndex);
+        for (size_t i = oldSize; i < compoundExps.size(); i++)
+            compoundExps[i]->cacheSlot = -1;
+
+        if (!analysis.isReachable(lineIndex))
+        {
+            compoundExps.resize(oldSize);
+            expLineIndices.resize(oldSize);
+        }
+    }
+
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, int> keyCnts;
+    for (auto exp : compoundExps)
+    {
+        keys.push_back(exp->getSyntaxTree(0));
+        keyCnts[keys.back()]++;
+    }
+
+    // 每个循环内被赋值的变量
+    const auto& loops = analysis.getLoops();
+    std::vector<std::vector<int>> loopDefinedVars(loops.size());
+    for (size_t j = 0; j < loops.size(); j++)
+    {
+        for (int lineIndex : loops[j].bodyLineIndices)
+        {
+            int varId = program.statementAt(program.find(lineIndex))->getDefinedVarId();
+            if (varId != -1)
+                loopDefinedVars[j].push_back(varId);
+        }
+    }
+
+    std::unordered_map<std::string, int> keySlots;
+    for (size_t i = 0; i < compoundExps.size(); i++)
+    {
+        std::vector<int> reads;
+        compoundExps[i]->collectIdentifiers(reads);
+
+        bool isCandidate = keyCnts[keys[i]] > 1;
+        for (size_t j = 0; j < loops.size() && !isCandidate; j++)
+        {
+            const auto& body = loops[j].bodyLineIndices;
+            if (!std::binary_search(body.begin(), body.end(), expLineIndices[i]))
+                continue;
+
+            const auto& defined = loopDefinedVars[j];
+            isCandidate = std::none_of(reads.begin(), reads.end(), [&defined](int varId) {
+                return std::find(defined.begin(), defined.end(), varId) != defined.end();
+            });
+        }
+        if (!isCandidate)
+            continue;
+
+        auto it = keySlots.find(keys[i]);
+        if (it == keySlots.end())
+            it = keySlots.emplace(keys[i], context->addCachedSubexp(reads)).first;
+        compoundExps[i]->cacheSlot = it->second;
+    }
+}
+
+/*
+ * 数组边界检查外提。
+ *
+ * 对由FOR/NEXT构成的循环，若循环体只能经由FOR进入、循环变量只被NEXT修改、
+ * 循环体内也没有重新DIM对应的数组，那么形如A(I)、A(I + c)、A(I - c)、A(c + I)的访问
+ * 在整个循环中的下标范围在FOR执行时就能确定。这些访问改为读取FOR在入口处统一检查的结果
+ * （ForStmt::boundsVerified）；检查不通过时仍逐次检查，越界错误照常在出错的语句处报告。
+ */
+void Optimizer::hoistBoundsChecks(const ProgramStore& program, const ProgramAnalysis& analysis)
+{
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        Statement* statement = program.statementAt(pos);
+        if (ForStmt* forStmt = dynamic_cast<ForStmt*>(statement))
+        {
+            forStmt->boundsGuards.clear();
+            forStmt->boundsVerified = false;
+        }
+
+        std::vector<Expression*> exps;
+        std::vector<IndexExp*> indexExps;
+        statement->collectExpressions(exps);
+        for (auto exp : exps)
+            collectIndexExps(exp, indexExps);
+        for (auto indexExp : indexExps)
+            indexExp->hoistedCheck = nullptr;
+    }
+
+    for (const auto& loop : analysis.getLoops())
+    {
+        NextStmt* nextStmt = dynamic_cast<NextStmt*>(program.statementAt(program.find(loop.latchLineIndex)));
+        if (!nextStmt || !nextStmt->loop || nextStmt->bodyLineIndex != loop.headerLineIndex)
+            continue;
+
+        ForStmt* forStmt = nextStmt->loop;
+        size_t headerPos = program.find(loop.headerLineIndex);
+        if (headerPos == 0 || program.statementAt(headerPos - 1) != forStmt)
+            continue;
+        int forLineIndex = program.lineIndexAt(headerPos - 1);
+
+        const auto& body = loop.bodyLineIndices;
+        bool safe = true;
+        std::vector<int> dimmedArrays;
+        for (int lineIndex : body)
+        {
+            for (int pred : analysis.getPredecessors(lineIndex))
+            {
+                bool fromFor = lineIndex == loop.headerLineIndex && pred == forLineIndex;
+                safe = safe && (fromFor || std::binary_search(body.begin(), body.end(), pred));
+            }
+
+            Statement* statement = program.statementAt(program.find(lineIndex));
+            if (dynamic_cast<DimStmt*>(statement))
+                dimmedArrays.push_back(statement->getDefinedVarId());
+            else if (lineIndex != loop.latchLineIndex && statement->getDefinedVarId() == forStmt->varId)
+                safe = false;
+        }
+        if (!safe)
+            continue;
+
+        for (int lineIndex : body)
+        {
+            std::vector<Expression*> exps;
+            std::vector<IndexExp*> indexExps;
+            program.statementAt(program.find(lineIndex))->collectExpressions(exps);
+            for (auto exp : exps)
+                collectIndexExps(exp, indexExps);
+
+            for (auto indexExp : indexExps)
+            {
+                int offset;
+                if (indexExp->hoistedCheck || !matchLoopIndex(indexExp->indexExp, forStmt->varId, offset)
+                    || std::count(dimmedArrays.begin(), dimmedArrays.end(), indexExp->varId))
+                    continue;
+                addBoundsGuard(forStmt, indexExp->varId, offset);
+                indexExp->hoistedCheck = &forStmt->boundsVerified;
+            }
+        }
+    }
+}
+
+void Optimizer::collectCompoundExps(Expression* exp, std::vector<CompoundExp*>& res)
+{
+    if (IndexExp* indexExp = dynamic_cast<IndexExp*>(exp))
+    {
+        collectCompoundExps(indexExp->indexExp, res);
+        return;
+    }
+
+    CompoundExp* compoundExp = dynamic_cast<CompoundExp*>(exp);
+    if (!compoundExp)
+        return;
+
+    res.push_back(compoundExp);
+    collectCompoundExps(compoundExp->leftExp, res);
+    collectCompoundExps(compoundExp->rightExp, res);
+}
+
+void Optimizer::collectIndexExps(Expression* exp, std::vector<IndexExp*>& res)
+{
+    if (IndexExp* indexExp = dynamic_cast<IndexExp*>(exp))
+    {
+        res.push_back(indexExp);
+        collectIndexExps(indexExp->indexExp, res);
+    }
+    else if (CompoundExp* compoundExp = dynamic_cast<CompoundExp*>(exp))
+    {
+        collectIndexExps(compoundExp->leftExp, res);
+        collectIndexExps(compoundExp->rightExp, res);
+    }
+}
+
+// 匹配 I、I + c、I - c、c + I
+bool Optimizer::matchLoopIndex(const Expression* exp, int loopVarId, int& offset)
+{
+    const IdentifierExp* identifierExp = dynamic_cast<const IdentifierExp*>(exp);
+    if (identifierExp)
+    {
+        offset = 0;
+        return identifierExp->varId == loopVarId;
+    }
+
+    const CompoundExp* compoundExp = dynamic_cast<const CompoundExp*>(exp);
+    if (!compoundExp || (compoundExp->operation != Expression::ADD && compoundExp->operation != Expression::SUB))
+        return false;
+
+    const IdentifierExp* leftVar = dynamic_cast<const IdentifierExp*>(compoundExp->leftExp);
+    const IdentifierExp* rightVar = dynamic_cast<const IdentifierExp*>(compoundExp->rightExp);
+    const ConstantExp* leftConst = dynamic_cast<const ConstantExp*>(compoundExp->leftExp);
+    const ConstantExp* rightConst = dynamic_cast<const ConstantExp*>(compoundExp->rightExp);
+
+    if (leftVar && leftVar->varId == loopVarId && rightConst)
+    {
+        offset = compoundExp->operation == Expression::ADD ? rightConst->value : -rightConst->value;
+        return true;
+    }
+    if (compoundExp->operation == Expression::ADD && leftConst && rightVar && rightVar->varId == loopVarId)
+    {
+        offset = leftConst->value;
+        return true;
+    }
+    return false;
+}
+
+void Optimizer::addBoundsGuard(ForStmt* forStmt, int arrayVarId, int offset)
+{
+    for (auto& guard : forStmt->boundsGuards)
+    {
+        if (guard.arrayVarId != arrayVarId)
+            continue;
+        guard.minOffset = std::min(guard.minOffset, offset);
+        guard.maxOffset = std::max(guard.maxOffset, offset);
+        return;
+    }
+    forStmt->boundsGuards.push_back( {arrayVarId, offset, offset} );
+}
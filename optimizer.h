@@ -0,0 +1,30 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+
+class RuntimeContext;
+class ProgramAnalysis;
+class ProgramStore;
+class Statement;
+class Expression;
+class CompoundExp;
+class IndexExp;
+class ForStmt;
+
+class Optimizer
+{
+public:
+    static void eliminateCommonSubexps(const ProgramStore& program,
+                                       const ProgramAnalysis& analysis, RuntimeContext* context);
+    static void hoistBoundsChecks(const ProgramStore& program, const ProgramAnalysis& analysis);
+
+private:
+    static void collectCompoundExps(Expression* exp, std::vector<CompoundExp*>& res);
+    static void collectIndexExps(Expression* exp, std::vector<IndexExp*>& res);
+    static bool matchLoopIndex(const Expression* exp, int loopVarId, int& offset);
+    static void addBoundsGuard(ForStmt* forStmt, int arrayVarId, int offset);
+};
+
+#endif // OPTIMIZER_H
@@ -0,0 +1,207 @@
+#include "outputbuffer.h"
+
+#include <algorithm>
+
+const size_t OutputBuffer::DEFAULT_CAPACITY;
+const size_t OutputBuffer::SPILL_INDEX_STRIDE;
+
+OutputBuffer::OutputBuffer(size_t capacity, bool spill)
+    : capacity(capacity > 0 ? capacity : 1), spillEnabled(spill)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    if (spillFile)
+        fclose(spillFile);
+}
+
+// 一次输出中含有换行时拆成多行，保证每个行号对应一行；末尾的换行只结束最后一行，不再多出空行
+void OutputBuffer::append(const std::string& line)
+{
+    size_t start = 0, end;
+    while ((end = line.find('\n', start)) != std::string::npos)
+    {
+        append(line.substr(start, end - start));
+        start = end + 1;
+    }
+    if (start > 0)
+    {
+        if (start < line.size())
+            append(line.substr(start));
+        return;
+    }
+
+    totalLines++;
+    if (ring.size() < capacity)
+    {
+        ring.push_back(line);
+        return;
+    }
+
+    spill(ring[head]);
+    ring[head] = line;
+    head = (head + 1) % capacity;
+}
+
+// 等待输入时提示符和输入的值显示在同一行，最后一行总在环形数组中；换行之后的内容按append另起新行
+void OutputBuffer::appendToLastLine(const std::string& text)
+{
+    if (ring.empty())
+    {
+        append(text);
+        return;
+    }
+    size_t end = text.find('\n');
+    ring[(head + ring.size() - 1) % ring.size()] += text.substr(0, end);
+    if (end != std::string::npos && end + 1 < text.size())
+        append(text.substr(end + 1));
+}
+
+void OutputBuffer::clear()
+{
+    ring.clear();
+    head = 0;
+    totalLines = 0;
+    droppedLines = 0;
+    spilledLines = 0;
+    spillIndex.clear();
+    spillSize = 0;
+    spillRead = false;
+    if (spillFile)
+    {
+        fclose(spillFile);
+        spillFile = nullptr;
+    }
+}
+
+size_t OutputBuffer::lineCount() const
+{
+    return totalLines;
+}
+
+// 更早的行已经丢弃，显示为空行
+size_t OutputBuffer::firstAvailableLine() const
+{
+    return droppedLines;
+}
+
+std::string OutputBuffer::line(size_t lineIndex) const
+{
+    size_t firstRingLine = totalLines - ring.size();
+    if (lineIndex >= totalLines || lineIndex < droppedLines)
+        return std::string();
+    if (lineIndex >= firstRingLine)
+        return ring[(head + lineIndex - firstRingLine) % ring.size()];
+    return spilledLine(lineIndex);
+}
+
+// 从fromLine开始（包含）按方向查找第一个含有text的行，找不到返回-1，不回绕
+long long OutputBuffer::find(const std::string& text, size_t fromLine, bool forward) const
+{
+    if (totalLines == 0 || text.empty())
+        return -1;
+    if (fromLine >= totalLines)
+    {
+        if (forward)
+            return -1;
+        fromLine = totalLines - 1;
+    }
+    if (fromLine < droppedLines)
+    {
+        if (!forward)
+            return -1;
+        fromLine = droppedLines;
+    }
+
+    // 溢出文件中的行按索引块整块读出，避免逐行定位
+    size_t firstRingLine = totalLines - ring.size();
+    std::vector<std::string> block;
+    long long lineIndex = fromLine;
+    while (lineIndex >= (long long)droppedLines && lineIndex < (long long)totalLines)
+    {
+        if (lineIndex >= (long long)firstRingLine)
+        {
+            if (line(lineIndex).find(text) != std::string::npos)
+                return lineIndex;
+            lineIndex += forward ? 1 : -1;
+            continue;
+        }
+
+        size_t blockStart = lineIndex / SPILL_INDEX_STRIDE * SPILL_INDEX_STRIDE;
+        size_t blockEnd = std::min(blockStart + SPILL_INDEX_STRIDE, spilledLines);
+        block.clear();
+        readSpilledBlock(blockStart, blockEnd - blockStart, block);
+        if (block.size() < blockEnd - blockStart)
+            return -1;
+        while (lineIndex >= (long long)blockStart && lineIndex < (long long)blockEnd)
+        {
+            if (block[lineIndex - blockStart].find(text) != std::string::npos)
+                return lineIndex;
+            lineIndex += forward ? 1 : -1;
+        }
+    }
+    return -1;
+}
+
+// 溢出文件打不开或写失败时改为丢弃，已溢出的行一并算作丢弃
+void OutputBuffer::spill(const std::string& line)
+{
+    if (spillEnabled && !spillFile)
+    {
+        spillFile = tmpfile();
+        if (!spillFile)
+            spillEnabled = false;
+    }
+    if (!spillEnabled)
+    {
+        droppedLines++;
+        return;
+    }
+
+    if (spilledLines % SPILL_INDEX_STRIDE == 0)
+        spillIndex.push_back(spillSize);
+    if ((spillRead && fseek(spillFile, 0, SEEK_END) != 0) || fwrite(line.data(), 1, line.size(), spillFile) != line.size()
+        || fputc('\n', spillFile) == EOF)
+    {
+        fclose(spillFile);
+        spillFile = nullptr;
+        spillEnabled = false;
+        droppedLines += spilledLines + 1;
+        spilledLines = 0;
+        spillIndex.clear();
+        spillSize = 0;
+        return;
+    }
+    spillRead = false;
+    spillSize += line.size() + 1;
+    spilledLines++;
+}
+
+std::string OutputBuffer::spilledLine(size_t lineIndex) const
+{
+    size_t blockStart = lineIndex / SPILL_INDEX_STRIDE * SPILL_INDEX_STRIDE;
+    std::vector<std::string> block;
+    readSpilledBlock(blockStart, lineIndex - blockStart + 1, block);
+    return block.size() == lineIndex - blockStart + 1 ? block.back() : std::string();
+}
+
+// 从first所在索引块的起点开始顺序读出count行，first必须是块的起点
+void OutputBuffer::readSpilledBlock(size_t first, size_t count, std::vector<std::string>& lines) const
+{
+    if (!spillFile || fseek(spillFile, spillIndex[first / SPILL_INDEX_STRIDE], SEEK_SET) != 0)
+        return;
+    spillRead = true;
+    std::string line;
+    int ch;
+    while (lines.size() < count && (ch = fgetc(spillFile)) != EOF)
+    {
+        if (ch == '\n')
+        {
+            lines.push_back(line);
+            line.clear();
+        }
+        else
+            line.push_back((char)ch);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+ * 运行结果的行缓冲：最近的capacity行放在环形数组中，更早的行在开启溢出时追加到临时文件，
+ * 否则直接丢弃。行号从0开始连续编号，clear之前不复用；
+ * 溢出文件每SPILL_INDEX_STRIDE行记一个偏移，读某一行时从最近的偏移顺序读过去。
+ */
+class OutputBuffer
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 100000;
+    static const size_t SPILL_INDEX_STRIDE = 64;
+
+private:
+    std::vector<std::string> ring;
+    size_t capacity;
+    size_t head = 0;            // 环形数组中最早一行的位置
+    size_t totalLines = 0;      // 追加过的总行数
+    size_t droppedLines = 0;    // 没有溢出文件时丢掉的行数
+
+    bool spillEnabled;
+    FILE* spillFile = nullptr;
+    mutable bool spillRead = false;     // 读过之后要先定位到文件末尾才能接着写
+    size_t spilledLines = 0;
+    std::vector<int64_t> spillIndex;
+    int64_t spillSize = 0;
+
+public:
+    explicit OutputBuffer(size_t capacity = DEFAULT_CAPACITY, bool spill = true);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(const std::string& line);
+    void appendToLastLine(const std::string& text);
+    void clear();
+
+    size_t lineCount() const;
+    size_t firstAvailableLine() const;
+    std::string line(size_t lineIndex) const;
+    long long find(const std::string& text, size_t fromLine, bool forward) const;
+
+private:
+    void spill(const std::string& line);
+    std::string spilledLine(size_t lineIndex) const;
+    void readSpilledBlock(size_t first, size_t count, std::vector<std::string>& lines) const;
+};
+
+#endif // OUTPUTBUFFER_H
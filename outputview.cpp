@@ -0,0 +1,179 @@
+#include "outputview.h"
+
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QTimer>
+#include <algorithm>
+#include <climits>
+
+static const int TEXT_MARGIN = 4;
+
+OutputView::OutputView(QWidget* parent)
+    : QAbstractScrollArea(parent)
+{
+    setFocusPolicy(Qt::StrongFocus);
+    verticalScrollBar()->setSingleStep(1);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, [this](int value) {
+        if (!updatingRange)
+            followEnd = value >= verticalScrollBar()->maximum();
+    });
+}
+
+void OutputView::append(const QString& text)
+{
+    buffer.append(text.toStdString());
+    scheduleRefresh();
+}
+
+void OutputView::appendToLastLine(const QString& text)
+{
+    buffer.appendToLastLine(text.toStdString());
+    scheduleRefresh();
+}
+
+void OutputView::clear()
+{
+    buffer.clear();
+    followEnd = true;
+    matchLine = -1;
+    maxLineWidth = 0;
+    scheduleRefresh();
+}
+
+size_t OutputView::lineCount() const
+{
+    return buffer.lineCount();
+}
+
+void OutputView::scrollToEnd()
+{
+    followEnd = true;
+    refresh();
+}
+
+// 从上次找到的行（没有时从可见区域）开始查找，到头后回绕一次
+bool OutputView::findNext(const QString& text, bool forward)
+{
+    // 换了查找内容就从当前可见的位置重新开始，而不是接着上一个匹配
+    if (text != matchText)
+    {
+        matchText = text;
+        matchLine = -1;
+    }
+
+    std::string str = text.toStdString();
+    long long start;
+    if (matchLine >= 0)
+        start = matchLine + (forward ? 1 : -1);
+    else
+        start = verticalScrollBar()->value() + (forward ? 0 : visibleLineCount() - 1);
+
+    long long found = start >= 0 ? buffer.find(str, start, forward) : -1;
+    if (found < 0 && buffer.lineCount() > 0)
+        found = buffer.find(str, forward ? 0 : buffer.lineCount() - 1, forward);
+
+    matchLine = found;
+    if (found >= 0)
+        scrollToLine(found);
+    viewport()->update();
+    return found >= 0;
+}
+
+void OutputView::paintEvent(QPaintEvent* event)
+{
+    Q_UNUSED(event);
+    QPainter painter(viewport());
+    QFontMetrics metrics = fontMetrics();
+    int height = lineHeight();
+    int left = TEXT_MARGIN - horizontalScrollBar()->value();
+    long long first = verticalScrollBar()->value();
+    long long last = std::min<long long>(buffer.lineCount(), first + visibleLineCount() + 1);
+
+    int widest = maxLineWidth;
+    for (long long lineIndex = first; lineIndex < last; lineIndex++)
+    {
+        int top = (lineIndex - first) * height;
+        QString text = QString::fromStdString(buffer.line(lineIndex));
+        if (lineIndex == matchLine)
+        {
+            painter.fillRect(0, top, viewport()->width(), height, palette().highlight());
+            painter.setPen(palette().highlightedText().color());
+        }
+        else
+            painter.setPen(palette().text().color());
+        painter.drawText(left, top + metrics.ascent(), text);
+        widest = std::max(widest, metrics.horizontalAdvance(text) + 2 * TEXT_MARGIN);
+    }
+
+    // 只量过画出来的行，遇到更宽的行再放大水平滚动范围
+    if (widest > maxLineWidth)
+    {
+        maxLineWidth = widest;
+        scheduleRefresh();
+    }
+}
+
+void OutputView::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    refresh();
+}
+
+void OutputView::keyPressEvent(QKeyEvent* event)
+{
+    if (event->key() == Qt::Key_End)
+        scrollToEnd();
+    else if (event->key() == Qt::Key_Home)
+        verticalScrollBar()->setValue(0);
+    else
+        QAbstractScrollArea::keyPressEvent(event);
+}
+
+int OutputView::lineHeight() const
+{
+    return std::max(1, fontMetrics().lineSpacing());
+}
+
+int OutputView::visibleLineCount() const
+{
+    return std::max(1, viewport()->height() / lineHeight());
+}
+
+void OutputView::scheduleRefresh()
+{
+    if (refreshScheduled)
+        return;
+
+    refreshScheduled = true;
+    QTimer::singleShot(0, this, [this]() {
+        refreshScheduled = false;
+        refresh();
+    });
+}
+
+void OutputView::refresh()
+{
+    QScrollBar* vertical = verticalScrollBar();
+    QScrollBar* horizontal = horizontalScrollBar();
+    int visible = visibleLineCount();
+    long long maxFirstLine = std::max<long long>(0, (long long)buffer.lineCount() - visible);
+
+    updatingRange = true;
+    vertical->setPageStep(visible);
+    vertical->setRange(0, std::min<long long>(maxFirstLine, INT_MAX));
+    if (followEnd)
+        vertical->setValue(vertical->maximum());
+    horizontal->setPageStep(viewport()->width());
+    horizontal->setRange(0, std::max(0, maxLineWidth - viewport()->width()));
+    updatingRange = false;
+    viewport()->update();
+}
+
+// 让目标行出现在可见区域的中间
+void OutputView::scrollToLine(long long lineIndex)
+{
+    refresh();
+    long long first = std::max<long long>(0, lineIndex - visibleLineCount() / 2);
+    verticalScrollBar()->setValue(std::min<long long>(first, verticalScrollBar()->maximum()));
+}
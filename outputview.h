@@ -0,0 +1,51 @@
+#ifndef OUTPUTVIEW_H
+#define OUTPUTVIEW_H
+
+#include "outputbuffer.h"
+
+#include <QAbstractScrollArea>
+#include <QString>
+
+/*
+ * 运行结果窗口：内容放在OutputBuffer中，只绘制可见的几行，输出再多也不会变慢。
+ * 滚动条以行为单位；停在末尾时跟随新输出，向上滚动后保持位置，直到再次回到末尾。
+ * 追加只更新缓冲区，滚动范围和重绘合并到下一次事件循环中进行。
+ */
+class OutputView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+private:
+    OutputBuffer buffer;
+    bool followEnd = true;
+    bool refreshScheduled = false;
+    bool updatingRange = false;
+    long long matchLine = -1;
+    QString matchText;
+    int maxLineWidth = 0;
+
+public:
+    explicit OutputView(QWidget* parent = nullptr);
+
+    void append(const QString& text);
+    void appendToLastLine(const QString& text);
+    void clear();
+    size_t lineCount() const;
+
+    void scrollToEnd();
+    bool findNext(const QString& text, bool forward = true);
+
+protected:
+    void paintEvent(QPaintEvent* event) override;
+    void resizeEvent(QResizeEvent* event) override;
+    void keyPressEvent(QKeyEvent* event) override;
+
+private:
+    int lineHeight() const;
+    int visibleLineCount() const;
+    void scheduleRefresh();
+    void refresh();
+    void scrollToLine(long long lineIndex);
+};
+
+#endif // OUTPUTVIEW_H
@@ -0,0 +1,312 @@
+#include "programanalysis.h"
+
+#include "statement.h"
+#include "expression.h"
+#include "programstore.h"
+#include "symboltable.h"
+
+#include <algorithm>
+#include <deque>
+
+ProgramAnalysis::ProgramAnalysis(const ProgramStore& program)
+{
+    buildGraph(program);
+    findReachable();
+    computeLiveness();
+    computeDefinedVars();
+    findLoops();
+    report();
+}
+
+const std::vector<ProgramAnalysis::Diagnostic>& ProgramAnalysis::getDiagnostics() const { return diagnostics; }
+const std::vector<ProgramAnalysis::Loop>& ProgramAnalysis::getLoops() const { return loops; }
+
+bool ProgramAnalysis::isReachable(int lineIndex) const
+{
+    int node = getNodeIndex(lineIndex);
+    return node != -1 && reachable[node];
+}
+
+std::vector<int> ProgramAnalysis::getPredecessors(int lineIndex) const
+{
+    std::vector<int> res;
+    int node = getNodeIndex(lineIndex);
+    if (node == -1)
+        return res;
+    for (int pred : predecessors[node])
+        res.push_back(lineIndices[pred]);
+    return res;
+}
+
+bool ProgramAnalysis::isDefinedBefore(int lineIndex, int varId) const
+{
+    int node = getNodeIndex(lineIndex);
+    if (node == -1 || varId < 0 || varId >= (int)varCnt)
+        return false;
+    return testVar(definedIn[node], varId);
+}
+
+int ProgramAnalysis::getNodeIndex(int lineIndex) const
+{
+    auto it = std::lower_bound(lineIndices.begin(), lineIndices.end(), lineIndex);
+    if (it == lineIndices.end() || *it != lineIndex)
+        return -1;
+    return it - lineIndices.begin();
+}
+
+// 数组与同名标量共用ID，读数组元素不算读取标量，只收集下标中的读取
+static void collectScalarReads(const Expression* exp, std::vector<int>& varIds)
+{
+    if (const IdentifierExp* identifierExp = dynamic_cast<const IdentifierExp*>(exp))
+    {
+        varIds.push_back(identifierExp->varId);
+    }
+    else if (const IndexExp* indexExp = dynamic_cast<const IndexExp*>(exp))
+    {
+        collectScalarReads(indexExp->indexExp, varIds);
+    }
+    else if (const CompoundExp* compoundExp = dynamic_cast<const CompoundExp*>(exp))
+    {
+        collectScalarReads(compoundExp->leftExp, varIds);
+        collectScalarReads(compoundExp->rightExp, varIds);
+    }
+}
+
+void ProgramAnalysis::buildGraph(const ProgramStore& program)
+{
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        lineIndices.push_back(program.lineIndexAt(pos));
+        nodes.push_back(program.statementAt(pos));
+    }
+
+    size_t n = nodes.size();
+    successors.resize(n);
+    predecessors.resize(n);
+    nodeUses.resize(n);
+    nodeDefs.assign(n, -1);
+    // 直接使用全局的变量ID作为位集下标
+    varCnt = SymbolTable::instance().size();
+
+    // GOSUB的下一行是返回点，每个RETURN都可能回到任意一个返回点
+    std::vector<int> returnSites;
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        if (dynamic_cast<GosubStmt*>(nodes[i]))
+            returnSites.push_back(i + 1);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (nodes[i]->canFallThrough() && i + 1 < n)
+            successors[i].push_back(i + 1);
+        if (dynamic_cast<ReturnStmt*>(nodes[i]))
+            successors[i].insert(successors[i].end(), returnSites.begin(), returnSites.end());
+
+        int targetLineIndex;
+        if (nodes[i]->getJumpTarget(targetLineIndex))
+        {
+            int target = getNodeIndex(targetLineIndex);
+            if (target != -1)
+                successors[i].push_back(target);
+        }
+
+        for (int succ : successors[i])
+            predecessors[succ].push_back(i);
+
+        std::vector<Expression*> exps;
+        nodes[i]->collectExpressions(exps);
+        for (auto exp : exps)
+            collectScalarReads(exp, nodeUses[i]);
+        nodeDefs[i] = nodes[i]->getDefinedVarId();
+        // NEXT先读取循环变量再写回
+        if (dynamic_cast<NextStmt*>(nodes[i]) && nodeDefs[i] != -1)
+            nodeUses[i].push_back(nodeDefs[i]);
+    }
+}
+
+void ProgramAnalysis::findReachable()
+{
+    reachable.assign(nodes.size(), false);
+    if (nodes.empty())
+        return;
+
+    std::deque<int> worklist = {0};
+    reachable[0] = true;
+    while (!worklist.empty())
+    {
+        int node = worklist.front();
+        worklist.pop_front();
+        for (int succ : successors[node])
+        {
+            if (!reachable[succ])
+            {
+                reachable[succ] = true;
+                worklist.push_back(succ);
+            }
+        }
+    }
+}
+
+// 活跃变量分析（逆向，并集）
+void ProgramAnalysis::computeLiveness()
+{
+    size_t n = nodes.size();
+    size_t words = (varCnt + 63) / 64;
+    liveOut.assign(n, VarSet(words, 0));
+    std::vector<VarSet> liveIn(n, VarSet(words, 0));
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t k = n; k-- > 0; )
+        {
+            VarSet out(words, 0);
+            for (int succ : successors[k])
+                for (size_t w = 0; w < words; w++)
+                    out[w] |= liveIn[succ][w];
+
+            VarSet in = out;
+            if (nodeDefs[k] != -1)
+                in[nodeDefs[k] / 64] &= ~(1ULL << (nodeDefs[k] % 64));
+            for (int varId : nodeUses[k])
+                setVar(in, varId);
+
+            if (in != liveIn[k] || out != liveOut[k])
+            {
+                liveIn[k] = std::move(in);
+                liveOut[k] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+}
+
+// 必定已赋值变量分析（正向，交集）
+void ProgramAnalysis::computeDefinedVars()
+{
+    size_t n = nodes.size();
+    size_t words = (varCnt + 63) / 64;
+    definedIn.assign(n, VarSet(words, ~0ULL));
+    std::vector<VarSet> definedOut(n, VarSet(words, ~0ULL));
+    if (n == 0)
+        return;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t k = 0; k < n; k++)
+        {
+            if (!reachable[k])
+                continue;
+
+            VarSet in(words, k == 0 ? 0 : ~0ULL);
+            if (k != 0)
+            {
+                for (int pred : predecessors[k])
+                    if (reachable[pred])
+                        for (size_t w = 0; w < words; w++)
+                            in[w] &= definedOut[pred][w];
+            }
+
+            // DIM定义的是同名数组，标量仍未定义
+            VarSet out = in;
+            if (nodeDefs[k] != -1 && !dynamic_cast<DimStmt*>(nodes[k]))
+                setVar(out, nodeDefs[k]);
+
+            if (in != definedIn[k] || out != definedOut[k])
+            {
+                definedIn[k] = std::move(in);
+                definedOut[k] = std::move(out);
+                changed = true;
+            }
+        }
+    }
+}
+
+// 自然循环：回边 latch -> header，循环体为不经过header就能到达latch的所有语句
+void ProgramAnalysis::findLoops()
+{
+    for (size_t latch = 0; latch < nodes.size(); latch++)
+    {
+        if (!reachable[latch])
+            continue;
+
+        for (int header : successors[latch])
+        {
+            if (header > (int)latch)
+                continue;
+
+            std::vector<bool> inLoop(nodes.size(), false);
+            std::vector<int> worklist = {(int)latch};
+            inLoop[header] = true;
+            inLoop[latch] = true;
+            while (!worklist.empty())
+            {
+                int node = worklist.back();
+                worklist.pop_back();
+                if (node == header)
+                    continue;
+                for (int pred : predecessors[node])
+                {
+                    if (!inLoop[pred] && reachable[pred])
+                    {
+                        inLoop[pred] = true;
+                        worklist.push_back(pred);
+                    }
+                }
+            }
+
+            Loop loop = {lineIndices[header], lineIndices[latch], {}};
+            for (size_t k = 0; k < nodes.size(); k++)
+                if (inLoop[k])
+                    loop.bodyLineIndices.push_back(lineIndices[k]);
+            loops.push_back(loop);
+        }
+    }
+}
+
+void ProgramAnalysis::report()
+{
+    for (size_t k = 0; k < nodes.size(); k++)
+    {
+        int lineIndex = lineIndices[k];
+
+        int targetLineIndex;
+        if (nodes[k]->getJumpTarget(targetLineIndex) && getNodeIndex(targetLineIndex) == -1)
+            diagnostics.push_back( {MISSING_JUMP_TARGET, lineIndex,
+                                    "Jump to a non-existed line index " + std::to_string(targetLineIndex)} );
+
+        if (!reachable[k])
+        {
+            diagnostics.push_back( {UNREACHABLE_LINE, lineIndex, "Unreachable line"} );
+            continue;
+        }
+
+        std::vector<int> reported;
+        for (int varId : nodeUses[k])
+        {
+            if (testVar(definedIn[k], varId) || std::count(reported.begin(), reported.end(), varId))
+                continue;
+            reported.push_back(varId);
+            diagnostics.push_back( {UNDEFINED_VARIABLE, lineIndex,
+                                    "Variable '" + SymbolTable::instance().nameOf(varId) + "' may be used before assignment"} );
+        }
+
+        if (dynamic_cast<LetStmt*>(nodes[k]) && nodeDefs[k] != -1 && !testVar(liveOut[k], nodeDefs[k]))
+            diagnostics.push_back( {DEAD_STORE, lineIndex,
+                                    "Value assigned to '" + SymbolTable::instance().nameOf(nodeDefs[k]) + "' is never read"} );
+    }
+}
+
+bool ProgramAnalysis::testVar(const VarSet& set, int varId)
+{
+    return (set[varId / 64] >> (varId % 64)) & 1;
+}
+
+void ProgramAnalysis::setVar(VarSet& set, int varId)
+{
+    set[varId / 64] |= 1ULL << (varId % 64);
+}
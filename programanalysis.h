@@ -0,0 +1,74 @@
+#ifndef PROGRAMANALYSIS_H
+#define PROGRAMANALYSIS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class Statement;
+class ProgramStore;
+
+class ProgramAnalysis
+{
+public:
+    typedef enum
+    {
+        UNREACHABLE_LINE = 1,
+        DEAD_STORE,
+        UNDEFINED_VARIABLE,
+        MISSING_JUMP_TARGET
+    } DiagnosticType;
+
+    struct Diagnostic
+    {
+        DiagnosticType type;
+        int lineIndex;
+        std::string message;
+    };
+
+    struct Loop
+    {
+        int headerLineIndex;
+        int latchLineIndex;
+        std::vector<int> bodyLineIndices;
+    };
+
+private:
+    typedef std::vector<uint64_t> VarSet;
+
+    std::vector<int> lineIndices;
+    std::vector<Statement*> nodes;
+    std::vector<std::vector<int>> successors;
+    std::vector<std::vector<int>> predecessors;
+    std::vector<bool> reachable;
+
+    size_t varCnt = 0;
+    std::vector<std::vector<int>> nodeUses;
+    std::vector<int> nodeDefs;
+    std::vector<VarSet> liveOut;
+    std::vector<VarSet> definedIn;
+
+    std::vector<Loop> loops;
+    std::vector<Diagnostic> diagnostics;
+
+public:
+    ProgramAnalysis(const ProgramStore& program);
+    const std::vector<Diagnostic>& getDiagnostics() const;
+    const std::vector<Loop>& getLoops() const;
+    bool isReachable(int lineIndex) const;
+    std::vector<int> getPredecessors(int lineIndex) const;
+    bool isDefinedBefore(int lineIndex, int varId) const;
+
+private:
+    int getNodeIndex(int lineIndex) const;
+    void buildGraph(const ProgramStore& program);
+    void findReachable();
+    void computeLiveness();
+    void computeDefinedVars();
+    void findLoops();
+    void report();
+    static bool testVar(const VarSet& set, int varId);
+    static void setVar(VarSet& set, int varId);
+};
+
+#endif // PROGRAMANALYSIS_H
@@ -0,0 +1,71 @@
+#include "programgenerator.h"
+
+ProgramGenerator::ProgramGenerator(unsigned int seed)
+    : random(seed) {}
+
+std::vector<std::string> ProgramGenerator::generate(int statementCnt)
+{
+    int lineCnt = VAR_CNT + statementCnt + 1;
+    std::vector<std::string> res;
+    res.reserve(lineCnt);
+
+    for (int i = 0; i < VAR_CNT; i++)
+    {
+        res.push_back(std::to_string((i + 1) * LINE_STEP) + " LET " + std::string(1, 'A' + i) + " = "
+                      + std::to_string(randomInt(0, MAX_CONSTANT)));
+    }
+
+    for (int i = VAR_CNT; i < lineCnt - 1; i++)
+    {
+        std::string line = std::to_string((i + 1) * LINE_STEP) + " ";
+        // 跳转目标不包括初始化的几行，否则程序几乎总在重复赋初值
+        int target = randomInt(VAR_CNT + 1, lineCnt) * LINE_STEP;
+        int kind = randomInt(0, 9);
+        if (kind < 5)
+        {
+            line += "LET " + randomVarName() + " = " + randomExpression(0);
+        }
+        else if (kind < 7)
+        {
+            line += "PRINT " + randomExpression(0);
+        }
+        else if (kind < 9)
+        {
+            static const char* const comparisons[] = {" = ", " < ", " > "};
+            line += "IF " + randomExpression(1) + comparisons[randomInt(0, 2)] + randomExpression(1)
+                    + " THEN " + std::to_string(target);
+        }
+        else
+        {
+            line += "GOTO " + std::to_string(target);
+        }
+        res.push_back(line);
+    }
+
+    res.push_back(std::to_string(lineCnt * LINE_STEP) + " END");
+    return res;
+}
+
+// 常数都不是负数，表达式解析时负号只能出现在开头或左括号之后
+std::string ProgramGenerator::randomExpression(int depth)
+{
+    if (depth >= MAX_EXP_DEPTH || randomInt(0, 2) == 0)
+    {
+        if (randomInt(0, 1) == 0)
+            return randomVarName();
+        return std::to_string(randomInt(0, MAX_CONSTANT));
+    }
+
+    static const char* const operations[] = {" + ", " - ", " * ", " / ", " MOD "};
+    return "(" + randomExpression(depth + 1) + operations[randomInt(0, 4)] + randomExpression(depth + 1) + ")";
+}
+
+std::string ProgramGenerator::randomVarName()
+{
+    return std::string(1, 'A' + randomInt(0, VAR_CNT - 1));
+}
+
+int ProgramGenerator::randomInt(int min, int max)
+{
+    return std::uniform_int_distribution<int>(min, max)(random);
+}
@@ -0,0 +1,32 @@
+#ifndef PROGRAMGENERATOR_H
+#define PROGRAMGENERATOR_H
+
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * 生成随机的合法程序用于对拍：开头给所有变量赋初值，之后是随机的LET/IF/GOTO/PRINT，最后一行END。
+ * 跳转目标都是存在的行，可能形成死循环，运行时需要配合语句数限制。
+ */
+class ProgramGenerator
+{
+private:
+    static const int VAR_CNT = 4;
+    static const int MAX_EXP_DEPTH = 3;
+    static const int MAX_CONSTANT = 99;
+    static const int LINE_STEP = 10;
+
+    std::mt19937 random;
+
+public:
+    ProgramGenerator(unsigned int seed);
+    std::vector<std::string> generate(int statementCnt);
+
+private:
+    std::string randomExpression(int depth);
+    std::string randomVarName();
+    int randomInt(int min, int max);
+};
+
+#endif // PROGRAMGENERATOR_H
@@ -3,34 +3,125 @@
 #include "runtimecontext.h"
 #include "statement.h"
 #include "expression.h"
+#include "optimizer.h"
+#include "programanalysis.h"
+#include "inputqueue.h"
+#include "symboltable.h"
+#include "registervm.h"
+#include "expressionpool.h"
+#include "checkpoint.h"
+#include "systemutils.h"
 
+#include <QTextBlock>
+#include <QTextDocument>
+#include <QTextCursor>
 #include <QTimer>
 #include <sstream>
+#include <iostream>
+#include <thread>
+#include <algorithm>
 
 ProgramManager::ProgramManager(Ui::MainWindow* ui)
-    : ui(ui) , context(new RuntimeContext) {}
+    : ui(ui) , context(new RuntimeContext), inputQueue(new InputQueue(this))
+{
+    connect(inputQueue, &InputQueue::inputAvailable, this, &ProgramManager::onInputAvailable);
+}
 
 ProgramManager::~ProgramManager()
 {
+    removeTraps();
+    for (auto trap : retiredTraps)
+        delete trap;
+    if (traceRecorder)
+        delete traceRecorder;
+    if (vm)
+        delete vm;
+    dropJit();
+    if (expPool)
+        delete expPool;
+
     if (context)
         delete context;
-
-    for (auto statement : statements)
-        if(statement.second)
-            delete statement.second;
 }
 
+// 运行中清空的只是待应用的新版本，正在执行的程序和变量不受影响
 void ProgramManager::clearCommand()
 {
-    statements.clear();
-    context->clear();
+    editableProgram().clear();
+    if (!isRunning())
+        context->clear();
 }
 
 bool ProgramManager::addCommand(QString& command)
 {
-    QTextStream textStream(&command);
-
+    ProgramStore& target = editableProgram();
     int lineIndex = 0;
+    Statement* statement = parseCommand(command, lineIndex);
+    if (!statement)
+    {
+        target.erase(lineIndex);
+        return false;
+    }
+
+    target.insert(lineIndex, statement, command.toStdString());
+    return true;
+}
+
+// 批量加载：分块交给多个线程解析，每个线程把结果写进自己的缓冲区，最后按源码顺序合并，
+// 因此重复的行号仍然是后出现的生效，解析失败的行同样会删除之前的同号行
+int ProgramManager::addCommands(const QStringList& commands)
+{
+    int lineCnt = commands.size();
+    int threadCnt = std::max(1, std::min((int)std::thread::hardware_concurrency(), lineCnt / PARALLEL_PARSE_MIN_LINES));
+    int chunkSize = (lineCnt + threadCnt - 1) / threadCnt;
+    std::vector<std::vector<ParsedCommand>> chunks(threadCnt);
+
+    auto parseChunk = [&commands, &chunks, lineCnt, chunkSize](int chunk) {
+        int begin = chunk * chunkSize;
+        int end = std::min(lineCnt, begin + chunkSize);
+        std::vector<ParsedCommand>& res = chunks[chunk];
+        res.reserve(end - begin);
+        for (int i = begin; i < end; i++)
+        {
+            ParsedCommand parsed = {0, nullptr};
+            parsed.statement = parseCommand(commands[i], parsed.lineIndex);
+            res.push_back(parsed);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int chunk = 1; chunk < threadCnt; chunk++)
+        workers.emplace_back(parseChunk, chunk);
+    parseChunk(0);
+    for (auto& worker : workers)
+        worker.join();
+
+    ProgramStore& target = editableProgram();
+    int addedCnt = 0;
+    for (int chunk = 0; chunk < threadCnt; chunk++)
+    {
+        for (size_t i = 0; i < chunks[chunk].size(); i++)
+        {
+            const ParsedCommand& parsed = chunks[chunk][i];
+            if (!parsed.statement)
+            {
+                target.erase(parsed.lineIndex);
+                continue;
+            }
+            target.insert(parsed.lineIndex, parsed.statement, commands[chunk * chunkSize + i].toStdString());
+            addedCnt++;
+        }
+    }
+    return addedCnt;
+}
+
+// 只读取参数，不访问ProgramManager的状态，可以在多个线程中同时调用；出错时返回nullptr
+Statement* ProgramManager::parseCommand(const QString& command, int& lineIndex)
+{
+    QString text = command;
+    QTextStream textStream(&text);
+
+    lineIndex = 0;
     QString keyword;
     QString arguments;
 
@@ -48,263 +139,1948 @@ bool ProgramManager::addCommand(QString& command)
 
     try
     {
-        if (keyword == "REM")
-        {
-            new_statement = new RemStmt(arguments.toStdString());
-        }
-
-        else if (keyword == "LET")
+        switch (keywordFromStr(keyword.toStdString()))
         {
-            int eqPos = arguments.indexOf('=');
-            if (eqPos == -1)
+            case REM:
             {
-                throw "LET statement with no '='";
+                new_statement = new RemStmt(arguments.toStdString());
+                break;
             }
 
-            QString varName = arguments.left(eqPos).trimmed();
-            QString expStr = arguments.mid(eqPos + 1).trimmed();
+            case LET:
+            {
+                int eqPos = arguments.indexOf('=');
+                if (eqPos == -1)
+                {
+                    throw "LET statement with no '='";
+                }
+
+                QString varName = arguments.left(eqPos).trimmed();
+                QString expStr = arguments.mid(eqPos + 1).trimmed();
+                QString indexStr;
+
+                if (varName.isEmpty())
+                {
+                    throw "LET statement with no variable name";
+                }
+
+                // 数组元素 A(i)
+                int lparenPos = varName.indexOf('(');
+                if (lparenPos != -1)
+                {
+                    if (!varName.endsWith(")"))
+                    {
+                        throw "LET statement with unmatched parenthese";
+                    }
+                    indexStr = varName.mid(lparenPos + 1, varName.length() - lparenPos - 2).trimmed();
+                    varName = varName.left(lparenPos).trimmed();
+                }
 
-            if (varName.isEmpty())
+                if (!isValidVarName(varName.toStdString()))
+                {
+                    throw "LET statement with invalid variable name";
+                }
+
+                if (expStr.isEmpty())
+                {
+                    qDebug() << "LET statement with no expression";
+                }
+
+                Expression* exp = Expression::newExpFromStr(expStr.toStdString());
+                if (lparenPos != -1)
+                {
+                    IndexExp* target = new IndexExp(varName.toStdString(), Expression::newExpFromStr(indexStr.toStdString()));
+                    new_statement = new LetStmt(target, exp);
+                }
+                else
+                {
+                    new_statement = new LetStmt(varName.toStdString(), exp);
+                }
+                break;
+            }
+
+            case PRINT:
             {
-                throw "LET statement with no variable name";
+                Expression* exp = Expression::newExpFromStr(arguments.toStdString());
+                new_statement = new PrintStmt(exp);
+                break;
             }
 
-            if (!isValidVarName(varName.toStdString()))
+            case INPUT:
             {
-                throw "LET statement with invalid variable name";
+                new_statement = new InputStmt(arguments.toStdString());
+                break;
             }
 
-            if (expStr.isEmpty())
+            case GOTO:
             {
-                qDebug() << "LET statement with no expression";
+                int targetLineIndex = arguments.toInt();
+                new_statement = new GotoStmt(targetLineIndex);
+                break;
             }
 
-            Expression* exp = Expression::newExpFromStr(expStr.toStdString());
-            new_statement = new LetStmt(varName.toStdString(), exp);
-        }
+            case IF:
+            {
+                int thenPos = arguments.indexOf("THEN");
+                if (thenPos == -1)
+                {
+                    throw "IF statement with no 'THEN'";
+                }
 
-        else if (keyword == "PRINT")
-        {
-            Expression* exp = Expression::newExpFromStr(arguments.toStdString());
-            new_statement = new PrintStmt(exp);
-        }
+                QString ifCondition = arguments.left(thenPos).trimmed();
+                int targetLineIndex = arguments.mid(thenPos + 4).trimmed().toInt();
 
-        else if (keyword == "INPUT")
-        {
-            new_statement = new InputStmt(arguments.toStdString());
-        }
+                int compOpPos = arguments.indexOf('=');
+                IfStmt::ComparisonType compType = IfStmt::EQUAL;
+                if (compOpPos == -1)
+                {
+                    compOpPos = arguments.indexOf('<');
+                    compType = IfStmt::LESS_THAN;
+                }
+                if (compOpPos == -1)
+                {
+                    compOpPos = arguments.indexOf('>');
+                    compType = IfStmt::GREATER_THAN;
+                }
+                if (compOpPos == -1)
+                {
+                    throw "IF statement with no condition operator";
+                }
 
-        else if (keyword == "GOTO")
-        {
-            int targetLineIndex = arguments.toInt();
-            new_statement = new GotoStmt(targetLineIndex);
-        }
+                QString leftExpStr = ifCondition.left(compOpPos).trimmed();
+                QString rightExpStr = ifCondition.mid(compOpPos + 1).trimmed();
+                Expression* leftExp = Expression::newExpFromStr(leftExpStr.toStdString());
+                Expression* rightExp = Expression::newExpFromStr(rightExpStr.toStdString());
 
-        else if (keyword == "IF")
-        {
-            int thenPos = arguments.indexOf("THEN");
-            if (thenPos == -1)
+                new_statement = new IfStmt(leftExp, rightExp, compType, targetLineIndex);
+                break;
+            }
+
+            case END:
             {
-                throw "IF statement with no 'THEN'";
+                new_statement = new EndStmt();
+                break;
             }
 
-            QString ifCondition = arguments.left(thenPos).trimmed();
-            int targetLineIndex = arguments.mid(thenPos + 4).trimmed().toInt();
+            case FOR:
+            {
+                std::string argStr = arguments.toStdString();
+                int eqPos = arguments.indexOf('=');
+                if (eqPos == -1)
+                {
+                    throw "FOR statement with no '='";
+                }
+
+                int toPos = findKeyword(argStr, "TO", eqPos + 1);
+                if (toPos == -1)
+                {
+                    throw "FOR statement with no 'TO'";
+                }
+                int stepPos = findKeyword(argStr, "STEP", toPos + 2);
 
-            int compOpPos = arguments.indexOf('=');
-            IfStmt::ComparisonType compType = IfStmt::EQUAL;
-            if (compOpPos == -1)
+                QString varName = arguments.left(eqPos).trimmed();
+                if (!isValidVarName(varName.toStdString()))
+                {
+                    throw "FOR statement with invalid variable name";
+                }
+
+                QString startExpStr = arguments.mid(eqPos + 1, toPos - eqPos - 1).trimmed();
+                QString endExpStr = stepPos == -1 ? arguments.mid(toPos + 2).trimmed()
+                                                  : arguments.mid(toPos + 2, stepPos - toPos - 2).trimmed();
+                Expression* startExp = Expression::newExpFromStr(startExpStr.toStdString());
+                Expression* endExp = Expression::newExpFromStr(endExpStr.toStdString());
+                Expression* stepExp = nullptr;
+                if (stepPos != -1)
+                    stepExp = Expression::newExpFromStr(arguments.mid(stepPos + 4).trimmed().toStdString());
+
+                new_statement = new ForStmt(varName.toStdString(), startExp, endExp, stepExp);
+                break;
+            }
+
+            case NEXT:
             {
-                compOpPos = arguments.indexOf('<');
-                compType = IfStmt::LESS_THAN;
+                if (!arguments.isEmpty() && !isValidVarName(arguments.toStdString()))
+                {
+                    throw "NEXT statement with invalid variable name";
+                }
+                new_statement = new NextStmt(arguments.toStdString());
+                break;
             }
-            if (compOpPos == -1)
+
+            case GOSUB:
             {
-                compOpPos = arguments.indexOf('>');
-                compType = IfStmt::GREATER_THAN;
+                int targetLineIndex = arguments.toInt();
+                new_statement = new GosubStmt(targetLineIndex);
+                break;
             }
-            if (compOpPos == -1)
+
+            case RETURN:
             {
-                throw "IF statement with no condition operator";
+                new_statement = new ReturnStmt();
+                break;
             }
 
-            QString leftExpStr = ifCondition.left(compOpPos).trimmed();
-            QString rightExpStr = ifCondition.mid(compOpPos + 1).trimmed();
-            Expression* leftExp = Expression::newExpFromStr(leftExpStr.toStdString());
-            Expression* rightExp = Expression::newExpFromStr(rightExpStr.toStdString());
+            case DIM:
+            {
+                int lparenPos = arguments.indexOf('(');
+                if (lparenPos == -1 || !arguments.endsWith(")"))
+                {
+                    throw "DIM statement with no size";
+                }
 
-            new_statement = new IfStmt(leftExp, rightExp, compType, targetLineIndex);
-        }
+                QString varName = arguments.left(lparenPos).trimmed();
+                if (!isValidVarName(varName.toStdString()))
+                {
+                    throw "DIM statement with invalid variable name";
+                }
 
-        else if (keyword == "END")
-        {
-            new_statement = new EndStmt();
-        }
+                QString sizeStr = arguments.mid(lparenPos + 1, arguments.length() - lparenPos - 2).trimmed();
+                Expression* sizeExp = Expression::newExpFromStr(sizeStr.toStdString());
+                new_statement = new DimStmt(varName.toStdString(), sizeExp);
+                break;
+            }
 
-        else
-        {
-            throw "Unknown keyword";
+            default:
+            {
+                throw "Unknown keyword";
+            }
         }
     }
     catch (const char* errMsg)
     {
         // errors[lineIndex] = std::string(errMsg);
-        statements.erase(lineIndex);
         qDebug() << "Caught error: " + std::string(errMsg);
-        return false;
+        return nullptr;
+    }
+    catch (const std::string& errMsg)
+    {
+        // 表达式中的非法记号带有记号本身，以std::string抛出
+        qDebug() << "Caught error: " + errMsg;
+        return nullptr;
     }
 
-    new_statement->rawCodeWithIndex = command.toStdString();
-    statements[lineIndex] = new_statement;
-    return true;
+    return new_statement;
 }
 
 void ProgramManager::showCode()
 {
-    std::stringstream res;
-    for (auto& statement : statements)
-        res << statement.second->rawCodeWithIndex << "\n";
-    ui->CodeDisplay->setText(QString::fromStdString(res.str()));
+    if (!ui)
+        return;
+
+    const ProgramStore& shown = hasPendingEdits ? pendingProgram : program;
+    std::string res;
+    for (size_t pos = 0; pos < shown.size(); pos++)
+    {
+        res += shown.sourceAt(pos);
+        res += "\n";
+    }
+    ui->CodeDisplay->setPlainText(QString::fromStdString(res));
+}
+
+// 运行中不分析：链接循环会改动与正在执行的版本共享的语句，诊断在应用修改时给出
+void ProgramManager::analyzeCode()
+{
+    if (isRunning())
+        return;
+    adoptPendingEdits();
+    linkLoops();
+    ProgramAnalysis analysis(program);
+    for (auto& diagnostic : analysis.getDiagnostics())
+        appendOutput("[Warning] At line " + std::to_string(diagnostic.lineIndex) + ": " + diagnostic.message);
 }
 
 void ProgramManager::runCode()
 {
     qDebug() << "Run!";
-    ui->textBrowser->clear();
-    _isRunning = true;
-    _isWaitingForInput = false;
-    context->clear();
-    for (auto& statement : statements)
-        statement.second->resetStats();
-    curLineIter = statements.begin();
+    prepareRun(true);
+    curPos = 0;
     continueRunning();
 }
 
+// 从头运行和从检查点恢复共用的准备工作：清空状态、分析和优化程序、按条件创建虚拟机和TraceJit
+void ProgramManager::prepareRun(bool allowVm)
+{
+    if (ui)
+    {
+        ui->outputView->clear();
+        ui->varDisplay->clear();
+        ui->metricsDisplay->clear();
+    }
+    discardSyntaxTree();
+    runState = RUNNING;
+    context->clear();
+    removeTraps();
+    adoptPendingEdits();
+    for (auto trap : retiredTraps)
+        delete trap;
+    retiredTraps.clear();
+    for (size_t pos = 0; pos < program.size(); pos++)
+        program.statementAt(pos)->resetStats();
+    linkLoops();
+    ProgramAnalysis analysis(program);
+    if (engine == OPTIMIZING_ENGINE)
+    {
+        Optimizer::eliminateCommonSubexps(program, analysis, context);
+        Optimizer::hoistBoundsChecks(program, analysis);
+    }
+    buildExpressionPool();
+
+    returnDepth = 0;
+    executedCnt = 0;
+    outputBytes = 0;
+    runMillis = 0;
+    jumpCnt = 0;
+    inputWaitMillis = 0;
+    stepRequested = false;
+    scheduleLimitCheck();
+    finishCheckpointWrite();
+    nextCheckpoint = checkpointInterval;
+
+    setUpLoopDetectors(analysis);
+
+    if (traceRecorder)
+        delete traceRecorder;
+    traceRecorder = nullptr;
+    if (!tracePath.empty())
+    {
+        std::string source;
+        for (size_t pos = 0; pos < program.size(); pos++)
+        {
+            source += program.sourceAt(pos);
+            source += "\n";
+        }
+        traceRecorder = new TraceRecorder;
+        if (!traceRecorder->open(tracePath, source))
+        {
+            appendOutput("[Trace] Cannot open " + tracePath);
+            delete traceRecorder;
+            traceRecorder = nullptr;
+        }
+    }
+    tracing = traceRecorder || traceReader;
+
+    if (vm)
+        delete vm;
+    vm = nullptr;
+    if (allowVm && (engine == REGISTER_VM_ENGINE || engine == NATIVE_ENGINE) && !tracing && loopDetectors.empty()
+        && breakpoints.empty() && watchpoints.empty() && checkpointInterval == 0)
+    {
+        vm = new RegisterVM(program, analysis, context, limits);
+        std::string error;
+        if (engine == NATIVE_ENGINE && !vm->compileNative(error))
+            appendOutput("[Native] " + error + ", running on the register VM instead");
+    }
+    dropJit();
+    if (engine == OPTIMIZING_ENGINE && !tracing && loopDetectors.empty() && breakpoints.empty() && watchpoints.empty())
+        jit = new TraceJit(program);
+
+    installTraps();
+}
+
+void ProgramManager::setUpLoopDetectors(const ProgramAnalysis& analysis)
+{
+    loopDetectors.clear();
+    if (!limits.detectInfiniteLoops)
+        return;
+    for (auto& loop : analysis.getLoops())
+    {
+        bool hasSideEffects = false;
+        for (int lineIndex : loop.bodyLineIndices)
+            hasSideEffects = hasSideEffects || program.statementAt(program.find(lineIndex))->hasSideEffects();
+        if (!hasSideEffects)
+        {
+            LoopDetector detector;
+            detector.headerPos = program.find(loop.headerLineIndex);
+            loopDetectors[loop.latchLineIndex] = detector;
+        }
+    }
+}
+
+// 运行中（暂停或等待输入）的修改写入新版本，与正在执行的版本共享未修改的行
+ProgramStore& ProgramManager::editableProgram()
+{
+    if (!isRunning())
+    {
+        adoptPendingEdits();
+        return program;
+    }
+    if (!hasPendingEdits)
+    {
+        // 新版本不能带上陷阱：先撤下再复制，重新安装时正在执行的版本会复制出自己的行表
+        removeTraps();
+        pendingProgram = program;
+        installTraps();
+        hasPendingEdits = true;
+    }
+    return pendingProgram;
+}
+
+// 只在没有语句正在执行时调用，旧版本独有的语句在这里释放
+void ProgramManager::adoptPendingEdits()
+{
+    if (!hasPendingEdits)
+        return;
+    discardSyntaxTree();
+    program = pendingProgram;
+    pendingProgram.clear();
+    hasPendingEdits = false;
+}
+
+// 切换到运行中修改出的新版本，从同一行号继续：变量、数组、GOSUB返回位置和未修改语句的统计都保留，
+// 循环链接、优化和死循环检测按新版本重新计算，寄存器虚拟机和已记录的轨迹作废
+bool ProgramManager::applyEdits()
+{
+    if (!isRunning() || !hasPendingEdits)
+    {
+        appendOutput("[Edit] No pending edits");
+        return false;
+    }
+    if (tracing)
+    {
+        appendOutput("[Edit] Cannot apply edits while a trace is recorded or replayed");
+        return false;
+    }
+
+    leaveVm();
+    int pausedLineIndex = curPos < program.size() ? program.lineIndexAt(curPos) : -1;
+
+    // 等待输入时从INPUT所在行号之后继续，即使INPUT这一行已被删除或改写
+    removeTraps();
+    if (runState == WAITING_FOR_INPUT)
+        curPos = pendingProgram.lowerBound(lineWaitingForInput + 1);
+    else
+        curPos = remapPos(curPos, false);
+    for (int i = 0; i < returnDepth; i++)
+        returnStack[i] = remapPos(returnStack[i], true);
+    adoptPendingEdits();
+
+    // 停下的那一行被删除时继续位置落到了别的行，那里的断点还没有报告过，继续时不能跳过
+    if (curPos >= program.size() || program.lineIndexAt(curPos) != pausedLineIndex)
+        skipTrapOnResume = false;
+
+    bool useJit = jit != nullptr;
+    dropJit();
+
+    linkLoops();
+    ProgramAnalysis analysis(program);
+    for (auto& diagnostic : analysis.getDiagnostics())
+        appendOutput("[Warning] At line " + std::to_string(diagnostic.lineIndex) + ": " + diagnostic.message);
+    if (engine == OPTIMIZING_ENGINE)
+    {
+        context->clearCachedSubexps();
+        Optimizer::eliminateCommonSubexps(program, analysis, context);
+        Optimizer::hoistBoundsChecks(program, analysis);
+    }
+    buildExpressionPool();
+    setUpLoopDetectors(analysis);
+    if (useJit && loopDetectors.empty())
+        jit = new TraceJit(program);
+    installTraps();
+
+    int lineIndex = curPos < program.size() ? program.lineIndexAt(curPos) : -1;
+    appendOutput("[Edit] Edits applied, continuing at line " + std::to_string(lineIndex));
+    return true;
+}
+
+// 寄存器虚拟机（包括本机代码）只会挂起在INPUT上，继续位置和返回栈在它自己那里；
+// 取回之后删除虚拟机，由逐条解释继续，断点、监视点和修改后的程序才能生效
+void ProgramManager::leaveVm()
+{
+    if (!vm)
+        return;
+    std::vector<size_t> returnPositions;
+    vm->getSuspendedState(curPos, returnPositions);
+    returnDepth = returnPositions.size();
+    std::copy(returnPositions.begin(), returnPositions.end(), returnStack);
+    delete vm;
+    vm = nullptr;
+}
+
+// 把正在执行的版本中的位置换算到新版本中；所在行被删除时落到其后的第一行。
+// afterPrevious表示位置是“某一行的下一行”，按那一行定位，这样在两行之间插入的新行也会执行
+size_t ProgramManager::remapPos(size_t pos, bool afterPrevious) const
+{
+    if (afterPrevious)
+        return pos == 0 ? 0 : pendingProgram.lowerBound(program.lineIndexAt(pos - 1) + 1);
+    return pos < program.size() ? pendingProgram.lowerBound(program.lineIndexAt(pos)) : pendingProgram.size();
+}
+
 void ProgramManager::continueRunning()
 {
-    auto tempLineIter = curLineIter;
+    runTimer.start();
     try
     {
-        while (_isRunning && !_isWaitingForInput)
+        if (vm)
+            runVm();
+        while (runState == RUNNING)
         {
-            tempLineIter = curLineIter;
-            if (curLineIter == statements.end())
+            if (curPos >= program.size())
             {
                 stopRunning();
                 break;
             }
-            qDebug() << "Executing line #" + std::to_string(curLineIter->first);
-            curLineIter->second->execute(this);
-            if (curLineIter == tempLineIter)
-                ++curLineIter;
+            if (--limitCheckCountdown == 0 && !checkLimits())
+                break;
+            qDebug() << "Executing line #" + std::to_string(program.lineIndexAt(curPos));
+            nextPos = curPos + 1;
+            program.statementAt(curPos)->execute(this);
+            if (tracing)
+                traceStep();
+            if (jitHook)
+                jitStep();
+            curPos = nextPos;
         }
     }
     catch(const char* errMsg)
     {
         runtimeError(std::string(errMsg));
     }
+    if (jit)
+        jit->abortRecording();
+    jitHook = false;
+    runMillis += runTimer.elapsed();
+    runTimer.invalidate();
+}
+
+// 虚拟机一直运行到结束、出错或等待输入，之后把它的计数交给运行统计
+void ProgramManager::runVm()
+{
+    RegisterVM::RunResult res = RegisterVM::SUSPENDED;
+    std::string errMsg;
+    bool failed = false;
+    try
+    {
+        res = vm->run(this, curPos, runMillis);
+    }
+    catch (const char* msg)
+    {
+        failed = true;
+        errMsg = msg;
+    }
+
+    executedCnt = vm->getExecutedCnt();
+    limitCheckCountdown = limitCheckInterval;
+    jumpCnt = vm->getJumpCnt();
+    if (failed)
+        runtimeError(errMsg);
+    else if (res == RegisterVM::FINISHED)
+        stopRunning();
+}
+
+// 记录中把刚执行的一步交给TraceJit，否则如果跳到了已有轨迹的循环头就改走轨迹
+void ProgramManager::jitStep()
+{
+    jitHook = false;
+    if (runState != RUNNING)
+    {
+        jit->abortRecording();
+        return;
+    }
+    if (jit->isRecording())
+    {
+        jitHook = jit->recordStep(curPos, nextPos);
+        return;
+    }
+    const TraceJit::Trace* trace = jit->traceAt(nextPos);
+    if (trace)
+        runTrace(*trace);
+}
+
+// 沿轨迹反复执行，语句和分支的计数照常累加；守卫不成立时按实际走向设置nextPos，回到逐条解释
+void ProgramManager::runTrace(const TraceJit::Trace& trace)
+{
+    const TraceJit::TraceStep* steps = trace.steps.data();
+    size_t stepCnt = trace.steps.size();
+    while (true)
+    {
+        for (size_t i = 0; i < stepCnt; i++)
+        {
+            const TraceJit::TraceStep& step = steps[i];
+            curPos = step.pos;
+            if (--limitCheckCountdown == 0 && !checkLimits())
+            {
+                nextPos = step.pos;
+                return;
+            }
+            switch (step.kind)
+            {
+                case TraceJit::SKIP:
+                    step.statement->countExecution();
+                    break;
+                case TraceJit::ASSIGN:
+                    step.statement->countExecution();
+                    context->setVarValue(step.varId, getExpressionValue(step.expression));
+                    break;
+                case TraceJit::EXECUTE:
+                    step.statement->execute(this);
+                    break;
+                case TraceJit::JUMP:
+                    step.statement->countExecution();
+                    jumpCnt++;
+                    break;
+                case TraceJit::GUARD_IF:
+                {
+                    IfStmt* ifStmt = static_cast<IfStmt*>(step.statement);
+                    ifStmt->countExecution();
+                    bool taken = ifStmt->test(this);
+                    if (taken != step.taken)
+                    {
+                        nextPos = step.pos + 1;
+                        if (taken)
+                            gotoLine(ifStmt->targetLineIndex);
+                        return;
+                    }
+                    if (taken)
+                        jumpCnt++;
+                    break;
+                }
+                case TraceJit::GUARD_NEXT:
+                {
+                    NextStmt* nextStmt = static_cast<NextStmt*>(step.statement);
+                    nextStmt->countExecution();
+                    bool taken = nextStmt->advance(this);
+                    if (taken != step.taken)
+                    {
+                        nextPos = step.pos + 1;
+                        if (taken)
+                            gotoLine(nextStmt->bodyLineIndex);
+                        return;
+                    }
+                    if (taken)
+                        jumpCnt++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void ProgramManager::dropJit()
+{
+    if (jit)
+        delete jit;
+    jit = nullptr;
+    jitHook = false;
+}
+
+// 优化后的树压进一个新池；其他引擎不生成，树上残留的poolIndex随旧池一起作废
+void ProgramManager::buildExpressionPool()
+{
+    if (expPool)
+        delete expPool;
+    expPool = nullptr;
+    if (engine != OPTIMIZING_ENGINE)
+        return;
+
+    expPool = new ExpressionPool(specializeNodes);
+    std::vector<Expression*> exps;
+    for (size_t pos = 0; pos < program.size(); pos++)
+        program.statementAt(pos)->collectExpressions(exps);
+    for (auto exp : exps)
+        expPool->add(exp);
+    expPool->compact();
 }
 
 void ProgramManager::stopRunning()
 {
-    _isRunning = false;
+    runState = STOPPED;
+    pendingWatchpoint = -1;
+    removeTraps();
+    finishCheckpointWrite();
+    if (traceRecorder)
+    {
+        appendOutput("[Trace] " + std::to_string(traceRecorder->getStepCnt()) + " steps recorded to " + tracePath);
+        delete traceRecorder;
+        traceRecorder = nullptr;
+        tracing = traceReader != nullptr;
+    }
     generateSyntaxTree();
+    showMetrics();
 }
 
-bool ProgramManager::isRunning() { return _isRunning; }
-bool ProgramManager::isWaitingForInput() { return _isWaitingForInput; }
+bool ProgramManager::isRunning() { return runState != STOPPED; }
+bool ProgramManager::isWaitingForInput() { return runState == WAITING_FOR_INPUT; }
+bool ProgramManager::isPaused() { return runState == PAUSED; }
 
-int ProgramManager::getVarValue(const std::string& name) const
+int ProgramManager::getVarValue(const int varId) const
 {
-    return context->getVarValue(name);
+    return context->getVarValue(varId);
 }
 
 int ProgramManager::getExpressionValue(Expression* expression) const
 {
+    if (expPool && expression->poolIndex >= 0)
+        return expPool->evaluate(expression->poolIndex, context);
     return expression->getValue(context);
 }
 
-int ProgramManager::getVarUseCnt(const std::string& name) const
+void ProgramManager::writeExpressionTree(std::string& out, const Expression* expression, int indent) const
+{
+    if (expPool && expression->poolIndex >= 0)
+        expPool->writeSyntaxTree(expression->poolIndex, out, indent);
+    else
+        expression->writeSyntaxTree(out, indent);
+}
+
+int ProgramManager::getVarUseCnt(const int varId) const
+{
+    return context->getVarUseCnt(varId);
+}
+
+void ProgramManager::setVarValue(const int varId, Expression* expression)
+{
+    context->setVarValue(varId, getExpressionValue(expression));
+}
+
+void ProgramManager::setVarValue(const int varId, const int value)
+{
+    context->setVarValue(varId, value);
+}
+
+void ProgramManager::setArrayValue(IndexExp* target, Expression* expression)
+{
+    int value = getExpressionValue(expression);
+    if (expPool && target->poolIndex >= 0)
+        expPool->store(target->poolIndex, context, value);
+    else
+        target->setValue(context, value);
+}
+
+void ProgramManager::dimArray(const int varId, const int size)
 {
-    return context->getVarUseCnt(name);
+    context->dimArray(varId, size);
 }
 
-void ProgramManager::setVarValue(const std::string& name, Expression* expression)
+int ProgramManager::getArraySize(const int varId) const
 {
-    context->setVarValue(name, expression->getValue(context));
+    return context->getArraySize(varId);
 }
 
 void ProgramManager::println(const std::string& str)
 {
-    ui->textBrowser->append(QString::fromStdString(str));
+    outputBytes += str.size() + 1;
+    if (limits.maxOutputBytes > 0 && outputBytes > limits.maxOutputBytes)
+        throw "Output limit exceeded";
+    if (!outputMuted)
+        appendOutput(str);
+}
+
+// 没有界面时（命令行模式）直接写到标准输出
+void ProgramManager::appendOutput(const std::string& str)
+{
+    if (outputCapture)
+        outputCapture->push_back( {curPos < program.size() ? program.lineIndexAt(curPos) : -1, str} );
+    else if (ui)
+        ui->outputView->append(QString::fromStdString(str));
+    else
+        std::cout << str << '\n';
 }
 
 void ProgramManager::runtimeError(const std::string& str)
 {
-    int lineIndex = curLineIter->first;
-    ui->textBrowser->append(QString::fromStdString("[Runtime Error] At line " + std::to_string(lineIndex) + ": " + str));
+    int lineIndex = program.lineIndexAt(curPos);
+    appendOutput("[Runtime Error] At line " + std::to_string(lineIndex) + ": " + str);
     stopRunning();
 }
 
-void ProgramManager::inputVar(const std::string& varName)
+void ProgramManager::inputVar(const int varId)
 {
-    _isWaitingForInput = true;
-    ui->textBrowser->append(" ? ");
-    varNameWaitingForInput = varName;
+    requestInput(varId, program.lineIndexAt(curPos));
+}
 
-    QTimer* inputCheckTimer = new QTimer();
-    connect(inputCheckTimer, &QTimer::timeout, this, [this]() {
-        if (_isWaitingForInput && !ui->cmdLineEdit->text().startsWith(" ? "))
-            ui->cmdLineEdit->setText(" ? ");
-    });
-    inputCheckTimer->start(100);
+// 队列中有输入时直接读取，不中断执行；否则等待InputQueue::inputAvailable信号
+void ProgramManager::requestInput(const int varId, const int lineIndex)
+{
+    int value;
+    if (inputQueue->pop(value))
+    {
+        if (!outputMuted)
+            appendOutput(" ? " + std::to_string(value));
+        assignInput(varId, value);
+        return;
+    }
+
+    // 命令行模式下没有人能再提供输入
+    if (!ui)
+        throw "No input available";
+
+    runState = WAITING_FOR_INPUT;
+    inputWaitTimer.start();
+    ui->outputView->append(" ? ");
+    inputPromptLine = ui->outputView->lineCount() - 1;
+    ui->cmdLineEdit->setText(" ? ");
+    varIdWaitingForInput = varId;
+    lineWaitingForInput = lineIndex;
 }
 
-void ProgramManager::gotInput(int value)
+void ProgramManager::onInputAvailable()
 {
-    ui->textBrowser->insertPlainText(QString::number(value));
-    context->setVarValue(varNameWaitingForInput, value);
-    _isWaitingForInput = false;
-    continueRunning();
+    int value;
+    if (runState != WAITING_FOR_INPUT || !inputQueue->pop(value))
+        return;
+
+    inputWaitMillis += inputWaitTimer.elapsed();
+    // 等待期间又有输出（如调试命令的结果）时，输入的值另起一行，保持先后顺序
+    if (ui->outputView->lineCount() == inputPromptLine + 1)
+        ui->outputView->appendToLastLine(QString::number(value));
+    else
+        ui->outputView->append(" ? " + QString::number(value));
+    runState = RUNNING;
+    assignInput(varIdWaitingForInput, value);
+    if (runState == RUNNING && pendingWatchpoint != -1)
+        trapWatchpoint(pendingWatchpoint);
+    pendingWatchpoint = -1;
+    if (runState == RUNNING)
+        continueRunning();
+}
+
+void ProgramManager::assignInput(const int varId, int value)
+{
+    if (traceRecorder)
+        traceRecorder->recordInput(value);
+
+    int oldValue;
+    bool changed = !context->findVarValue(varId, oldValue) || oldValue != value;
+    context->setVarValue(varId, value);
+    if (changed && watchpoints.count(varId))
+        trapWatchpoint(varId);
 }
 
+InputQueue* ProgramManager::getInputQueue() { return inputQueue; }
+
 void ProgramManager::gotoLine(int targetLineIndex)
 {
-    auto tempLineIter = curLineIter;
-    curLineIter = statements.find(targetLineIndex);
-    if (curLineIter == statements.end())
+    if (!loopDetectors.empty() && targetLineIndex <= program.lineIndexAt(curPos))
+        checkInfiniteLoop(program.lineIndexAt(curPos));
+
+    size_t targetPos = program.find(targetLineIndex);
+    if (targetPos == program.size())
     {
-        curLineIter = tempLineIter;
         runtimeError("GOTO statement with a non-existed line index");
+        return;
     }
+    nextPos = targetPos;
+    jumpCnt++;
+    if (jit && targetPos <= curPos && jit->onBackEdge(targetPos))
+        jitHook = true;
 }
 
-void ProgramManager::generateSyntaxTree()
+// 跳到某一行的下一行，FOR的循环次数为零时用来越过NEXT
+void ProgramManager::gotoLineAfter(int lineIndex)
 {
-    std::stringstream res;
-
-    for (auto& statement : statements)
+    size_t pos = program.find(lineIndex);
+    if (pos == program.size())
     {
-        res << statement.first << " " << statement.second->getTreeDisplay(this);
+        runtimeError("GOTO statement with a non-existed line index");
+        return;
     }
+    nextPos = pos + 1;
+    jumpCnt++;
+}
 
-    ui->treeDisplay->setText(QString::fromStdString(res.str()));
+void ProgramManager::callSubroutine(int targetLineIndex)
+{
+    if (returnDepth == RETURN_STACK_SIZE)
+        throw "GOSUB nested too deeply";
+    returnStack[returnDepth++] = nextPos;
+    gotoLine(targetLineIndex);
 }
 
-bool ProgramManager::isValidVarName(const std::string varName) const
+void ProgramManager::returnFromSubroutine()
 {
-    if (varName.empty())
-        return false;
+    if (returnDepth == 0)
+        throw "RETURN without GOSUB";
+    nextPos = returnStack[--returnDepth];
+    jumpCnt++;
+}
 
-    if (!std::isalpha(varName[0]))
-        return false;
+// 只标记过期：树视图可见时先生成第一屏，其余在空闲时分段补上，运行结束后立即把控制交还给用户
+void ProgramManager::generateSyntaxTree()
+{
+    if (!ui)
+        return;
 
-    for (size_t i = 1; i < varName.length(); i++)
+    treeDirty = true;
+    showSyntaxTree();
+}
+
+// 树视图显示出来时调用；不可见时什么也不做，等下一次显示
+void ProgramManager::showSyntaxTree()
+{
+    if (!ui || !treeDirty || !ui->treeDisplay->isVisible())
+        return;
+
+    treeDirty = false;
+    treeRenderedPos = 0;
+    int visibleLines = ui->treeDisplay->viewport()->height() / ui->treeDisplay->fontMetrics().lineSpacing() + 1;
+    std::string res;
+    int lineCnt = 0;
+    while (treeRenderedPos < program.size() && lineCnt < visibleLines)
     {
-        char c = varName[i];
-        if (!std::isalnum(c) && c != '_')
-            return false;
+        size_t oldSize = res.size();
+        writeSyntaxTree(res, treeRenderedPos, treeRenderedPos + 1);
+        lineCnt += std::count(res.begin() + oldSize, res.end(), '\n');
+        treeRenderedPos++;
     }
+    ui->treeDisplay->setPlainText(QString::fromStdString(res));
+    scheduleSyntaxTreeChunk();
+}
 
-    return true;
+// 滚动到已生成部分的末尾时调用，不等空闲直接补上一段
+void ProgramManager::extendSyntaxTree()
+{
+    if (ui && !treeDirty)
+        renderSyntaxTreeChunk();
+}
+
+// 程序或统计即将改变时丢弃已生成的部分，不再接着补，树中不会混有两个时刻的状态；
+// 等树视图下一次显示或运行结束时按优化后的语句重新生成
+void ProgramManager::discardSyntaxTree()
+{
+    if (!ui || treeDirty)
+        return;
+    treeDirty = true;
+    treeRenderedPos = 0;
+    ui->treeDisplay->clear();
+}
+
+void ProgramManager::renderSyntaxTreeChunk()
+{
+    size_t end = std::min(program.size(), treeRenderedPos + TREE_CHUNK_SIZE);
+    if (treeRenderedPos >= end)
+        return;
+
+    std::string res;
+    writeSyntaxTree(res, treeRenderedPos, end);
+    treeRenderedPos = end;
+    QTextCursor cursor(ui->treeDisplay->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(QString::fromStdString(res));
+}
+
+void ProgramManager::scheduleSyntaxTreeChunk()
+{
+    if (treeChunkScheduled || treeDirty || treeRenderedPos >= program.size())
+        return;
+
+    treeChunkScheduled = true;
+    QTimer::singleShot(0, this, [this]() {
+        treeChunkScheduled = false;
+        if (treeDirty)
+            return;
+        renderSyntaxTreeChunk();
+        scheduleSyntaxTreeChunk();
+    });
+}
+
+// 所有语句依次写入同一个缓冲区，避免逐层拼接字符串
+void ProgramManager::writeSyntaxTree(std::string& out, size_t from, size_t to)
+{
+    for (size_t pos = from; pos < to; pos++)
+    {
+        Expression::appendNumber(out, program.lineIndexAt(pos));
+        out += " ";
+        program.statementAt(pos)->writeTreeDisplay(out, this);
+    }
+}
+
+void ProgramManager::setExecutionLimits(const ExecutionLimits& limits)
+{
+    this->limits = limits;
+}
+
+// 语句数由限制检查的计数器推算，读取次数由各变量的使用次数汇总，执行时不需要额外计数
+ProgramManager::RuntimeMetrics ProgramManager::getMetrics() const
+{
+    RuntimeMetrics metrics;
+    metrics.statements = executedCnt + limitCheckInterval - limitCheckCountdown;
+    metrics.runMillis = runMillis + (runTimer.isValid() ? runTimer.elapsed() : 0);
+    metrics.expressionNodes = context->getEvalCnt();
+    metrics.varReads = context->getReadCnt();
+    metrics.varWrites = context->getWriteCnt();
+    metrics.jumps = jumpCnt;
+    metrics.outputBytes = outputBytes;
+    metrics.inputWaitMillis = inputWaitMillis;
+    if (runState == WAITING_FOR_INPUT)
+        metrics.inputWaitMillis += inputWaitTimer.elapsed();
+    metrics.peakMemoryKB = getPeakMemoryKB();
+    return metrics;
+}
+
+void ProgramManager::showMetrics()
+{
+    if (ui)
+        ui->metricsDisplay->setPlainText(QString::fromStdString(getMetrics().toText()));
+}
+
+void ProgramManager::setEngine(EngineType engine)
+{
+    this->engine = engine;
+}
+
+void ProgramManager::setNodeSpecialization(bool enabled)
+{
+    specializeNodes = enabled;
+}
+
+void ProgramManager::setOutputCapture(std::vector<OutputRecord>* capture)
+{
+    outputCapture = capture;
+}
+
+const RuntimeContext* ProgramManager::getContext() const
+{
+    return context;
+}
+
+// 每一行的行号和执行次数，按行号排列
+std::vector<std::pair<int, int>> ProgramManager::getExecutionCnts() const
+{
+    std::vector<std::pair<int, int>> res;
+    res.reserve(program.size());
+    for (size_t pos = 0; pos < program.size(); pos++)
+        res.push_back( {program.lineIndexAt(pos), program.statementAt(pos)->getExecutionCnt()} );
+    return res;
+}
+
+std::vector<ProgramManager::BranchCnt> ProgramManager::getBranchCnts() const
+{
+    std::vector<BranchCnt> res;
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        if (IfStmt* ifStmt = dynamic_cast<IfStmt*>(untrappedStatementAt(pos)))
+            res.push_back( {program.lineIndexAt(pos), ifStmt->getTrueCnt(), ifStmt->getFalseCnt()} );
+    }
+    return res;
+}
+
+std::vector<ProgramManager::LoopCnt> ProgramManager::getLoopCnts() const
+{
+    std::vector<LoopCnt> res;
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        if (NextStmt* nextStmt = dynamic_cast<NextStmt*>(untrappedStatementAt(pos)))
+            res.push_back( {program.lineIndexAt(pos), nextStmt->getLoopCnt(), nextStmt->getExitCnt()} );
+    }
+    return res;
+}
+
+// 第一条给变量或数组元素赋值的语句所在的行，没有时为-1
+int ProgramManager::findDefiningLine(const int varId) const
+{
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        Statement* stmt = program.statementAt(pos);
+        LetStmt* letStmt = dynamic_cast<LetStmt*>(stmt);
+        if (stmt->getDefinedVarId() == varId || (letStmt && letStmt->target && letStmt->target->varId == varId))
+            return program.lineIndexAt(pos);
+    }
+    return -1;
+}
+
+long long ProgramManager::RuntimeMetrics::statementsPerSecond() const
+{
+    if (runMillis <= 0)
+        return 0;
+    return statements * 1000 / runMillis;
+}
+
+std::string ProgramManager::RuntimeMetrics::toText() const
+{
+    std::stringstream res;
+    res << "Statements: " << statements << "\n"
+        << "Statements/sec: " << statementsPerSecond() << "\n"
+        << "Run time: " << runMillis << " ms\n"
+        << "Expression nodes: " << expressionNodes << "\n"
+        << "Variable reads: " << varReads << "\n"
+        << "Variable writes: " << varWrites << "\n"
+        << "Jumps: " << jumps << "\n"
+        << "Output bytes: " << outputBytes << "\n"
+        << "INPUT wait: " << inputWaitMillis << " ms\n"
+        << "Peak memory: " << peakMemoryKB << " KB";
+    return res.str();
+}
+
+std::string ProgramManager::RuntimeMetrics::toJson() const
+{
+    std::stringstream res;
+    res << "{\n"
+        << "  \"statements\": " << statements << ",\n"
+        << "  \"statements_per_second\": " << statementsPerSecond() << ",\n"
+        << "  \"run_millis\": " << runMillis << ",\n"
+        << "  \"expression_nodes\": " << expressionNodes << ",\n"
+        << "  \"var_reads\": " << varReads << ",\n"
+        << "  \"var_writes\": " << varWrites << ",\n"
+        << "  \"jumps\": " << jumps << ",\n"
+        << "  \"output_bytes\": " << outputBytes << ",\n"
+        << "  \"input_wait_millis\": " << inputWaitMillis << ",\n"
+        << "  \"peak_memory_kb\": " << peakMemoryKB << "\n"
+        << "}\n";
+    return res.str();
+}
+
+// 每隔一段语句才检查一次，避免每条语句都读时钟；单步执行也借用这个计数
+bool ProgramManager::checkLimits()
+{
+    executedCnt += limitCheckInterval;
+    if (limits.maxStatements > 0 && executedCnt > limits.maxStatements)
+        throw "Statement limit exceeded";
+    if (limits.maxMillis > 0 && runMillis + runTimer.elapsed() > limits.maxMillis)
+        throw "Time limit exceeded";
+
+    if (stepRequested)
+    {
+        stepRequested = false;
+        executedCnt--;
+        scheduleLimitCheck();
+        pause("Step");
+        return false;
+    }
+
+    // 当前这一步还没有执行，与单步暂停一样不计入；写文件在后台进行，这里只复制状态
+    if (nextCheckpoint > 0 && executedCnt >= nextCheckpoint)
+    {
+        finishCheckpointWrite();
+        Checkpoint checkpoint;
+        captureCheckpoint(checkpoint, executedCnt - 1);
+        checkpointWrite = std::async(std::launch::async, Checkpoint::write, checkpointPath, checkpoint.encode());
+        nextCheckpoint = executedCnt + checkpointInterval;
+    }
+
+    scheduleLimitCheck();
+    return true;
+}
+
+void ProgramManager::scheduleLimitCheck()
+{
+    limitCheckInterval = LIMIT_CHECK_INTERVAL;
+    if (limits.maxStatements > 0 && limits.maxStatements - executedCnt + 1 < limitCheckInterval)
+        limitCheckInterval = limits.maxStatements - executedCnt + 1;
+    limitCheckCountdown = limitCheckInterval;
+}
+
+void ProgramManager::checkInfiniteLoop(int latchLineIndex)
+{
+    auto it = loopDetectors.find(latchLineIndex);
+    if (it == loopDetectors.end())
+        return;
+
+    // 上一次回边之后循环头只应执行过一次（就是那次回边），多出来的是从循环外再次进入，如又一次GOSUB到这里
+    LoopDetector& detector = it->second;
+    long long headerCnt = untrappedStatementAt(detector.headerPos)->getExecutionCnt();
+    if (headerCnt != detector.headerCnt + 1)
+    {
+        LoopDetector entered;
+        entered.headerPos = detector.headerPos;
+        detector = entered;
+    }
+    detector.headerCnt = headerCnt;
+
+    size_t hash = context->hashVarValues();
+    if (detector.steps > 0 && hash == detector.savedHash
+        && context->getVarValues() == detector.savedValues && context->getVarDefined() == detector.savedDefined)
+        throw "Infinite loop detected";
+
+    if (++detector.steps == detector.power)
+    {
+        detector.power *= 2;
+        detector.steps = 0;
+        detector.savedHash = hash;
+        detector.savedValues = context->getVarValues();
+        detector.savedDefined = context->getVarDefined();
+    }
+}
+
+bool ProgramManager::runDebugCommand(const QString& command)
+{
+    QStringList args = command.trimmed().split(' ', Qt::SkipEmptyParts);
+    if (args.isEmpty())
+        return false;
+
+    QString keyword = args[0].toUpper();
+    bool ok = false;
+    if ((keyword == "BREAK" || keyword == "UNBREAK") && args.size() == 2)
+    {
+        int lineIndex = args[1].toInt(&ok);
+        if (ok)
+            setBreakpoint(lineIndex, keyword == "BREAK");
+    }
+    else if ((keyword == "WATCH" || keyword == "UNWATCH") && args.size() == 2)
+    {
+        ok = isValidVarName(args[1].toStdString());
+        if (ok)
+            setWatchpoint(args[1].toStdString(), keyword == "WATCH");
+    }
+    else if (keyword == "STEP" && args.size() == 1)
+    {
+        ok = true;
+        step();
+    }
+    else if (keyword == "CONT" && args.size() == 1)
+    {
+        ok = true;
+        resume();
+    }
+    else if (keyword == "APPLY" && args.size() == 1)
+    {
+        ok = true;
+        if (applyEdits() && isPaused())
+            resume();
+    }
+    else if (keyword == "CHECKPOINT" && (args.size() == 2 || args.size() == 3))
+    {
+        bool off = args[1].toUpper() == "OFF";
+        int interval = 0;
+        ok = args.size() == 2 || (!off && (interval = args[2].toInt(&ok)) > 0);
+        if (ok && off)
+        {
+            setCheckpointPath("", 0);
+            appendOutput("[Checkpoint] Automatic checkpoints disabled");
+        }
+        else if (ok && interval > 0)
+        {
+            setCheckpointPath(args[1].toStdString(), interval);
+            appendOutput("[Checkpoint] Saving to " + checkpointPath + " every " + std::to_string(interval)
+                         + " statements from the next run");
+        }
+        else if (ok)
+        {
+            saveCheckpoint(args[1].toStdString());
+        }
+    }
+    else if (keyword == "RESUME" && args.size() == 2)
+    {
+        ok = true;
+        resumeCheckpoint(args[1].toStdString());
+    }
+    else if (keyword == "TRACE" && args.size() == 2)
+    {
+        ok = true;
+        bool off = args[1].toUpper() == "OFF";
+        setTracePath(off ? "" : args[1].toStdString());
+        appendOutput(off ? "[Trace] Recording disabled" : "[Trace] Next run will be recorded to " + tracePath);
+    }
+    return ok;
+}
+
+// 不带行号的PRINT和LET在当前的运行环境中立即执行，运行结束后、暂停或等待输入时都可以使用。
+// 表达式按源码缓存，调试时反复查看同一个表达式不再重新解析；执行不计入变量的使用次数
+bool ProgramManager::runImmediate(const QString& command)
+{
+    QString text = command.trimmed();
+    if (text.isEmpty() || text[0].isDigit())
+        return false;
+
+    int spacePos = text.indexOf(' ');
+    QString keyword = spacePos == -1 ? text : text.left(spacePos);
+    QString arguments = spacePos == -1 ? QString() : text.mid(spacePos + 1).trimmed();
+    KeywordType type = keywordFromStr(keyword.toStdString());
+    if (type == UNKNOWN_KEYWORD)
+        return false;
+
+    std::vector<int> useCnts;
+    try
+    {
+        Expression* target = nullptr;
+        Expression* exp = nullptr;
+        if (type == PRINT)
+        {
+            exp = immediateExps.get(arguments.toStdString());
+        }
+        else if (type == LET)
+        {
+            int eqPos = arguments.indexOf('=');
+            if (eqPos == -1)
+                throw "LET statement with no '='";
+            // 轨迹里的每一步依赖原来的变量值，中途赋值会让记录或回放对不上
+            if (tracing)
+                throw "Cannot assign while a trace is recorded or replayed";
+            target = immediateExps.get(arguments.left(eqPos).trimmed().toStdString());
+            exp = immediateExps.get(arguments.mid(eqPos + 1).trimmed().toStdString());
+            if (!dynamic_cast<IdentifierExp*>(target) && !dynamic_cast<IndexExp*>(target))
+                throw "LET statement with invalid variable name";
+        }
+        else
+        {
+            throw "Only PRINT and LET can run without a line number";
+        }
+
+        // 解析时新出现的变量名已经驻留
+        for (int varId = 0; varId < SymbolTable::instance().size(); varId++)
+            useCnts.push_back(context->getVarUseCnt(varId));
+        int value = exp->getValue(context);
+        if (target)
+            assignImmediate(target, value);
+        else
+            appendOutput(std::to_string(value));
+    }
+    catch (const char* errMsg)
+    {
+        appendOutput(std::string("[Immediate] ") + errMsg);
+    }
+    catch (const std::string& errMsg)
+    {
+        appendOutput("[Immediate] " + errMsg);
+    }
+    restoreVarUseCnts(useCnts);
+    return true;
+}
+
+// 赋值可能推翻FOR在入口处对数组下标范围的检查，所有外提的检查都作废，逐次检查到下一次进入循环；
+// 公共子表达式的缓存由RuntimeContext::setVarValue按读取的变量失效
+void ProgramManager::assignImmediate(Expression* target, int value)
+{
+    int watchedVarId = -1;
+    if (IdentifierExp* var = dynamic_cast<IdentifierExp*>(target))
+    {
+        int oldValue;
+        bool changed = !context->findVarValue(var->varId, oldValue) || oldValue != value;
+        context->setVarValue(var->varId, value);
+        if (changed && watchpoints.count(var->varId))
+            watchedVarId = var->varId;
+    }
+    else
+        static_cast<IndexExp*>(target)->setValue(context, value);
+
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        if (ForStmt* forStmt = dynamic_cast<ForStmt*>(program.statementAt(pos)))
+            forStmt->boundsVerified = false;
+    }
+
+    // 监视的变量被改动时和程序自己赋值一样暂停；等待输入时先记下，取到输入后再暂停
+    // 暂停时立即赋值触发的监视点仍停在原来的位置，继续时和原来一样跳过这里的陷阱
+    if (watchedVarId != -1 && runState == PAUSED)
+    {
+        bool skipTrap = skipTrapOnResume;
+        trapWatchpoint(watchedVarId);
+        skipTrapOnResume = skipTrap;
+    }
+    else if (watchedVarId != -1 && runState == WAITING_FOR_INPUT)
+        pendingWatchpoint = watchedVarId;
+    else if (runState == PAUSED)
+        showPausedState();
+}
+
+void ProgramManager::restoreVarUseCnts(const std::vector<int>& useCnts)
+{
+    for (size_t varId = 0; varId < useCnts.size(); varId++)
+    {
+        int delta = context->getVarUseCnt(varId) - useCnts[varId];
+        if (delta != 0)
+            context->addVarUseCnt(varId, -delta);
+    }
+}
+
+void ProgramManager::setBreakpoint(int lineIndex, bool enabled)
+{
+    if (enabled)
+    {
+        breakpoints.insert(lineIndex);
+        appendOutput("[Debug] Breakpoint set at line " + std::to_string(lineIndex));
+    }
+    else
+    {
+        breakpoints.erase(lineIndex);
+        appendOutput("[Debug] Breakpoint removed at line " + std::to_string(lineIndex));
+    }
+
+    // 轨迹和虚拟机执行的都是原来的语句，绕过了陷阱
+    if (isRunning())
+    {
+        leaveVm();
+        dropJit();
+        installTraps();
+    }
+}
+
+void ProgramManager::setWatchpoint(const std::string& varName, bool enabled)
+{
+    if (enabled)
+    {
+        watchpoints.insert(SymbolTable::instance().intern(varName));
+        appendOutput("[Debug] Watching variable " + varName);
+    }
+    else
+    {
+        watchpoints.erase(SymbolTable::instance().intern(varName));
+        appendOutput("[Debug] Stopped watching variable " + varName);
+    }
+
+    if (isRunning())
+    {
+        leaveVm();
+        dropJit();
+        installTraps();
+    }
+}
+
+// 让计数器在下一条语句开始前触发，从而在不增加额外检查的前提下执行一条语句后暂停
+void ProgramManager::step()
+{
+    if (runState != PAUSED)
+        return;
+
+    executedCnt += limitCheckInterval - limitCheckCountdown;
+    limitCheckInterval = limitCheckCountdown = 2;
+    stepRequested = true;
+    skipTrapOnce = skipTrapOnResume && curPos < program.size() ? program.statementAt(curPos) : nullptr;
+    runState = RUNNING;
+    continueRunning();
+}
+
+void ProgramManager::resume()
+{
+    if (runState != PAUSED)
+        return;
+
+    skipTrapOnce = skipTrapOnResume && curPos < program.size() ? program.statementAt(curPos) : nullptr;
+    runState = RUNNING;
+    continueRunning();
+}
+
+bool ProgramManager::trapBreakpoint(const Statement* trap)
+{
+    if (skipTrapOnce == trap)
+    {
+        skipTrapOnce = nullptr;
+        return false;
+    }
+
+    nextPos = curPos;
+    if (traceRecorder)
+        traceRecorder->skipNextStep();
+    pause("Breakpoint");
+    return true;
+}
+
+// 引起暂停的赋值已经执行完，继续时从下一条语句开始，那里的断点照常生效
+void ProgramManager::trapWatchpoint(const int varId)
+{
+    int value = 0;
+    context->findVarValue(varId, value);
+    pause("Watchpoint " + SymbolTable::instance().nameOf(varId) + " = " + std::to_string(value));
+    skipTrapOnResume = false;
+}
+
+bool ProgramManager::peekVarValue(const int varId, int& value) const
+{
+    return context->findVarValue(varId, value);
+}
+
+void ProgramManager::pause(const std::string& reason)
+{
+    runState = PAUSED;
+    skipTrapOnce = nullptr;
+    skipTrapOnResume = true;
+    stepRequested = false;
+    int lineIndex = curPos < program.size() ? program.lineIndexAt(curPos) : -1;
+    appendOutput("[Paused] At line " + std::to_string(lineIndex) + ": " + reason);
+    showPausedState();
+    showMetrics();
+}
+
+void ProgramManager::showPausedState()
+{
+    std::stringstream res;
+    if (curPos < program.size())
+        res << "Line " << program.lineIndexAt(curPos) << "\n\n";
+
+    std::map<std::string, int> sortedVars;
+    const std::vector<int>& values = context->getVarValues();
+    const std::vector<char>& defined = context->getVarDefined();
+    for (size_t varId = 0; varId < values.size(); varId++)
+    {
+        if (defined[varId])
+            sortedVars[SymbolTable::instance().nameOf(varId)] = values[varId];
+    }
+    for (auto& var : sortedVars)
+        res << var.first << " = " << var.second << "\n";
+    if (!ui)
+    {
+        std::cout << res.str();
+        return;
+    }
+    ui->varDisplay->setPlainText(QString::fromStdString(res.str()));
+
+    // 在代码框中高亮当前行
+    QList<QTextEdit::ExtraSelection> selections;
+    if (curPos < program.size())
+    {
+        QString prefix = QString::number(program.lineIndexAt(curPos)) + " ";
+        QTextDocument* document = ui->CodeDisplay->document();
+        for (QTextBlock block = document->begin(); block.isValid(); block = block.next())
+        {
+            if (!block.text().startsWith(prefix))
+                continue;
+
+            QTextEdit::ExtraSelection selection;
+            selection.format.setBackground(QColor(Qt::yellow));
+            selection.format.setProperty(QTextFormat::FullWidthSelection, true);
+            selection.cursor = QTextCursor(block);
+            selections.append(selection);
+            ui->CodeDisplay->setTextCursor(selection.cursor);
+        }
+    }
+    ui->CodeDisplay->setExtraSelections(selections);
+}
+
+void ProgramManager::installTraps()
+{
+    removeTraps();
+    for (int lineIndex : breakpoints)
+        installTrap(lineIndex);
+    if (watchpoints.empty())
+        return;
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        Statement* statement = program.statementAt(pos);
+        if (!dynamic_cast<InputStmt*>(statement) && watchpoints.count(statement->getDefinedVarId()))
+            installTrap(program.lineIndexAt(pos));
+    }
+}
+
+void ProgramManager::installTrap(int lineIndex)
+{
+    size_t pos = program.find(lineIndex);
+    if (pos == program.size() || trappedStatements.count(lineIndex))
+        return;
+
+    Statement* original = program.statementAt(pos);
+    Statement* trap = original;
+    if (!dynamic_cast<InputStmt*>(original) && watchpoints.count(original->getDefinedVarId()))
+        trap = new WatchpointStmt(trap);
+    if (breakpoints.count(lineIndex))
+        trap = new BreakpointStmt(trap);
+
+    trappedStatements[lineIndex] = original;
+    program.replaceStatementAt(pos, trap);
+}
+
+// 被替换下来的陷阱语句可能正在执行（例如断点所在行是END），所以延迟到下次运行再释放
+void ProgramManager::removeTraps()
+{
+    for (auto& trapped : trappedStatements)
+    {
+        size_t pos = program.find(trapped.first);
+        if (pos == program.size())
+            continue;
+        retiredTraps.push_back(program.statementAt(pos));
+        program.replaceStatementAt(pos, trapped.second);
+    }
+    trappedStatements.clear();
+}
+
+bool ProgramManager::isValidVarName(const std::string varName)
+{
+    if (varName.empty())
+        return false;
+
+    if (!std::isalpha(varName[0]))
+        return false;
+
+    for (size_t i = 1; i < varName.length(); i++)
+    {
+        char c = varName[i];
+        if (!std::isalnum(c) && c != '_')
+            return false;
+    }
+
+    return true;
+}
+
+// 关键字的完美哈希：首字符、末字符和长度组合后在16项的表中互不冲突，再用一次比较确认
+ProgramManager::KeywordType ProgramManager::keywordFromStr(const std::string& keyword)
+{
+    static const char* const keywordTable[KEYWORD_TABLE_SIZE] =
+    {
+        "RETURN", "FOR", "NEXT", "IF", "GOSUB", "PRINT", nullptr, "GOTO",
+        "END", "REM", nullptr, "DIM", nullptr, nullptr, "INPUT", "LET"
+    };
+    static const KeywordType typeTable[KEYWORD_TABLE_SIZE] =
+    {
+        RETURN, FOR, NEXT, IF, GOSUB, PRINT, UNKNOWN_KEYWORD, GOTO,
+        END, REM, UNKNOWN_KEYWORD, DIM, UNKNOWN_KEYWORD, UNKNOWN_KEYWORD, INPUT, LET
+    };
+
+    if (keyword.empty())
+        return UNKNOWN_KEYWORD;
+
+    unsigned char first = keyword.front();
+    unsigned char last = keyword.back();
+    int slot = (first + 4 * last + keyword.size()) & (KEYWORD_TABLE_SIZE - 1);
+    if (keywordTable[slot] == nullptr || keyword != keywordTable[slot])
+        return UNKNOWN_KEYWORD;
+    return typeTable[slot];
+}
+
+// 按行号顺序为每个NEXT找到对应的FOR；NEXT省略变量名时匹配最内层的FOR
+void ProgramManager::linkLoops()
+{
+    std::vector<size_t> openLoops;
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        Statement* statement = program.statementAt(pos);
+        if (ForStmt* forStmt = dynamic_cast<ForStmt*>(statement))
+        {
+            forStmt->nextLineIndex = forStmt->exitLineIndex = -1;
+            openLoops.push_back(pos);
+        }
+
+        NextStmt* nextStmt = dynamic_cast<NextStmt*>(statement);
+        if (!nextStmt)
+            continue;
+
+        nextStmt->loop = nullptr;
+        nextStmt->bodyLineIndex = -1;
+        int depth = openLoops.size() - 1;
+        while (depth >= 0 && nextStmt->varId != -1
+               && static_cast<ForStmt*>(program.statementAt(openLoops[depth]))->varId != nextStmt->varId)
+            depth--;
+        if (depth < 0)
+            continue;
+
+        size_t forPos = openLoops[depth];
+        openLoops.resize(depth);
+        ForStmt* forStmt = static_cast<ForStmt*>(program.statementAt(forPos));
+        forStmt->nextLineIndex = program.lineIndexAt(pos);
+        forStmt->exitLineIndex = pos + 1 < program.size() ? program.lineIndexAt(pos + 1) : -1;
+        nextStmt->loop = forStmt;
+        nextStmt->bodyLineIndex = program.lineIndexAt(forPos + 1);
+    }
+}
+
+// 查找作为独立单词出现的关键字，避免匹配到TOTAL之类的变量名
+int ProgramManager::findKeyword(const std::string& str, const std::string& keyword, int from)
+{
+    size_t pos = from;
+    while ((pos = str.find(keyword, pos)) != std::string::npos)
+    {
+        size_t end = pos + keyword.size();
+        bool startsWord = pos == 0 || !(std::isalnum((unsigned char)str[pos - 1]) || str[pos - 1] == '_');
+        bool endsWord = end == str.size() || !(std::isalnum((unsigned char)str[end]) || str[end] == '_');
+        if (startsWord && endsWord)
+            return pos;
+        pos++;
+    }
+    return -1;
+}
+
+void ProgramManager::setTracePath(const std::string& path)
+{
+    tracePath = path;
+}
+
+void ProgramManager::setTraceReader(TraceReader* reader)
+{
+    traceReader = reader;
+    traceSnapshots.clear();
+    traceSnapshotInterval = TRACE_SNAPSHOT_INTERVAL;
+    traceSeekStep = -1;
+    tracing = traceRecorder || traceReader;
+}
+
+void ProgramManager::setOutputMuted(bool muted)
+{
+    outputMuted = muted;
+}
+
+// 每执行一步：记录轨迹，或与正在回放的轨迹核对
+void ProgramManager::traceStep()
+{
+    // END结束程序的那一步不计入轨迹
+    if (runState == STOPPED)
+        return;
+    if (traceRecorder)
+        traceRecorder->recordStep(curPos, nextPos);
+    if (!traceReader)
+        return;
+
+    size_t expectedNextPos;
+    if (!traceReader->nextStep(expectedNextPos) || expectedNextPos != nextPos)
+        throw "Execution diverged from the trace";
+
+    long long step = traceReader->getStep();
+    if (step % traceSnapshotInterval == 0)
+        saveTraceSnapshot();
+    if (step == traceSeekStep)
+    {
+        curPos = nextPos;
+        pause("Step " + std::to_string(step));
+    }
+}
+
+// 快照保存的是这一步执行完之后的状态
+void ProgramManager::saveTraceSnapshot()
+{
+    long long step = traceReader->getStep();
+    for (const auto& snapshot : traceSnapshots)
+    {
+        if (snapshot.step == step)
+            return;
+    }
+
+    TraceSnapshot snapshot = {step, nextPos, *context,
+                              std::vector<size_t>(returnStack, returnStack + returnDepth),
+                              {}, inputQueue->size(), traceReader->getState()};
+    for (size_t pos = 0; pos < program.size(); pos++)
+        program.statementAt(pos)->saveState(snapshot.statementStates);
+    traceSnapshots.push_back(snapshot);
+
+    // 快照越来越稀疏，内存有上限，定位到任意一步最多重新执行当前间隔那么多步
+    while (traceSnapshots.size() > MAX_TRACE_SNAPSHOTS)
+    {
+        traceSnapshotInterval *= 2;
+        long long interval = traceSnapshotInterval;
+        traceSnapshots.erase(std::remove_if(traceSnapshots.begin(), traceSnapshots.end(),
+                                            [interval](const TraceSnapshot& kept)
+                                            { return kept.step % interval != 0; }),
+                             traceSnapshots.end());
+    }
+}
+
+void ProgramManager::restoreTraceSnapshot(const TraceSnapshot& snapshot)
+{
+    *context = snapshot.context;
+    curPos = snapshot.pos;
+    returnDepth = snapshot.returnStack.size();
+    std::copy(snapshot.returnStack.begin(), snapshot.returnStack.end(), returnStack);
+
+    const int* in = snapshot.statementStates.data();
+    for (size_t pos = 0; pos < program.size(); pos++)
+        program.statementAt(pos)->loadState(in);
+
+    const std::vector<int>& inputs = traceReader->getInputs();
+    inputQueue->clear();
+    inputQueue->pushAll(std::vector<int>(inputs.end() - snapshot.inputsLeft, inputs.end()));
+    traceReader->setState(snapshot.readerState);
+    scheduleLimitCheck();
+}
+
+// 定位到第step步执行完之后：能直接向后执行就继续，否则从不晚于目标的最近快照恢复，没有快照时从头开始
+void ProgramManager::seekTrace(long long step)
+{
+    if (!traceReader)
+        return;
+
+    traceSeekStep = step;
+    long long current = traceReader->getStep();
+    bool canContinue = runState == PAUSED && current < step;
+
+    const TraceSnapshot* best = nullptr;
+    for (const auto& snapshot : traceSnapshots)
+    {
+        if (snapshot.step <= step && (!best || snapshot.step > best->step))
+            best = &snapshot;
+    }
+
+    if (best && best->step == step)
+    {
+        restoreTraceSnapshot(*best);
+        pause("Step " + std::to_string(step));
+        return;
+    }
+
+    if (best && (!canContinue || best->step > current))
+    {
+        restoreTraceSnapshot(*best);
+        canContinue = true;
+    }
+
+    if (canContinue)
+    {
+        runState = RUNNING;
+        continueRunning();
+        return;
+    }
+
+    traceReader->rewind();
+    inputQueue->clear();
+    inputQueue->pushAll(traceReader->getInputs());
+    runCode();
+}
+
+// 路径为空时关闭自动检查点，立即生效；开启从下一次运行开始
+void ProgramManager::setCheckpointPath(const std::string& path, long long interval)
+{
+    finishCheckpointWrite();
+    checkpointPath = path;
+    checkpointInterval = path.empty() ? 0 : interval;
+    if (path.empty())
+        nextCheckpoint = 0;
+}
+
+// 手动保存只在暂停或等待输入时进行，这时没有执行到一半的语句
+bool ProgramManager::saveCheckpoint(const std::string& fileName)
+{
+    if (runState != PAUSED && runState != WAITING_FOR_INPUT)
+    {
+        appendOutput("[Checkpoint] Only a paused program or one waiting for input can be saved");
+        return false;
+    }
+
+    Checkpoint checkpoint;
+    captureCheckpoint(checkpoint, getMetrics().statements);
+    if (!Checkpoint::write(fileName, checkpoint.encode()))
+    {
+        appendOutput("[Checkpoint] Cannot write " + fileName);
+        return false;
+    }
+    appendOutput("[Checkpoint] Saved to " + fileName + " after " + std::to_string(checkpoint.statements)
+                 + " statements");
+    return true;
+}
+
+// 按检查点中的源码重建程序，恢复状态后从保存时的位置继续：保存时暂停的，恢复后仍然暂停，等待CONT或STEP；
+// 保存时在等待输入的，恢复后重新等待。
+// 恢复后的运行总是逐条解释，寄存器虚拟机无法从程序中间接手
+bool ProgramManager::resumeCheckpoint(const std::string& fileName)
+{
+    if (isRunning())
+    {
+        appendOutput("[Checkpoint] Stop the running program before resuming");
+        return false;
+    }
+    if (!tracePath.empty() || traceReader)
+    {
+        appendOutput("[Checkpoint] Cannot resume while recording or replaying a trace");
+        return false;
+    }
+
+    Checkpoint checkpoint;
+    if (!checkpoint.load(fileName))
+    {
+        appendOutput("[Checkpoint] Cannot read checkpoint " + fileName);
+        return false;
+    }
+
+    clearCommand();
+    addCommands(QString::fromStdString(checkpoint.source).split('\n', Qt::SkipEmptyParts));
+    showCode();
+
+    std::vector<int> states;
+    for (size_t pos = 0; pos < program.size(); pos++)
+        program.statementAt(pos)->saveState(states);
+    bool matches = states.size() == checkpoint.statementStates.size() && checkpoint.pos <= program.size()
+                   && checkpoint.returnStack.size() <= RETURN_STACK_SIZE;
+    for (size_t returnPos : checkpoint.returnStack)
+        matches = matches && returnPos <= program.size();
+    if (checkpoint.waitingForInput)
+        matches = matches && program.find(checkpoint.inputLineIndex) < program.size();
+    if (!matches)
+    {
+        appendOutput("[Checkpoint] " + fileName + " does not match its program");
+        return false;
+    }
+
+    prepareRun(false);
+    restoreCheckpoint(checkpoint);
+    int lineIndex = curPos < program.size() ? program.lineIndexAt(curPos) : -1;
+    appendOutput("[Checkpoint] Resumed at line " + std::to_string(lineIndex) + " after "
+                 + std::to_string(checkpoint.statements) + " statements and "
+                 + std::to_string(checkpoint.outputBytes) + " bytes of output");
+
+    if (checkpoint.paused)
+    {
+        pause("Resumed from checkpoint");
+        return true;
+    }
+    if (checkpoint.waitingForInput)
+    {
+        try
+        {
+            requestInput(SymbolTable::instance().intern(checkpoint.inputVarName), checkpoint.inputLineIndex);
+        }
+        catch (const char* errMsg)
+        {
+            curPos = program.find(checkpoint.inputLineIndex);
+            runtimeError(errMsg);
+            return true;
+        }
+    }
+    if (runState == RUNNING)
+        continueRunning();
+    return true;
+}
+
+void ProgramManager::captureCheckpoint(Checkpoint& checkpoint, long long statements)
+{
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        checkpoint.source += program.sourceAt(pos);
+        checkpoint.source += "\n";
+    }
+
+    checkpoint.statements = statements;
+    checkpoint.outputBytes = outputBytes;
+    checkpoint.jumps = jumpCnt;
+    checkpoint.runMillis = runMillis + (runTimer.isValid() ? runTimer.elapsed() : 0);
+    checkpoint.writeCnt = context->getWriteCnt();
+    checkpoint.evalCnt = context->getEvalCnt();
+    checkpoint.pos = curPos;
+    checkpoint.returnStack.assign(returnStack, returnStack + returnDepth);
+    // 寄存器虚拟机挂起时，继续位置和返回栈在它自己那里
+    if (vm)
+        vm->getSuspendedState(checkpoint.pos, checkpoint.returnStack);
+
+    checkpoint.paused = runState == PAUSED;
+    checkpoint.waitingForInput = runState == WAITING_FOR_INPUT;
+    if (checkpoint.waitingForInput)
+    {
+        checkpoint.inputLineIndex = lineWaitingForInput;
+        checkpoint.inputVarName = SymbolTable::instance().nameOf(varIdWaitingForInput);
+    }
+
+    // 只保存出现过的变量
+    const std::vector<int>& values = context->getVarValues();
+    const std::vector<char>& defined = context->getVarDefined();
+    const std::vector<std::vector<int>>& arrays = context->getArrayValues();
+    for (int varId = 0; varId < (int)values.size(); varId++)
+    {
+        int useCnt = context->getVarUseCnt(varId);
+        if (!defined[varId] && useCnt == 0 && arrays[varId].empty())
+            continue;
+        checkpoint.variables.push_back( {SymbolTable::instance().nameOf(varId), defined[varId] != 0,
+                                         values[varId], useCnt, arrays[varId]} );
+    }
+
+    for (size_t pos = 0; pos < program.size(); pos++)
+        untrappedStatementAt(pos)->saveState(checkpoint.statementStates);
+}
+
+void ProgramManager::restoreCheckpoint(const Checkpoint& checkpoint)
+{
+    for (const auto& variable : checkpoint.variables)
+        context->loadVar(SymbolTable::instance().intern(variable.name), variable.defined, variable.value,
+                         variable.useCnt, variable.array);
+    context->setCounters(checkpoint.writeCnt, checkpoint.evalCnt);
+
+    const int* in = checkpoint.statementStates.data();
+    for (size_t pos = 0; pos < program.size(); pos++)
+        untrappedStatementAt(pos)->loadState(in);
+
+    curPos = checkpoint.pos;
+    returnDepth = checkpoint.returnStack.size();
+    std::copy(checkpoint.returnStack.begin(), checkpoint.returnStack.end(), returnStack);
+    executedCnt = checkpoint.statements;
+    outputBytes = checkpoint.outputBytes;
+    jumpCnt = checkpoint.jumps;
+    runMillis = checkpoint.runMillis;
+    scheduleLimitCheck();
+    if (checkpointInterval > 0)
+        nextCheckpoint = executedCnt + checkpointInterval;
+}
+
+void ProgramManager::finishCheckpointWrite()
+{
+    if (checkpointWrite.valid() && !checkpointWrite.get())
+        appendOutput("[Checkpoint] Cannot write " + checkpointPath);
+}
+
+// 断点和监视点的替身比原语句多一个计数器，检查点只按原语句保存和恢复
+Statement* ProgramManager::untrappedStatementAt(size_t pos) const
+{
+    Statement* statement = program.statementAt(pos);
+    TrapStmt* trap = dynamic_cast<TrapStmt*>(statement);
+    return trap ? trap->original : statement;
 }
@@ -4,53 +4,347 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <future>
 #include <QString>
+#include <QStringList>
 #include <QObject>
+#include <QElapsedTimer>
 #include "ui_mainwindow.h"
+#include "programstore.h"
+#include "runtimecontext.h"
+#include "tracerecorder.h"
+#include "tracejit.h"
+#include "expressioncache.h"
 
-class RuntimeContext;
 class Statement;
 class Expression;
+class IndexExp;
+class InputQueue;
+class RegisterVM;
+class ExpressionPool;
+class Checkpoint;
+class ProgramAnalysis;
 
 class ProgramManager : public QObject
 {
     Q_OBJECT
 
+public:
+    // 0表示不限制
+    typedef enum
+    {
+        STOPPED = 0,
+        RUNNING,
+        WAITING_FOR_INPUT,
+        PAUSED
+    } RunState;
+
+    typedef enum
+    {
+        UNKNOWN_KEYWORD = 0,
+        REM,
+        LET,
+        PRINT,
+        INPUT,
+        GOTO,
+        IF,
+        END,
+        FOR,
+        NEXT,
+        GOSUB,
+        RETURN,
+        DIM
+    } KeywordType;
+
+    // REFERENCE_ENGINE逐条解释语法树，不做公共子表达式消除和越界检查外提，作为对拍的基准；
+    // REGISTER_VM_ENGINE编译成寄存器指令执行，调试、记录轨迹或检测死循环时退回逐条解释；
+    // NATIVE_ENGINE再把寄存器指令翻译成C++，用本机编译器编译后加载，编译失败时退回寄存器虚拟机
+    typedef enum
+    {
+        OPTIMIZING_ENGINE = 0,
+        REFERENCE_ENGINE,
+        REGISTER_VM_ENGINE,
+        NATIVE_ENGINE
+    } EngineType;
+
+    // 对拍时截获的输出，记下输出时所在的行
+    struct OutputRecord
+    {
+        int lineIndex;
+        std::string text;
+    };
+
+    // IF语句条件成立（跳转）和不成立的次数
+    struct BranchCnt
+    {
+        int lineIndex;
+        int trueCnt;
+        int falseCnt;
+    };
+
+    // NEXT语句回到循环体和结束循环的次数
+    struct LoopCnt
+    {
+        int lineIndex;
+        int loopCnt;
+        int exitCnt;
+    };
+
+    struct ExecutionLimits
+    {
+        long long maxStatements = 0;
+        long long maxMillis = 0;
+        long long maxOutputBytes = 0;
+        bool detectInfiniteLoops = false;
+    };
+
+    // 运行统计，计数器在执行时顺带累加，汇总工作都推迟到读取时
+    struct RuntimeMetrics
+    {
+        long long statements = 0;
+        long long runMillis = 0;
+        long long expressionNodes = 0;
+        long long varReads = 0;
+        long long varWrites = 0;
+        long long jumps = 0;
+        long long outputBytes = 0;
+        long long inputWaitMillis = 0;
+        long long peakMemoryKB = 0;
+
+        long long statementsPerSecond() const;
+        std::string toText() const;
+        std::string toJson() const;
+    };
+
 private:
-    bool _isRunning = false;
-    bool _isWaitingForInput = false;
-    std::string varNameWaitingForInput;
-    std::_Rb_tree_iterator<std::pair<const int, Statement*>> curLineIter;
+    // Brent判圈：在回边处保存变量状态，状态重复即说明循环不会终止。
+    // 循环头的执行次数用来区分每一次从循环外进入，重新进入时判圈从头开始
+    struct LoopDetector
+    {
+        size_t headerPos = 0;
+        long long headerCnt = -1;
+        long long power = 1;
+        long long steps = 0;
+        size_t savedHash = 0;
+        std::vector<int> savedValues;
+        std::vector<char> savedDefined;
+    };
+
+    // 回放轨迹时定期保存的完整运行状态，定位到任意一步时从最近的快照继续执行
+    struct TraceSnapshot
+    {
+        long long step;
+        size_t pos;
+        RuntimeContext context;
+        std::vector<size_t> returnStack;
+        std::vector<int> statementStates;
+        size_t inputsLeft;
+        TraceReader::State readerState;
+    };
+
+    static const int LIMIT_CHECK_INTERVAL = 1024;
+    static const int KEYWORD_TABLE_SIZE = 16;
+    static const int RETURN_STACK_SIZE = 256;
+    static const long long TRACE_SNAPSHOT_INTERVAL = 1 << 16;
+    // 每个快照都复制全部变量和语句状态，超过这个数量就隔一个删一个，间隔加倍
+    static const size_t MAX_TRACE_SNAPSHOTS = 64;
+    // 第一屏之后每次空闲时生成的语句数
+    static const size_t TREE_CHUNK_SIZE = 256;
+    // 每个解析线程至少分到这么多行，程序较短时不值得启动线程
+    static const int PARALLEL_PARSE_MIN_LINES = 512;
+
+    struct ParsedCommand
+    {
+        int lineIndex;
+        Statement* statement;
+    };
+
+    RunState runState = STOPPED;
+    int varIdWaitingForInput = -1;
+    int lineWaitingForInput = -1;
+    size_t inputPromptLine = 0;     // 输入提示符在运行结果窗口中的行号
+    size_t curPos = 0;
+    size_t nextPos = 0;
+    // GOSUB的返回位置，固定大小，运行期间不分配内存
+    size_t returnStack[RETURN_STACK_SIZE];
+    int returnDepth = 0;
 
     Ui::MainWindow* ui;
     RuntimeContext* context;
-    std::map<int, Statement*> statements;
+    InputQueue* inputQueue;
+    ProgramStore program;
+    // 运行中修改出的新版本，APPLY后才切换过去执行
+    ProgramStore pendingProgram;
+    bool hasPendingEdits = false;
     // std::map<int, std::string> errors;
 
+    ExecutionLimits limits;
+    long long executedCnt = 0;
+    long long outputBytes = 0;
+    int limitCheckInterval = LIMIT_CHECK_INTERVAL;
+    int limitCheckCountdown = LIMIT_CHECK_INTERVAL;
+    long long runMillis = 0;
+    QElapsedTimer runTimer;
+    long long jumpCnt = 0;
+    long long inputWaitMillis = 0;
+    QElapsedTimer inputWaitTimer;
+    std::unordered_map<int, LoopDetector> loopDetectors;
+    // 语法树按需分段生成，treeRenderedPos之前的语句已经写入树视图
+    bool treeDirty = false;
+    size_t treeRenderedPos = 0;
+    bool treeChunkScheduled = false;
+
+    // 断点和监视点通过替换对应行的语句实现，不在每条语句上增加检查
+    std::set<int> breakpoints;
+    std::set<int> watchpoints;
+    std::map<int, Statement*> trappedStatements;
+    std::vector<Statement*> retiredTraps;
+    const Statement* skipTrapOnce = nullptr;
+    // 停在断点或单步处时，继续或单步要跳过当前位置的陷阱一次；监视点暂停时当前位置还没有执行过
+    bool skipTrapOnResume = false;
+    // 等待输入时立即执行的LET改了监视的变量，取到输入后暂停
+    int pendingWatchpoint = -1;
+    bool stepRequested = false;
+
+    // 执行轨迹：记录时traceRecorder非空，回放时traceReader非空
+    bool tracing = false;
+    std::string tracePath;
+    TraceRecorder* traceRecorder = nullptr;
+    TraceReader* traceReader = nullptr;
+    long long traceSeekStep = -1;
+    std::vector<TraceSnapshot> traceSnapshots;
+    long long traceSnapshotInterval = TRACE_SNAPSHOT_INTERVAL;
+    bool outputMuted = false;
+    std::vector<OutputRecord>* outputCapture = nullptr;
+    EngineType engine = OPTIMIZING_ENGINE;
+    // 表达式池中的运算节点按操作数的种类特化，--bench关闭它来对比
+    bool specializeNodes = true;
+    RegisterVM* vm = nullptr;
+    // 只在OPTIMIZING_ENGINE且没有调试、轨迹和死循环检测时启用；jitHook表示这一步执行完后要交给它
+    TraceJit* jit = nullptr;
+    bool jitHook = false;
+    // 只在OPTIMIZING_ENGINE下生成，表达式经由它求值；程序改动后由runCode和applyEdits重新生成
+    ExpressionPool* expPool = nullptr;
+    // 立即执行的PRINT/LET用到的表达式
+    ExpressionCache immediateExps;
+    // 自动检查点：每执行checkpointInterval条语句在限制检查时保存一次，文件由后台线程写出
+    std::string checkpointPath;
+    long long checkpointInterval = 0;
+    long long nextCheckpoint = 0;
+    std::future<bool> checkpointWrite;
+
 public:
     ProgramManager(Ui::MainWindow* ui);
     ~ProgramManager();
     void clearCommand();
     bool addCommand(QString& command);
+    int addCommands(const QStringList& commands);
     void showCode();
+    void analyzeCode();
     void runCode();
     void continueRunning();
     void stopRunning();
     bool isRunning();
     bool isWaitingForInput();
-    int getVarValue(const std::string& name) const;
+    bool isPaused();
+    int getVarValue(const int varId) const;
     int getExpressionValue(Expression* expression) const;
-    int getVarUseCnt(const std::string& name) const;
-    void setVarValue(const std::string& name, Expression* expression);
+    void writeExpressionTree(std::string& out, const Expression* expression, int indent) const;
+    int getVarUseCnt(const int varId) const;
+    void setVarValue(const int varId, Expression* expression);
+    void setVarValue(const int varId, const int value);
+    void setArrayValue(IndexExp* target, Expression* expression);
+    void dimArray(const int varId, const int size);
+    int getArraySize(const int varId) const;
     void println(const std::string& str);
     void runtimeError(const std::string& str);
-    void inputVar(const std::string& varName);
-    void gotInput(int value);
+    void inputVar(const int varId);
+    InputQueue* getInputQueue();
     void gotoLine(int targetLineIndex);
+    void gotoLineAfter(int lineIndex);
+    void callSubroutine(int targetLineIndex);
+    void returnFromSubroutine();
     void generateSyntaxTree();
+    void showSyntaxTree();
+    void extendSyntaxTree();
+    void writeSyntaxTree(std::string& out, size_t from, size_t to);
+    void setExecutionLimits(const ExecutionLimits& limits);
+    RuntimeMetrics getMetrics() const;
+    void setEngine(EngineType engine);
+    void setNodeSpecialization(bool enabled);
+    void setOutputCapture(std::vector<OutputRecord>* capture);
+    const RuntimeContext* getContext() const;
+    std::vector<std::pair<int, int>> getExecutionCnts() const;
+    std::vector<BranchCnt> getBranchCnts() const;
+    std::vector<LoopCnt> getLoopCnts() const;
+    int findDefiningLine(const int varId) const;
+
+    bool runDebugCommand(const QString& command);
+    bool runImmediate(const QString& command);
+    void setBreakpoint(int lineIndex, bool enabled);
+    void setWatchpoint(const std::string& varName, bool enabled);
+    void step();
+    void resume();
+    bool applyEdits();
+    bool trapBreakpoint(const Statement* trap);
+    void trapWatchpoint(const int varId);
+    bool peekVarValue(const int varId, int& value) const;
+
+    void setTracePath(const std::string& path);
+    void setTraceReader(TraceReader* reader);
+    void seekTrace(long long step);
+    void setOutputMuted(bool muted);
+
+    void setCheckpointPath(const std::string& path, long long interval);
+    bool saveCheckpoint(const std::string& fileName);
+    bool resumeCheckpoint(const std::string& fileName);
+
+private slots:
+    void onInputAvailable();
 
 private:
-    bool isValidVarName(const std::string varName) const;
+    void appendOutput(const std::string& str);
+    void prepareRun(bool allowVm);
+    void requestInput(const int varId, const int lineIndex);
+    void assignInput(const int varId, int value);
+    bool checkLimits();
+    void scheduleLimitCheck();
+    void checkInfiniteLoop(int latchLineIndex);
+    void pause(const std::string& reason);
+    void showPausedState();
+    void showMetrics();
+    void setUpLoopDetectors(const ProgramAnalysis& analysis);
+    ProgramStore& editableProgram();
+    void adoptPendingEdits();
+    void leaveVm();
+    size_t remapPos(size_t pos, bool afterPrevious) const;
+    void discardSyntaxTree();
+    void renderSyntaxTreeChunk();
+    void scheduleSyntaxTreeChunk();
+    void installTraps();
+    void installTrap(int lineIndex);
+    void removeTraps();
+    void linkLoops();
+    void traceStep();
+    void assignImmediate(Expression* target, int value);
+    void restoreVarUseCnts(const std::vector<int>& useCnts);
+    void runVm();
+    void jitStep();
+    void runTrace(const TraceJit::Trace& trace);
+    void dropJit();
+    void buildExpressionPool();
+    void saveTraceSnapshot();
+    void restoreTraceSnapshot(const TraceSnapshot& snapshot);
+    void captureCheckpoint(Checkpoint& checkpoint, long long statements);
+    void restoreCheckpoint(const Checkpoint& checkpoint);
+    void finishCheckpointWrite();
+    Statement* untrappedStatementAt(size_t pos) const;
+    static Statement* parseCommand(const QString& command, int& lineIndex);
+    static int findKeyword(const std::string& str, const std::string& keyword, int from = 0);
+    static bool isValidVarName(const std::string varName);
+    static KeywordType keywordFromStr(const std::string& keyword);
 };
 
 #endif // PROGRAMMANAGER_H
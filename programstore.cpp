@@ -0,0 +1,164 @@
+#include "programstore.h"
+
+#include "statement.h"
+
+#include <algorithm>
+
+ProgramStore::ProgramStore() : version(std::make_shared<Version>()) {}
+
+ProgramStore::ProgramStore(const ProgramStore& other) : version(other.version) {}
+
+ProgramStore& ProgramStore::operator=(const ProgramStore& other)
+{
+    version = other.version;
+    denseIndex.clear();
+    indexDirty = true;
+    return *this;
+}
+
+ProgramStore::~ProgramStore() {}
+
+size_t ProgramStore::size() const { return version->lines.size(); }
+bool ProgramStore::empty() const { return version->lines.empty(); }
+int ProgramStore::lineIndexAt(size_t pos) const { return version->lines[pos].lineIndex; }
+Statement* ProgramStore::statementAt(size_t pos) const { return version->lines[pos].statement; }
+
+// 只替换语句指针，不释放原语句（调试器的陷阱语句使用）
+void ProgramStore::replaceStatementAt(size_t pos, Statement* statement)
+{
+    detach().lines[pos].statement = statement;
+}
+
+std::string ProgramStore::sourceAt(size_t pos) const
+{
+    const Line& line = version->lines[pos];
+    return version->sourceText.substr(line.textOffset, line.textLength);
+}
+
+// 找不到时返回size()
+size_t ProgramStore::find(int lineIndex) const
+{
+    const std::vector<Line>& lines = version->lines;
+    if (indexDirty)
+        buildIndex();
+
+    if (isDense)
+    {
+        long long offset = (long long)lineIndex - lines.front().lineIndex;
+        if (offset < 0 || offset >= (long long)denseIndex.size() || denseIndex[offset] < 0)
+            return lines.size();
+        return denseIndex[offset];
+    }
+
+    size_t pos = lowerBound(lineIndex);
+    if (pos == lines.size() || lines[pos].lineIndex != lineIndex)
+        return lines.size();
+    return pos;
+}
+
+size_t ProgramStore::lowerBound(int lineIndex) const
+{
+    const std::vector<Line>& lines = version->lines;
+    auto it = std::lower_bound(lines.begin(), lines.end(), lineIndex, [](const Line& line, int lineIndex) {
+        return line.lineIndex < lineIndex;
+    });
+    return it - lines.begin();
+}
+
+// 同一行号已存在时替换，与按源码顺序加载时“后出现者生效”一致
+void ProgramStore::insert(int lineIndex, Statement* statement, const std::string& source)
+{
+    Version& current = detach();
+    std::vector<Line>& lines = current.lines;
+    size_t pos = lines.empty() || lines.back().lineIndex < lineIndex ? lines.size() : lowerBound(lineIndex);
+
+    if (pos < lines.size() && lines[pos].lineIndex == lineIndex)
+    {
+        current.deadTextBytes += lines[pos].textLength;
+        lines[pos].textLength = 0;
+        lines[pos].statement = statement;
+        lines[pos].owner.reset(statement);
+        appendSource(lines[pos], source);
+        return;
+    }
+
+    Line line = {lineIndex, 0, 0, statement, std::shared_ptr<Statement>(statement)};
+    appendSource(line, source);
+    lines.insert(lines.begin() + pos, line);
+    indexDirty = true;
+}
+
+bool ProgramStore::erase(int lineIndex)
+{
+    size_t pos = lowerBound(lineIndex);
+    if (pos == size() || lineIndexAt(pos) != lineIndex)
+        return false;
+
+    Version& current = detach();
+    std::vector<Line>& lines = current.lines;
+    current.deadTextBytes += lines[pos].textLength;
+    lines.erase(lines.begin() + pos);
+    indexDirty = true;
+    return true;
+}
+
+// 其他版本仍在使用的语句不会被释放
+void ProgramStore::clear()
+{
+    version = std::make_shared<Version>();
+    denseIndex.clear();
+    indexDirty = true;
+}
+
+// 写时复制：版本被其他副本共享时先复制一份行表和源码，语句本身仍然共享
+ProgramStore::Version& ProgramStore::detach()
+{
+    if (version.use_count() > 1)
+        version = std::make_shared<Version>(*version);
+    return *version;
+}
+
+void ProgramStore::buildIndex() const
+{
+    const std::vector<Line>& lines = version->lines;
+    indexDirty = false;
+    isDense = false;
+    denseIndex.clear();
+    if (lines.empty())
+        return;
+
+    long long range = (long long)lines.back().lineIndex - lines.front().lineIndex + 1;
+    if (range > (long long)lines.size() * DENSE_FACTOR)
+        return;
+
+    isDense = true;
+    denseIndex.assign(range, -1);
+    for (size_t pos = 0; pos < lines.size(); pos++)
+        denseIndex[lines[pos].lineIndex - lines.front().lineIndex] = pos;
+}
+
+void ProgramStore::appendSource(Line& line, const std::string& source)
+{
+    std::string& sourceText = version->sourceText;
+    if (version->deadTextBytes > sourceText.size() / 2 && version->deadTextBytes > 4096)
+        compactSource();
+
+    line.textOffset = sourceText.size();
+    line.textLength = source.size();
+    sourceText += source;
+}
+
+// 被替换或删除的行在源码缓冲区中留下的空洞过多时整理一次
+void ProgramStore::compactSource()
+{
+    std::string compacted;
+    compacted.reserve(version->sourceText.size() - version->deadTextBytes);
+    for (auto& line : version->lines)
+    {
+        uint32_t offset = compacted.size();
+        compacted.append(version->sourceText, line.textOffset, line.textLength);
+        line.textOffset = offset;
+    }
+    version->sourceText.swap(compacted);
+    version->deadTextBytes = 0;
+}
@@ -0,0 +1,75 @@
+#ifndef PROGRAMSTORE_H
+#define PROGRAMSTORE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory>
+
+class Statement;
+
+/*
+ * 程序的存储：按行号排序的紧凑语句数组 + 连续的源码缓冲区 + 行号索引。
+ * 行号较稠密时用直接映射表O(1)查找，否则在有序数组上二分查找。
+ * 索引在修改后延迟重建，交互式插入一行只需要一次有序插入。
+ * 复制只共享同一个版本，第一次修改时才复制行表和源码；语句由共享它的各个版本共同持有，
+ * 运行中修改程序时正在执行的版本保持不变。
+ */
+class ProgramStore
+{
+public:
+    struct Line
+    {
+        int lineIndex;
+        uint32_t textOffset;
+        uint32_t textLength;
+        // 执行的语句，装有陷阱时是陷阱语句
+        Statement* statement;
+        std::shared_ptr<Statement> owner;
+    };
+
+private:
+    // 行号范围不超过语句数的这个倍数时使用直接映射表
+    static const int DENSE_FACTOR = 4;
+
+    struct Version
+    {
+        std::vector<Line> lines;
+        std::string sourceText;
+        size_t deadTextBytes = 0;
+    };
+
+    std::shared_ptr<Version> version;
+
+    mutable bool indexDirty = true;
+    mutable bool isDense = false;
+    mutable std::vector<int32_t> denseIndex;
+
+public:
+    ProgramStore();
+    ProgramStore(const ProgramStore& other);
+    ProgramStore& operator=(const ProgramStore& other);
+    ~ProgramStore();
+
+    size_t size() const;
+    bool empty() const;
+    int lineIndexAt(size_t pos) const;
+    Statement* statementAt(size_t pos) const;
+    void replaceStatementAt(size_t pos, Statement* statement);
+    std::string sourceAt(size_t pos) const;
+
+    size_t find(int lineIndex) const;
+    size_t lowerBound(int lineIndex) const;
+
+    void insert(int lineIndex, Statement* statement, const std::string& source);
+    bool erase(int lineIndex);
+    void clear();
+
+private:
+    Version& detach();
+    void buildIndex() const;
+    void appendSource(Line& line, const std::string& source);
+    void compactSource();
+};
+
+#endif // PROGRAMSTORE_H
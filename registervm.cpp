@@ -0,0 +1,1096 @@
+#include "registervm.h"
+
+#include "programstore.h"
+#include "programanalysis.h"
+#include "runtimecontext.h"
+#include "statement.h"
+#include "expression.h"
+#include "symboltable.h"
+#include "nativecompiler.h"
+
+#include <algorithm>
+#include <climits>
+#include <set>
+#include <sstream>
+
+// 跳转目标行不存在
+static const int MISSING_TARGET = INT_MAX;
+
+RegisterVM::RegisterVM(const ProgramStore& program, const ProgramAnalysis& analysis, RuntimeContext* context,
+                       const ProgramManager::ExecutionLimits& limits)
+    : program(program), context(context), limits(limits)
+{
+    compile(analysis);
+    scheduleLimitCheck();
+}
+
+RegisterVM::~RegisterVM()
+{
+    delete nativeCompiler;
+}
+
+// 编译失败时仍可以解释执行
+bool RegisterVM::compileNative(std::string& error)
+{
+    std::string source;
+    writeNativeSource(source);
+    nativeCompiler = new NativeCompiler;
+    nativeEntry = reinterpret_cast<NativeEntry>(nativeCompiler->build(source, "minibasic_run", error));
+    if (nativeEntry)
+        return true;
+
+    delete nativeCompiler;
+    nativeCompiler = nullptr;
+    return false;
+}
+
+// 从语句之间的边界继续执行：等待INPUT挂起后，恢复时从下一条语句开始
+RegisterVM::RunResult RegisterVM::run(ProgramManager* pm, size_t& curPos, long long elapsedMillis)
+{
+    millisLeft = limits.maxMillis - elapsedMillis;
+    runTimer.start();
+    loadVars();
+    if (nativeEntry)
+        return runNative(pm, curPos);
+
+    const Instruction* instructions = code.data();
+    int* r = regs.data();
+    int* states = statementStates.data();
+
+    try
+    {
+        while (true)
+        {
+            const Instruction& in = instructions[pc];
+            switch (in.op)
+            {
+                case STMT:
+                    curPos = in.a;
+                    if (--limitCheckCountdown == 0)
+                        checkLimits();
+                    states[in.b]++;
+                    pc++;
+                    break;
+
+                case MOVE: r[in.dst] = r[in.a]; pc++; break;
+                case ADD: r[in.dst] = r[in.a] + r[in.b]; pc++; break;
+                case SUB: r[in.dst] = r[in.a] - r[in.b]; pc++; break;
+                case MUL: r[in.dst] = r[in.a] * r[in.b]; pc++; break;
+                case DIV: r[in.dst] = CompoundExp::basicDivide(r[in.a], r[in.b]); pc++; break;
+                case MOD: r[in.dst] = CompoundExp::basicMod(r[in.a], r[in.b]); pc++; break;
+                case POW: r[in.dst] = CompoundExp::basicPower(r[in.a], r[in.b]); pc++; break;
+
+                case CHECK_DEFINED:
+                    if (!defined[in.a])
+                    {
+                        messages.push_back("Variable '" + SymbolTable::instance().nameOf(in.a) + "' not found");
+                        throw messages.back().c_str();
+                    }
+                    pc++;
+                    break;
+
+                case DEFINE:
+                    defined[in.a] = 1;
+                    pc++;
+                    break;
+
+                case LOAD_ELEM:
+                    r[in.dst] = context->getArrayValue(in.a, r[in.b]);
+                    pc++;
+                    break;
+
+                case STORE_ELEM:
+                    context->setArrayValue(in.a, r[in.b], r[in.aux]);
+                    pc++;
+                    break;
+
+                case PRINT:
+                    pm->println(std::to_string(r[in.a]));
+                    pc++;
+                    break;
+
+                case JUMP:
+                    jumpCnt++;
+                    pc = in.dst;
+                    break;
+
+                case JUMP_IF_EQUAL:
+                case JUMP_IF_LESS:
+                case JUMP_IF_GREATER:
+                {
+                    bool satisfied = in.op == JUMP_IF_EQUAL ? r[in.a] == r[in.b]
+                                     : in.op == JUMP_IF_LESS ? r[in.a] < r[in.b] : r[in.a] > r[in.b];
+                    if (satisfied)
+                    {
+                        states[in.aux]++;
+                        jumpCnt++;
+                        pc = in.dst;
+                    }
+                    else
+                    {
+                        states[in.aux + 1]++;
+                        pc++;
+                    }
+                    break;
+                }
+
+                // aux处依次是终值和步长
+                case FOR_ENTER:
+                {
+                    int stepValue = r[in.aux + 1];
+                    if (stepValue == 0)
+                        throw "FOR statement with a zero STEP";
+                    int startValue = r[in.b];
+                    r[in.a] = startValue;
+                    defined[in.a] = 1;
+                    if (stepValue > 0 ? startValue > r[in.aux] : startValue < r[in.aux])
+                    {
+                        jumpCnt++;
+                        pc = in.dst;
+                    }
+                    else
+                    {
+                        pc++;
+                    }
+                    break;
+                }
+
+                case NEXT:
+                {
+                    // 与NextStmt::advance相同，超出int范围时变量不变并结束循环
+                    int stepValue = r[in.b + 1];
+                    long long value = (long long)r[in.a] + stepValue;
+                    if (value >= INT_MIN && value <= INT_MAX)
+                        r[in.a] = (int)value;
+                    if (stepValue > 0 ? value <= r[in.b] : value >= r[in.b])
+                    {
+                        states[in.aux]++;
+                        jumpCnt++;
+                        pc = in.dst;
+                    }
+                    else
+                    {
+                        states[in.aux + 1]++;
+                        pc++;
+                    }
+                    break;
+                }
+
+                case GOSUB:
+                    if (returnDepth == RETURN_STACK_SIZE)
+                        throw "GOSUB nested too deeply";
+                    returnStack[returnDepth++] = in.a;
+                    jumpCnt++;
+                    pc = in.dst;
+                    break;
+
+                case RETURN:
+                    if (returnDepth == 0)
+                        throw "RETURN without GOSUB";
+                    pc = returnStack[--returnDepth];
+                    jumpCnt++;
+                    break;
+
+                // 原语句直接读写RuntimeContext，执行前后同步变量
+                case EXEC:
+                    storeVars();
+                    program.statementAt(in.a)->execute(pm);
+                    pc++;
+                    if (pm->isWaitingForInput())
+                    {
+                        storeStates();
+                        return SUSPENDED;
+                    }
+                    loadVars();
+                    break;
+
+                case ERROR:
+                    throw messages[in.a].c_str();
+
+                case FINISH:
+                    storeVars();
+                    storeStates();
+                    return FINISHED;
+            }
+        }
+    }
+    catch (const char* errMsg)
+    {
+        storeVars();
+        applyVarUses(pc);
+        storeStates();
+        throw;
+    }
+}
+
+long long RegisterVM::getExecutedCnt() const
+{
+    return executedCnt + limitCheckInterval - limitCheckCountdown;
+}
+
+long long RegisterVM::getJumpCnt() const
+{
+    return jumpCnt;
+}
+
+// 等待INPUT挂起时的继续位置和GOSUB返回位置都是语句开头的pc，换算回语句下标交给逐条解释
+void RegisterVM::getSuspendedState(size_t& resumePos, std::vector<size_t>& returnPositions) const
+{
+    auto toPos = [this](int statementPc) {
+        auto it = std::lower_bound(statementPcs.begin(), statementPcs.end(), statementPc);
+        return it == statementPcs.end() || *it != statementPc ? program.size() : size_t(it - statementPcs.begin());
+    };
+    resumePos = toPos(pc);
+    returnPositions.clear();
+    for (int i = 0; i < returnDepth; i++)
+        returnPositions.push_back(toPos(returnStack[i]));
+}
+
+void RegisterVM::compile(const ProgramAnalysis& analysis)
+{
+    this->analysis = &analysis;
+    varCnt = context->getVarValues().size();
+
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        stateOffsets.push_back(statementStates.size());
+        program.statementAt(pos)->saveState(statementStates);
+    }
+
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        statementPcs.push_back(code.size());
+        useOffsets.push_back(varUses.size());
+        appliedCnts.push_back(statementStates[stateOffsets[pos]]);
+        size_t begin = code.size();
+        compileStatement(pos);
+        allocateTemps(begin, code.size());
+    }
+    useOffsets.push_back(varUses.size());
+
+    finishPc = code.size();
+    appendInstruction(FINISH, 0);
+    missingTargetPc = code.size();
+    appendInstruction(ERROR, 0, addMessage("GOTO statement with a non-existed line index"));
+
+    relocate();
+    this->analysis = nullptr;
+
+    regs.assign(varCnt, 0);
+    regs.insert(regs.end(), initValues.begin(), initValues.end());
+    regs.resize(regs.size() + tempCnt, 0);
+    defined.assign(varCnt, 0);
+}
+
+// 语义与各语句的doExecute一致，包括求值顺序和报错的时机
+void RegisterVM::compileStatement(size_t pos)
+{
+    Statement* stmt = program.statementAt(pos);
+    curLineIndex = program.lineIndexAt(pos);
+    virtualTempCnt = 0;
+    checkedVars.clear();
+    int stateOffset = stateOffsets[pos];
+    appendInstruction(STMT, 0, pos, stateOffset);
+
+    if (dynamic_cast<RemStmt*>(stmt))
+        return;
+
+    if (LetStmt* letStmt = dynamic_cast<LetStmt*>(stmt))
+    {
+        if (letStmt->target)
+        {
+            int value = compileExpression(letStmt->expression);
+            int index = compileExpression(letStmt->target->indexExp);
+            appendInstruction(STORE_ELEM, 0, letStmt->target->varId, index, value);
+            return;
+        }
+        compileExpressionInto(letStmt->expression, letStmt->varId);
+        if (!analysis->isDefinedBefore(curLineIndex, letStmt->varId))
+            appendInstruction(DEFINE, 0, letStmt->varId);
+        return;
+    }
+
+    if (PrintStmt* printStmt = dynamic_cast<PrintStmt*>(stmt))
+    {
+        appendInstruction(PRINT, 0, compileExpression(printStmt->expression));
+        return;
+    }
+
+    if (GotoStmt* gotoStmt = dynamic_cast<GotoStmt*>(stmt))
+    {
+        appendInstruction(JUMP, targetPos(gotoStmt->targetLineIndex));
+        return;
+    }
+
+    // IfStmt的计数器在执行次数之后依次是trueCnt和falseCnt
+    if (IfStmt* ifStmt = dynamic_cast<IfStmt*>(stmt))
+    {
+        int left = compileExpression(ifStmt->leftExp);
+        int right = compileExpression(ifStmt->rightExp);
+        OpCode op = ifStmt->comp == IfStmt::EQUAL ? JUMP_IF_EQUAL
+                    : ifStmt->comp == IfStmt::LESS_THAN ? JUMP_IF_LESS : JUMP_IF_GREATER;
+        appendInstruction(op, targetPos(ifStmt->targetLineIndex), left, right, stateOffset + 1);
+        return;
+    }
+
+    if (dynamic_cast<EndStmt*>(stmt))
+    {
+        appendInstruction(FINISH, 0);
+        return;
+    }
+
+    if (ForStmt* forStmt = dynamic_cast<ForStmt*>(stmt))
+    {
+        if (forStmt->nextLineIndex == -1)
+        {
+            appendInstruction(ERROR, 0, addMessage("FOR statement with no matching NEXT"));
+            return;
+        }
+        int loopReg = loopRegOf(forStmt);
+        int start = compileExpression(forStmt->startExp);
+        compileExpressionInto(forStmt->endExp, loopReg);
+        if (forStmt->stepExp)
+            compileExpressionInto(forStmt->stepExp, loopReg + 1);
+        else
+            appendInstruction(MOVE, loopReg + 1, constReg(1));
+        size_t nextPos = program.find(forStmt->nextLineIndex);
+        appendInstruction(FOR_ENTER, nextPos == program.size() ? MISSING_TARGET : (int)nextPos + 1, forStmt->varId, start, loopReg);
+        return;
+    }
+
+    // NextStmt的计数器在执行次数之后依次是loopCnt和exitCnt
+    if (NextStmt* nextStmt = dynamic_cast<NextStmt*>(stmt))
+    {
+        if (!nextStmt->loop)
+        {
+            appendInstruction(ERROR, 0, addMessage("NEXT statement with no matching FOR"));
+            return;
+        }
+        int varId = nextStmt->loop->varId;
+        varUses.push_back( {varId, (int)code.size()} );
+        if (!analysis->isDefinedBefore(curLineIndex, varId))
+            appendInstruction(CHECK_DEFINED, 0, varId);
+        appendInstruction(NEXT, targetPos(nextStmt->bodyLineIndex), varId, loopRegOf(nextStmt->loop), stateOffset + 1);
+        return;
+    }
+
+    if (GosubStmt* gosubStmt = dynamic_cast<GosubStmt*>(stmt))
+    {
+        appendInstruction(GOSUB, targetPos(gosubStmt->targetLineIndex), pos + 1);
+        return;
+    }
+
+    if (dynamic_cast<ReturnStmt*>(stmt))
+    {
+        appendInstruction(RETURN, 0);
+        return;
+    }
+
+    // INPUT、DIM以及调试器的陷阱语句
+    appendInstruction(EXEC, 0, pos);
+}
+
+// 叶子节点直接返回变量或常量寄存器，只有运算结果占用临时寄存器
+int RegisterVM::compileExpression(const Expression* exp)
+{
+    if (const ConstantExp* constantExp = dynamic_cast<const ConstantExp*>(exp))
+        return constReg(constantExp->value);
+
+    if (const IdentifierExp* identifierExp = dynamic_cast<const IdentifierExp*>(exp))
+    {
+        int varId = identifierExp->varId;
+        varUses.push_back( {varId, (int)code.size()} );
+        // 在树遍历求值读到这个变量的位置检查，报错的先后与树遍历一致
+        if (std::find(checkedVars.begin(), checkedVars.end(), varId) == checkedVars.end()
+            && !analysis->isDefinedBefore(curLineIndex, varId))
+        {
+            appendInstruction(CHECK_DEFINED, 0, varId);
+            checkedVars.push_back(varId);
+        }
+        return varId;
+    }
+
+    int dst = newTemp();
+    compileExpressionInto(exp, dst);
+    return dst;
+}
+
+void RegisterVM::compileExpressionInto(const Expression* exp, int dst)
+{
+    if (const CompoundExp* compoundExp = dynamic_cast<const CompoundExp*>(exp))
+    {
+        int left = compileExpression(compoundExp->leftExp);
+        int right = compileExpression(compoundExp->rightExp);
+        OpCode op = ADD;
+        switch (compoundExp->operation)
+        {
+            case Expression::ADD: op = ADD; break;
+            case Expression::SUB: op = SUB; break;
+            case Expression::MUL: op = MUL; break;
+            case Expression::DIV: op = DIV; break;
+            case Expression::MOD: op = MOD; break;
+            case Expression::POW: op = POW; break;
+        }
+        appendInstruction(op, dst, left, right);
+        return;
+    }
+
+    // 数组元素的使用次数由RuntimeContext在读取时计入
+    if (const IndexExp* indexExp = dynamic_cast<const IndexExp*>(exp))
+    {
+        appendInstruction(LOAD_ELEM, dst, indexExp->varId, compileExpression(indexExp->indexExp));
+        return;
+    }
+
+    appendInstruction(MOVE, dst, compileExpression(exp));
+}
+
+void RegisterVM::appendInstruction(OpCode op, int dst, int a, int b, int aux)
+{
+    code.push_back( {op, dst, a, b, aux} );
+}
+
+int RegisterVM::newTemp()
+{
+    return -(++virtualTempCnt);
+}
+
+int RegisterVM::constReg(int value)
+{
+    auto it = constRegs.find(value);
+    if (it != constRegs.end())
+        return it->second;
+
+    int reg = varCnt + initValues.size();
+    initValues.push_back(value);
+    constRegs[value] = reg;
+    return reg;
+}
+
+// 终值和步长的初值取自ForStmt，未经FOR进入循环时NEXT看到的值与树遍历相同
+int RegisterVM::loopRegOf(const ForStmt* loop)
+{
+    auto it = loopRegs.find(loop);
+    if (it != loopRegs.end())
+        return it->second;
+
+    int reg = varCnt + initValues.size();
+    initValues.push_back(loop->endValue);
+    initValues.push_back(loop->stepValue);
+    loopRegs[loop] = reg;
+    return reg;
+}
+
+int RegisterVM::targetPos(int lineIndex) const
+{
+    size_t pos = program.find(lineIndex);
+    return pos == program.size() ? MISSING_TARGET : (int)pos;
+}
+
+int RegisterVM::addMessage(const std::string& message)
+{
+    messages.push_back(message);
+    return messages.size() - 1;
+}
+
+// 线性扫描：表达式树中每个临时值只被读一次，读完即可把寄存器交给同一条指令的结果
+void RegisterVM::allocateTemps(size_t begin, size_t end)
+{
+    std::vector<size_t> lastUse(virtualTempCnt + 1, begin);
+    for (size_t i = begin; i < end; i++)
+    {
+        for (int operand : {code[i].a, code[i].b, code[i].aux})
+        {
+            if (operand < 0)
+                lastUse[-operand] = i;
+        }
+    }
+
+    std::vector<int> physical(virtualTempCnt + 1, 0);
+    std::set<int> freeRegs;
+    int usedCnt = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        Instruction& in = code[i];
+        for (int* operand : {&in.a, &in.b, &in.aux})
+        {
+            if (*operand >= 0)
+                continue;
+            int temp = -*operand;
+            *operand = -(physical[temp] + 1);
+            if (lastUse[temp] == i)
+                freeRegs.insert(physical[temp]);
+        }
+
+        if (in.dst < 0)
+        {
+            int temp = -in.dst;
+            if (freeRegs.empty())
+            {
+                physical[temp] = usedCnt++;
+            }
+            else
+            {
+                physical[temp] = *freeRegs.begin();
+                freeRegs.erase(freeRegs.begin());
+            }
+            in.dst = -(physical[temp] + 1);
+        }
+    }
+    tempCnt = std::max(tempCnt, usedCnt);
+}
+
+// 临时寄存器排在常量和FOR寄存器之后；跳转目标从语句下标换成该语句第一条指令的地址
+void RegisterVM::relocate()
+{
+    int tempBase = varCnt + initValues.size();
+    auto toPc = [this](int pos) {
+        if (pos == MISSING_TARGET)
+            return missingTargetPc;
+        if (pos == (int)program.size())
+            return finishPc;
+        return statementPcs[pos];
+    };
+
+    for (auto& in : code)
+    {
+        switch (in.op)
+        {
+            case JUMP:
+            case JUMP_IF_EQUAL:
+            case JUMP_IF_LESS:
+            case JUMP_IF_GREATER:
+            case FOR_ENTER:
+            case NEXT:
+                in.dst = toPc(in.dst);
+                break;
+            case GOSUB:
+                in.dst = toPc(in.dst);
+                in.a = toPc(in.a);
+                break;
+            default:
+                break;
+        }
+
+        for (int* operand : {&in.dst, &in.a, &in.b, &in.aux})
+        {
+            if (*operand < 0)
+                *operand = tempBase - *operand - 1;
+        }
+    }
+}
+
+void RegisterVM::loadVars()
+{
+    const std::vector<int>& values = context->getVarValues();
+    const std::vector<char>& varDefined = context->getVarDefined();
+    std::copy(values.begin(), values.begin() + varCnt, regs.begin());
+    std::copy(varDefined.begin(), varDefined.begin() + varCnt, defined.begin());
+}
+
+void RegisterVM::storeVars()
+{
+    context->setVarValues(regs.data(), defined.data(), varCnt);
+}
+
+// ForStmt的状态在执行次数之后是终值和步长
+void RegisterVM::storeStates()
+{
+    applyVarUses(-1);
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        ForStmt* forStmt = dynamic_cast<ForStmt*>(program.statementAt(pos));
+        auto it = forStmt ? loopRegs.find(forStmt) : loopRegs.end();
+        if (it != loopRegs.end())
+        {
+            statementStates[stateOffsets[pos] + 1] = regs[it->second];
+            statementStates[stateOffsets[pos] + 2] = regs[it->second + 1];
+        }
+
+        const int* in = statementStates.data() + stateOffsets[pos];
+        program.statementAt(pos)->loadState(in);
+    }
+}
+
+// 语句开头的限制检查出错时这条语句还没有计数，也没有读取任何变量
+void RegisterVM::applyVarUses(int failedPc)
+{
+    int failedPos = -1;
+    if (failedPc >= 0 && failedPc < finishPc && code[failedPc].op != STMT)
+        failedPos = std::upper_bound(statementPcs.begin(), statementPcs.end(), failedPc) - statementPcs.begin() - 1;
+
+    for (size_t pos = 0; pos < program.size(); pos++)
+    {
+        int cnt = statementStates[stateOffsets[pos]];
+        int delta = cnt - appliedCnts[pos];
+        appliedCnts[pos] = cnt;
+        if ((int)pos == failedPos)
+            delta--;
+        for (size_t i = useOffsets[pos]; i < useOffsets[pos + 1]; i++)
+        {
+            int useCnt = delta + ((int)pos == failedPos && varUses[i].pc <= failedPc);
+            if (useCnt != 0)
+                context->addVarUseCnt(varUses[i].varId, useCnt);
+        }
+    }
+}
+
+void RegisterVM::checkLimits()
+{
+    executedCnt += limitCheckInterval;
+    if (limits.maxStatements > 0 && executedCnt > limits.maxStatements)
+        throw "Statement limit exceeded";
+    if (limits.maxMillis > 0 && runTimer.elapsed() > millisLeft)
+        throw "Time limit exceeded";
+    scheduleLimitCheck();
+}
+
+void RegisterVM::scheduleLimitCheck()
+{
+    limitCheckInterval = LIMIT_CHECK_INTERVAL;
+    if (limits.maxStatements > 0 && limits.maxStatements - executedCnt + 1 < limitCheckInterval)
+        limitCheckInterval = limits.maxStatements - executedCnt + 1;
+    limitCheckCountdown = limitCheckInterval;
+}
+
+static const char* NATIVE_PROLOGUE =
+    "#include <climits>\n"
+    "#include <cstddef>\n"
+    "\n"
+    "#ifdef _WIN32\n"
+    "#define MINIBASIC_EXPORT extern \"C\" __declspec(dllexport)\n"
+    "#else\n"
+    "#define MINIBASIC_EXPORT extern \"C\" __attribute__((visibility(\"default\")))\n"
+    "#endif\n"
+    "\n"
+    "// 出错时记下出错的指令地址，虚拟机据此补上这条语句已经发生的变量读取\n"
+    "#define FAIL(p) { pc = p; goto fail; }\n"
+    "\n"
+    "struct NativeFrame\n"
+    "{\n"
+    "    int* regs;\n"
+    "    char* defined;\n"
+    "    int* states;\n"
+    "    int* returnStack;\n"
+    "    int returnDepth;\n"
+    "    int pc;\n"
+    "    std::size_t* curPos;\n"
+    "    int limitCheckCountdown;\n"
+    "    long long jumpCnt;\n"
+    "    const char* error;\n"
+    "    void* vm;\n"
+    "    void* pm;\n"
+    "    int (*divide)(NativeFrame* frame, int a, int b);\n"
+    "    int (*mod)(NativeFrame* frame, int a, int b);\n"
+    "    int (*power)(NativeFrame* frame, int a, int b);\n"
+    "    int (*loadElem)(NativeFrame* frame, int varId, int index);\n"
+    "    void (*storeElem)(NativeFrame* frame, int varId, int index, int value);\n"
+    "    void (*print)(NativeFrame* frame, int value);\n"
+    "    int (*exec)(NativeFrame* frame, int pos);\n"
+    "    void (*checkLimits)(NativeFrame* frame);\n"
+    "};\n"
+    "\n";
+
+static std::string quoted(const std::string& str)
+{
+    std::string res = "\"";
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            res += '\\';
+        res += c;
+    }
+    return res + "\"";
+}
+
+// 逐条翻译编译好的指令：变量、FOR寄存器和临时寄存器是局部变量，常量直接写成字面量。
+// 标号只加在语句开头和结束、出错的公共入口上，RETURN和恢复执行经由dispatch处的switch跳转。
+void RegisterVM::writeNativeSource(std::string& out) const
+{
+    std::set<int> labels(statementPcs.begin(), statementPcs.end());
+    labels.insert(finishPc);
+    labels.insert(missingTargetPc);
+    std::map<int, size_t> pcToPos;
+    for (size_t pos = 0; pos < statementPcs.size(); pos++)
+        pcToPos[statementPcs[pos]] = pos;
+
+    std::ostringstream src;
+    size_t i = 0;
+    auto fail = [&i](const std::string& message) {
+        return "{ f->error = " + quoted(message) + "; FAIL(" + std::to_string(i) + "); }";
+    };
+    auto check = [&i]() {
+        return " if (f->error) FAIL(" + std::to_string(i) + ");";
+    };
+
+    src << NATIVE_PROLOGUE;
+    src << "MINIBASIC_EXPORT int minibasic_run(NativeFrame* f)\n{\n";
+    src << "    int* st = f->states;\n";
+    src << "    std::size_t* curPos = f->curPos;\n";
+    src << "    long long jumps = f->jumpCnt;\n";
+    src << "    int countdown = f->limitCheckCountdown;\n";
+    src << "    int pc = f->pc;\n";
+    src << "    int res = 0;\n";
+    src << "    int value = 0;\n";
+    src << "    long long next = 0;\n";
+    std::string load;
+    writeNativeVars(load, false, true);
+    src << load;
+    for (int i = 0; i < tempCnt; i++)
+        src << "    int t" << i << " = 0;\n";
+    src << "    goto dispatch;\n";
+
+    for (i = 0; i < code.size(); i++)
+    {
+        const Instruction& in = code[i];
+        if (labels.count(i))
+            src << "L" << i << ":\n";
+        // 行尾的反斜杠会把下一行代码也变成注释
+        if (pcToPos.count(i))
+        {
+            std::string source = program.sourceAt(pcToPos[i]);
+            std::replace(source.begin(), source.end(), '\\', '/');
+            src << "    // " << source << "\n";
+        }
+
+        std::string dst = nativeOperand(in.dst);
+        std::string a = nativeOperand(in.a);
+        std::string b = nativeOperand(in.b);
+        switch (in.op)
+        {
+            case STMT:
+                src << "    *curPos = " << in.a << ";\n";
+                src << "    if (--countdown == 0) { f->limitCheckCountdown = 0; f->checkLimits(f);" << check()
+                    << " countdown = f->limitCheckCountdown; }\n";
+                src << "    st[" << in.b << "]++;\n";
+                break;
+
+            case MOVE: src << "    " << dst << " = " << a << ";\n"; break;
+            case ADD: src << "    " << dst << " = " << a << " + " << b << ";\n"; break;
+            case SUB: src << "    " << dst << " = " << a << " - " << b << ";\n"; break;
+            case MUL: src << "    " << dst << " = " << a << " * " << b << ";\n"; break;
+
+            // 出错时目标变量保持原值，结果先放在value中
+            case DIV:
+            case MOD:
+            case POW:
+            {
+                const char* func = in.op == DIV ? "divide" : in.op == MOD ? "mod" : "power";
+                src << "    value = f->" << func << "(f, " << a << ", " << b << ");" << check() << " "
+                    << dst << " = value;\n";
+                break;
+            }
+
+            case CHECK_DEFINED:
+                src << "    if (!d" << in.a << ") "
+                    << fail("Variable '" + SymbolTable::instance().nameOf(in.a) + "' not found") << "\n";
+                break;
+
+            case DEFINE:
+                src << "    d" << in.a << " = 1;\n";
+                break;
+
+            case LOAD_ELEM:
+                src << "    value = f->loadElem(f, " << in.a << ", " << b << ");" << check() << " "
+                    << dst << " = value;\n";
+                break;
+
+            case STORE_ELEM:
+                src << "    f->storeElem(f, " << in.a << ", " << b << ", " << nativeOperand(in.aux) << ");" << check() << "\n";
+                break;
+
+            case PRINT:
+                src << "    f->print(f, " << a << ");" << check() << "\n";
+                break;
+
+            case JUMP:
+                src << "    jumps++; goto L" << in.dst << ";\n";
+                break;
+
+            case JUMP_IF_EQUAL:
+            case JUMP_IF_LESS:
+            case JUMP_IF_GREATER:
+            {
+                const char* comp = in.op == JUMP_IF_EQUAL ? " == " : in.op == JUMP_IF_LESS ? " < " : " > ";
+                src << "    if (" << a << comp << b << ") { st[" << in.aux << "]++; jumps++; goto L" << in.dst << "; }\n";
+                src << "    st[" << in.aux + 1 << "]++;\n";
+                break;
+            }
+
+            case FOR_ENTER:
+            {
+                std::string end = nativeOperand(in.aux);
+                std::string step = nativeOperand(in.aux + 1);
+                src << "    if (" << step << " == 0) " << fail("FOR statement with a zero STEP") << "\n";
+                src << "    " << a << " = " << b << "; d" << in.a << " = 1;\n";
+                src << "    if (" << step << " > 0 ? " << a << " > " << end << " : " << a << " < " << end << ") "
+                    << "{ jumps++; goto L" << in.dst << "; }\n";
+                break;
+            }
+
+            case NEXT:
+            {
+                std::string end = nativeOperand(in.b);
+                std::string step = nativeOperand(in.b + 1);
+                src << "    next = (long long)" << a << " + " << step << ";\n";
+                src << "    if (next >= INT_MIN && next <= INT_MAX) " << a << " = (int)next;\n";
+                src << "    if (" << step << " > 0 ? next <= " << end << " : next >= " << end << ") "
+                    << "{ st[" << in.aux << "]++; jumps++; goto L" << in.dst << "; }\n";
+                src << "    st[" << in.aux + 1 << "]++;\n";
+                break;
+            }
+
+            case GOSUB:
+                src << "    if (f->returnDepth == " << RETURN_STACK_SIZE << ") " << fail("GOSUB nested too deeply") << "\n";
+                src << "    f->returnStack[f->returnDepth++] = " << in.a << "; jumps++; goto L" << in.dst << ";\n";
+                break;
+
+            case RETURN:
+                src << "    if (f->returnDepth == 0) " << fail("RETURN without GOSUB") << "\n";
+                src << "    pc = f->returnStack[--f->returnDepth]; jumps++; goto dispatch;\n";
+                break;
+
+            // 原语句直接读写RuntimeContext，调用前后同步局部变量
+            case EXEC:
+            {
+                std::string store;
+                writeNativeVars(store, true, false);
+                src << store;
+                src << "    if (f->exec(f, " << in.a << ")) { pc = " << i + 1 << "; res = 1; goto leave; }\n";
+                src << "   " << check() << "\n";
+                std::string load;
+                writeNativeVars(load, false, false);
+                src << load;
+                break;
+            }
+
+            case ERROR:
+                src << "    " << fail(messages[in.a]) << "\n";
+                break;
+
+            case FINISH:
+                src << "    goto leave;\n";
+                break;
+        }
+    }
+
+    src << "dispatch:\n";
+    src << "    switch (pc)\n    {\n";
+    for (int label : labels)
+        src << "        case " << label << ": goto L" << label << ";\n";
+    src << "    }\n";
+    src << "fail:\n";
+    src << "    res = 2;\n";
+    src << "leave:\n";
+    std::string store;
+    writeNativeVars(store, true, false);
+    src << store;
+    src << "    f->jumpCnt = jumps;\n";
+    src << "    f->limitCheckCountdown = countdown;\n";
+    src << "    f->pc = pc;\n";
+    src << "    return res;\n";
+    src << "}\n";
+    out = src.str();
+}
+
+// 常量寄存器不会被写入，直接换成字面量
+std::string RegisterVM::nativeOperand(int reg) const
+{
+    int tempBase = varCnt + initValues.size();
+    if (reg >= tempBase)
+        return "t" + std::to_string(reg - tempBase);
+    if (reg >= varCnt)
+    {
+        int value = initValues[reg - varCnt];
+        auto it = constRegs.find(value);
+        if (it != constRegs.end() && it->second == reg)
+            return value == INT_MIN ? "(-2147483647 - 1)" : "(" + std::to_string(value) + ")";
+    }
+    return "v" + std::to_string(reg);
+}
+
+// 变量带有定义标记，FOR的终值和步长只有值
+void RegisterVM::writeNativeVars(std::string& out, bool store, bool declare) const
+{
+    int tempBase = varCnt + initValues.size();
+    for (int reg = 0; reg < tempBase; reg++)
+    {
+        std::string name = nativeOperand(reg);
+        if (name[0] != 'v')
+            continue;
+        std::string index = std::to_string(reg);
+        if (store)
+            out += "    f->regs[" + index + "] = " + name + ";\n";
+        else
+            out += std::string("    ") + (declare ? "int " : "") + name + " = f->regs[" + index + "];\n";
+        if (reg >= varCnt)
+            continue;
+        if (store)
+            out += "    f->defined[" + index + "] = d" + index + ";\n";
+        else
+            out += std::string("    ") + (declare ? "char " : "") + "d" + index + " = f->defined[" + index + "];\n";
+    }
+}
+
+// 状态都在虚拟机里，原生代码只在运行期间借用；恢复执行时从上次停下的指令地址进入
+RegisterVM::RunResult RegisterVM::runNative(ProgramManager* pm, size_t& curPos)
+{
+    NativeFrame frame;
+    frame.regs = regs.data();
+    frame.defined = defined.data();
+    frame.states = statementStates.data();
+    frame.returnStack = returnStack;
+    frame.returnDepth = returnDepth;
+    frame.pc = pc;
+    frame.curPos = &curPos;
+    frame.limitCheckCountdown = limitCheckCountdown;
+    frame.jumpCnt = jumpCnt;
+    frame.error = nullptr;
+    frame.vm = this;
+    frame.pm = pm;
+    frame.divide = nativeDivide;
+    frame.mod = nativeMod;
+    frame.power = nativePower;
+    frame.loadElem = nativeLoadElem;
+    frame.storeElem = nativeStoreElem;
+    frame.print = nativePrint;
+    frame.exec = nativeExec;
+    frame.checkLimits = nativeCheckLimits;
+
+    int res = nativeEntry(&frame);
+
+    returnDepth = frame.returnDepth;
+    pc = frame.pc;
+    limitCheckCountdown = frame.limitCheckCountdown;
+    jumpCnt = frame.jumpCnt;
+    if (res == NATIVE_SUSPENDED)
+    {
+        storeStates();
+        return SUSPENDED;
+    }
+
+    storeVars();
+    if (res == NATIVE_FAILED)
+        applyVarUses(pc);
+    storeStates();
+    if (res == NATIVE_FAILED)
+        throw frame.error;
+    return FINISHED;
+}
+
+// 出错信息可能指向RuntimeContext中会被覆盖的缓冲区，先复制一份
+void RegisterVM::failNative(NativeFrame* frame, const char* errMsg)
+{
+    frame->vm->nativeError = errMsg;
+    frame->error = frame->vm->nativeError.c_str();
+}
+
+int RegisterVM::nativeDivide(NativeFrame* frame, int a, int b)
+{
+    try
+    {
+        return CompoundExp::basicDivide(a, b);
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+        return 0;
+    }
+}
+
+int RegisterVM::nativeMod(NativeFrame* frame, int a, int b)
+{
+    try
+    {
+        return CompoundExp::basicMod(a, b);
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+        return 0;
+    }
+}
+
+int RegisterVM::nativePower(NativeFrame* frame, int a, int b)
+{
+    try
+    {
+        return CompoundExp::basicPower(a, b);
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+        return 0;
+    }
+}
+
+int RegisterVM::nativeLoadElem(NativeFrame* frame, int varId, int index)
+{
+    try
+    {
+        return frame->vm->context->getArrayValue(varId, index);
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+        return 0;
+    }
+}
+
+void RegisterVM::nativeStoreElem(NativeFrame* frame, int varId, int index, int value)
+{
+    try
+    {
+        frame->vm->context->setArrayValue(varId, index, value);
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+    }
+}
+
+void RegisterVM::nativePrint(NativeFrame* frame, int value)
+{
+    try
+    {
+        frame->pm->println(std::to_string(value));
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+    }
+}
+
+// 返回非零表示在等待输入，生成的代码已经把局部变量写回寄存器
+int RegisterVM::nativeExec(NativeFrame* frame, int pos)
+{
+    RegisterVM* vm = frame->vm;
+    try
+    {
+        vm->storeVars();
+        vm->program.statementAt(pos)->execute(frame->pm);
+        if (frame->pm->isWaitingForInput())
+            return 1;
+        vm->loadVars();
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+    }
+    return 0;
+}
+
+void RegisterVM::nativeCheckLimits(NativeFrame* frame)
+{
+    RegisterVM* vm = frame->vm;
+    vm->limitCheckCountdown = 0;
+    try
+    {
+        vm->checkLimits();
+        frame->limitCheckCountdown = vm->limitCheckCountdown;
+    }
+    catch (const char* errMsg)
+    {
+        failNative(frame, errMsg);
+    }
+}
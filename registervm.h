@@ -0,0 +1,211 @@
+#ifndef REGISTERVM_H
+#define REGISTERVM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <QElapsedTimer>
+#include "programmanager.h"
+
+class ProgramStore;
+class ProgramAnalysis;
+class RuntimeContext;
+class Expression;
+class ForStmt;
+class NativeCompiler;
+
+/*
+ * 寄存器虚拟机：运行前把整个程序编译成三地址指令，寄存器文件依次是
+ *   变量 | FOR的终值和步长 | 临时寄存器 | 常量
+ * 表达式的中间结果放在临时寄存器中，每条语句编译完后用线性扫描分配；
+ * LET的最后一步运算直接写入目标变量的寄存器，不再经过临时寄存器。
+ * 分析能证明已定义的变量读取时不再检查，INPUT和DIM仍交给原语句执行。
+ * 编译出的指令还可以再翻译成C++交给本机编译器（NATIVE_ENGINE），变量成为局部变量，
+ * 每条语句一个标号，跳转直接用goto，其余的运行时支持通过NativeFrame中的回调完成。
+ */
+class RegisterVM
+{
+public:
+    typedef enum
+    {
+        FINISHED = 0,
+        SUSPENDED
+    } RunResult;
+
+private:
+    typedef enum
+    {
+        STMT = 0,
+        MOVE,
+        ADD,
+        SUB,
+        MUL,
+        DIV,
+        MOD,
+        POW,
+        CHECK_DEFINED,
+        DEFINE,
+        LOAD_ELEM,
+        STORE_ELEM,
+        PRINT,
+        JUMP,
+        JUMP_IF_EQUAL,
+        JUMP_IF_LESS,
+        JUMP_IF_GREATER,
+        FOR_ENTER,
+        NEXT,
+        GOSUB,
+        RETURN,
+        EXEC,
+        ERROR,
+        FINISH
+    } OpCode;
+
+    // 编译期间临时寄存器用负数表示，跳转目标是语句下标，编译结束后统一换成寄存器编号和指令地址
+    struct Instruction
+    {
+        OpCode op;
+        int dst;
+        int a;
+        int b;
+        int aux;
+    };
+
+    // 原生代码与虚拟机之间的接口，布局必须与writeNativeSource生成的定义一致；
+    // 回调出错时设置error，不向生成的代码抛出异常
+    struct NativeFrame
+    {
+        int* regs;
+        char* defined;
+        int* states;
+        int* returnStack;
+        int returnDepth;
+        int pc;
+        size_t* curPos;
+        int limitCheckCountdown;
+        long long jumpCnt;
+        const char* error;
+        RegisterVM* vm;
+        ProgramManager* pm;
+        int (*divide)(NativeFrame* frame, int a, int b);
+        int (*mod)(NativeFrame* frame, int a, int b);
+        int (*power)(NativeFrame* frame, int a, int b);
+        int (*loadElem)(NativeFrame* frame, int varId, int index);
+        void (*storeElem)(NativeFrame* frame, int varId, int index, int value);
+        void (*print)(NativeFrame* frame, int value);
+        int (*exec)(NativeFrame* frame, int pos);
+        void (*checkLimits)(NativeFrame* frame);
+    };
+
+    typedef enum
+    {
+        NATIVE_FINISHED = 0,
+        NATIVE_SUSPENDED,
+        NATIVE_FAILED
+    } NativeResult;
+
+    typedef int (*NativeEntry)(NativeFrame* frame);
+
+    // 树遍历每读一次变量计一次使用次数。编译时记下每条语句按求值顺序读了哪些变量，
+    // 运行时按语句执行次数的增量批量补上；pc是读取所在的指令，出错时只计入不晚于出错指令的读取
+    struct VarUse
+    {
+        int varId;
+        int pc;
+    };
+
+    static const int RETURN_STACK_SIZE = 256;
+    static const int LIMIT_CHECK_INTERVAL = 1024;
+
+    const ProgramStore& program;
+    // 只在编译期间使用
+    const ProgramAnalysis* analysis = nullptr;
+    RuntimeContext* context;
+    ProgramManager::ExecutionLimits limits;
+
+    std::vector<Instruction> code;
+    std::vector<int> regs;
+    std::vector<char> defined;
+    int varCnt = 0;
+    int tempCnt = 0;
+    // 变量之后的常量和FOR寄存器在编译时就确定编号，initValues是它们的初值
+    std::vector<int> initValues;
+    std::map<int, int> constRegs;
+    std::map<const ForStmt*, int> loopRegs;
+    std::vector<std::string> messages;
+
+    // 每条语句的计数器按Statement::saveState的布局连续存放，结束时原样写回语句
+    std::vector<int> statementStates;
+    std::vector<size_t> stateOffsets;
+    std::vector<int> statementPcs;
+    std::vector<VarUse> varUses;
+    std::vector<size_t> useOffsets;
+    std::vector<int> appliedCnts;
+    int finishPc = 0;
+    int missingTargetPc = 0;
+
+    int returnStack[RETURN_STACK_SIZE];
+    int returnDepth = 0;
+    size_t pc = 0;
+    long long executedCnt = 0;
+    long long jumpCnt = 0;
+    int limitCheckInterval = LIMIT_CHECK_INTERVAL;
+    int limitCheckCountdown = LIMIT_CHECK_INTERVAL;
+    long long millisLeft = 0;
+    QElapsedTimer runTimer;
+
+    NativeCompiler* nativeCompiler = nullptr;
+    NativeEntry nativeEntry = nullptr;
+    std::string nativeError;
+
+    // 编译一条语句时使用
+    int curLineIndex = 0;
+    int virtualTempCnt = 0;
+    std::vector<int> checkedVars;
+
+public:
+    RegisterVM(const ProgramStore& program, const ProgramAnalysis& analysis, RuntimeContext* context,
+               const ProgramManager::ExecutionLimits& limits);
+    ~RegisterVM();
+    bool compileNative(std::string& error);
+    RunResult run(ProgramManager* pm, size_t& curPos, long long elapsedMillis);
+    long long getExecutedCnt() const;
+    long long getJumpCnt() const;
+    void getSuspendedState(size_t& resumePos, std::vector<size_t>& returnPositions) const;
+
+private:
+    void compile(const ProgramAnalysis& analysis);
+    void compileStatement(size_t pos);
+    int compileExpression(const Expression* exp);
+    void compileExpressionInto(const Expression* exp, int dst);
+    void appendInstruction(OpCode op, int dst, int a = 0, int b = 0, int aux = 0);
+    int newTemp();
+    int constReg(int value);
+    int loopRegOf(const ForStmt* loop);
+    int targetPos(int lineIndex) const;
+    int addMessage(const std::string& message);
+    void allocateTemps(size_t begin, size_t end);
+    void relocate();
+    void writeNativeSource(std::string& out) const;
+    std::string nativeOperand(int reg) const;
+    void writeNativeVars(std::string& out, bool store, bool declare) const;
+    RunResult runNative(ProgramManager* pm, size_t& curPos);
+    static void failNative(NativeFrame* frame, const char* errMsg);
+    static int nativeDivide(NativeFrame* frame, int a, int b);
+    static int nativeMod(NativeFrame* frame, int a, int b);
+    static int nativePower(NativeFrame* frame, int a, int b);
+    static int nativeLoadElem(NativeFrame* frame, int varId, int index);
+    static void nativeStoreElem(NativeFrame* frame, int varId, int index, int value);
+    static void nativePrint(NativeFrame* frame, int value);
+    static int nativeExec(NativeFrame* frame, int pos);
+    static void nativeCheckLimits(NativeFrame* frame);
+
+    void loadVars();
+    void storeVars();
+    void storeStates();
+    void applyVarUses(int failedPc);
+    void checkLimits();
+    void scheduleLimitCheck();
+};
+
+#endif // REGISTERVM_H
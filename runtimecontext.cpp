@@ -1,38 +1,266 @@
 #include "runtimecontext.h"
+#include "symboltable.h"
+
+#include <algorithm>
 
 RuntimeContext::RuntimeContext() {}
 
 void RuntimeContext::clear()
 {
-    varValues.clear();
-    varUseCnts.clear();
+    // 加载完成后所有变量名都已驻留，这里一次性分配好，运行时不再扩容
+    size_t varCnt = SymbolTable::instance().size();
+    varValues.assign(varCnt, 0);
+    varDefined.assign(varCnt, 0);
+    varUseCnts.assign(varCnt, 0);
+    arrayValues.assign(varCnt, std::vector<int>());
+    subexpCache.clear();
+    subexpDependents.clear();
+    writeCnt = 0;
+    evalCnt = 0;
+}
+
+void RuntimeContext::reserveVar(const int varId)
+{
+    if (varId < (int)varValues.size())
+        return;
+    varValues.resize(varId + 1, 0);
+    varDefined.resize(varId + 1, 0);
+    varUseCnts.resize(varId + 1, 0);
+    arrayValues.resize(varId + 1);
 }
 
-int RuntimeContext::getVarValue(const std::string& name)
+int RuntimeContext::getVarValue(const int varId)
 {
-    varUseCnts[name]++;
-    auto it = varValues.find(name);
-    if (it == varValues.end())
+    reserveVar(varId);
+    varUseCnts[varId]++;
+    if (!varDefined[varId])
     {
-        throwError(("Variable '" + name + "' not found").c_str());
+        // 异常抛出的是指针，消息必须保存在比调用栈活得更久的地方
+        errorMessage = "Variable '" + SymbolTable::instance().nameOf(varId) + "' not found";
+        throwError(errorMessage.c_str());
     }
-    return it->second;
+    return varValues[varId];
+}
+
+bool RuntimeContext::findVarValue(const int varId, int& value) const
+{
+    if (varId < 0 || varId >= (int)varValues.size() || !varDefined[varId])
+        return false;
+    value = varValues[varId];
+    return true;
+}
+
+void RuntimeContext::setVarValue(const int varId, const int value)
+{
+    reserveVar(varId);
+    varValues[varId] = value;
+    varDefined[varId] = 1;
+    writeCnt++;
+    invalidateDependents(varId);
+}
+
+// 寄存器虚拟机把前varCnt个变量整体写回，不经过公共子表达式缓存；变量表比它短时先扩充
+void RuntimeContext::setVarValues(const int* values, const char* defined, const size_t varCnt)
+{
+    if (varCnt == 0)
+        return;
+    reserveVar(varCnt - 1);
+    std::copy(values, values + varCnt, varValues.begin());
+    std::copy(defined, defined + varCnt, varDefined.begin());
 }
 
-void RuntimeContext::setVarValue(const std::string& name, const int value)
+void RuntimeContext::invalidateDependents(const int varId)
 {
-    varValues[name] = value;
+    if (varId >= (int)subexpDependents.size())
+        return;
+    for (int slot : subexpDependents[varId])
+        subexpCache[slot].valid = false;
 }
 
-int RuntimeContext::getVarUseCnt(const std::string& name) const
+int RuntimeContext::getVarUseCnt(const int varId) const
 {
-    auto it = varUseCnts.find(name);
-    if (it == varUseCnts.end())
+    if (varId < 0 || varId >= (int)varUseCnts.size())
         return 0;
-    return it->second;
+    return varUseCnts[varId];
+}
+
+// 寄存器虚拟机按语句的执行次数批量补上读取次数
+void RuntimeContext::addVarUseCnt(const int varId, const int cnt)
+{
+    reserveVar(varId);
+    varUseCnts[varId] += cnt;
+}
+
+long long RuntimeContext::getReadCnt() const
+{
+    long long res = 0;
+    for (int cnt : varUseCnts)
+        res += cnt;
+    return res;
+}
+
+long long RuntimeContext::getWriteCnt() const
+{
+    return writeCnt;
+}
+
+long long RuntimeContext::getEvalCnt() const
+{
+    return evalCnt;
+}
+
+const std::vector<int>& RuntimeContext::getVarValues() const
+{
+    return varValues;
+}
+
+const std::vector<char>& RuntimeContext::getVarDefined() const
+{
+    return varDefined;
+}
+
+const std::vector<std::vector<int>>& RuntimeContext::getArrayValues() const
+{
+    return arrayValues;
+}
+
+// 从检查点恢复：直接写入，不计入写入次数；恢复前公共子表达式缓存都还没有值
+void RuntimeContext::loadVar(const int varId, const bool defined, const int value, const int useCnt,
+                             const std::vector<int>& array)
+{
+    reserveVar(varId);
+    varValues[varId] = value;
+    varDefined[varId] = defined;
+    varUseCnts[varId] = useCnt;
+    arrayValues[varId] = array;
+}
+
+void RuntimeContext::setCounters(const long long writeCnt, const long long evalCnt)
+{
+    this->writeCnt = writeCnt;
+    this->evalCnt = evalCnt;
+}
+
+// 内容相同的两个状态哈希一定相同
+size_t RuntimeContext::hashVarValues() const
+{
+    size_t res = varValues.size();
+    for (size_t i = 0; i < varValues.size(); i++)
+    {
+        if (!varDefined[i])
+            continue;
+        size_t h = (i + 1) ^ ((size_t)(unsigned)varValues[i] * 0x9E3779B97F4A7C15ULL);
+        res = res * 31 + (h ^ (h >> 29));
+    }
+    return res;
 }
 
 void RuntimeContext::throwError(const char* errMsg) const
 {
     throw errMsg;
 }
+
+// 重新DIM会丢弃原有内容，所有元素清零
+void RuntimeContext::dimArray(const int varId, const int size)
+{
+    reserveVar(varId);
+    arrayValues[varId].assign(size, 0);
+    invalidateDependents(varId);
+}
+
+int RuntimeContext::getArraySize(const int varId) const
+{
+    if (varId < 0 || varId >= (int)arrayValues.size())
+        return 0;
+    return arrayValues[varId].size();
+}
+
+void RuntimeContext::checkArrayIndex(const int varId, const int index)
+{
+    reserveVar(varId);
+    const std::vector<int>& values = arrayValues[varId];
+    if (values.empty())
+    {
+        errorMessage = "Array '" + SymbolTable::instance().nameOf(varId) + "' is not dimensioned";
+        throwError(errorMessage.c_str());
+    }
+    if (index < 0 || index >= (int)values.size())
+    {
+        errorMessage = "Index " + std::to_string(index) + " out of range for array '"
+                       + SymbolTable::instance().nameOf(varId) + "'";
+        throwError(errorMessage.c_str());
+    }
+}
+
+int RuntimeContext::getArrayValue(const int varId, const int index)
+{
+    checkArrayIndex(varId, index);
+    return getArrayValueUnchecked(varId, index);
+}
+
+int RuntimeContext::getArrayValueUnchecked(const int varId, const int index)
+{
+    varUseCnts[varId]++;
+    return arrayValues[varId][index];
+}
+
+void RuntimeContext::setArrayValue(const int varId, const int index, const int value)
+{
+    checkArrayIndex(varId, index);
+    setArrayValueUnchecked(varId, index, value);
+}
+
+void RuntimeContext::setArrayValueUnchecked(const int varId, const int index, const int value)
+{
+    arrayValues[varId][index] = value;
+    writeCnt++;
+    invalidateDependents(varId);
+}
+
+
+int RuntimeContext::addCachedSubexp(const std::vector<int>& reads)
+{
+    int slot = subexpCache.size();
+    subexpCache.push_back( {0, false, reads} );
+
+    for (size_t i = 0; i < reads.size(); i++)
+    {
+        bool seen = false;
+        for (size_t j = 0; j < i; j++)
+            seen = seen || reads[j] == reads[i];
+        if (seen)
+            continue;
+        if (reads[i] >= (int)subexpDependents.size())
+            subexpDependents.resize(reads[i] + 1);
+        subexpDependents[reads[i]].push_back(slot);
+    }
+    return slot;
+}
+
+// 程序改变后缓存槽要重新分配，变量的值保留
+void RuntimeContext::clearCachedSubexps()
+{
+    subexpCache.clear();
+    subexpDependents.clear();
+}
+
+bool RuntimeContext::getCachedValue(const int slot, int& value)
+{
+    if (slot >= (int)subexpCache.size() || !subexpCache[slot].valid)
+        return false;
+
+    // 命中缓存时仍要计入变量的使用次数，保证语法树统计不变
+    const CachedSubexp& entry = subexpCache[slot];
+    for (int varId : entry.reads)
+        varUseCnts[varId]++;
+    value = entry.value;
+    return true;
+}
+
+void RuntimeContext::setCachedValue(const int slot, const int value)
+{
+    if (slot >= (int)subexpCache.size())
+        return;
+    subexpCache[slot].value = value;
+    subexpCache[slot].valid = true;
+}
@@ -2,21 +2,68 @@
 #define RUNTIMECONTEXT_H
 
 #include <string>
-#include <unordered_map>
+#include <vector>
 
+// 变量按SymbolTable分配的ID存放在连续数组中
 class RuntimeContext
 {
 private:
-    std::unordered_map<std::string, int> varValues;
-    std::unordered_map<std::string, int> varUseCnts;
+    struct CachedSubexp
+    {
+        int value = 0;
+        bool valid = false;
+        std::vector<int> reads;
+    };
+
+    std::vector<int> varValues;
+    std::vector<char> varDefined;
+    std::vector<int> varUseCnts;
+    // 数组与同名的标量变量共用ID，每个数组是一段连续的int，未DIM时为空
+    std::vector<std::vector<int>> arrayValues;
+    std::vector<CachedSubexp> subexpCache;
+    std::vector<std::vector<int>> subexpDependents;
+    std::string errorMessage;
+    // 运行统计：读取次数由varUseCnts汇总，这里只记写入和求值的节点数
+    long long writeCnt = 0;
+    long long evalCnt = 0;
+
+    void reserveVar(const int varId);
+    void invalidateDependents(const int varId);
+    void checkArrayIndex(const int varId, const int index);
 
 public:
     RuntimeContext();
     void clear();
-    int getVarValue(const std::string& name);
-    void setVarValue(const std::string& name, const int value);
-    int getVarUseCnt(const std::string& name) const;
+    int getVarValue(const int varId);
+    bool findVarValue(const int varId, int& value) const;
+    void setVarValue(const int varId, const int value);
+    void setVarValues(const int* values, const char* defined, const size_t varCnt);
+    int getVarUseCnt(const int varId) const;
+    void addVarUseCnt(const int varId, const int cnt);
+    const std::vector<int>& getVarValues() const;
+    const std::vector<char>& getVarDefined() const;
+    const std::vector<std::vector<int>>& getArrayValues() const;
+    size_t hashVarValues() const;
+    long long getReadCnt() const;
+    long long getWriteCnt() const;
+    long long getEvalCnt() const;
+    void countEval() { evalCnt++; }
+    void loadVar(const int varId, const bool defined, const int value, const int useCnt,
+                 const std::vector<int>& array);
+    void setCounters(const long long writeCnt, const long long evalCnt);
     void throwError(const char* errMsg) const;
+
+    void dimArray(const int varId, const int size);
+    int getArraySize(const int varId) const;
+    int getArrayValue(const int varId, const int index);
+    int getArrayValueUnchecked(const int varId, const int index);
+    void setArrayValue(const int varId, const int index, const int value);
+    void setArrayValueUnchecked(const int varId, const int index, const int value);
+
+    int addCachedSubexp(const std::vector<int>& reads);
+    void clearCachedSubexps();
+    bool getCachedValue(const int slot, int& value);
+    void setCachedValue(const int slot, const int value);
 };
 
 #endif // RUNTIMECONTEXT_H
@@ -2,8 +2,10 @@
 
 #include "programmanager.h"
 #include "expression.h"
+#include "symboltable.h"
+
+#include <climits>
 
-#include <sstream>
 
 void Statement::execute(ProgramManager* pm)
 {
@@ -11,6 +13,15 @@ void Statement::execute(ProgramManager* pm)
     doExecute(pm);
 }
 
+void Statement::countExecution() { executionCnt++; }
+
+std::string Statement::getTreeDisplay(ProgramManager* pm)
+{
+    std::string res;
+    writeTreeDisplay(res, pm);
+    return res;
+}
+
 int Statement::getExecutionCnt() { return executionCnt; }
 
 void Statement::resetStats()
@@ -19,16 +30,39 @@ void Statement::resetStats()
     doResetStats();
 }
 
+// 保存计数器等运行状态，用于快照和断点续跑
+void Statement::saveState(std::vector<int>& out) const
+{
+    out.push_back(executionCnt);
+    doSaveState(out);
+}
+
+void Statement::loadState(const int*& in)
+{
+    executionCnt = *in++;
+    doLoadState(in);
+}
+
+void Statement::doSaveState(std::vector<int>& out) const {}
+void Statement::doLoadState(const int*& in) {}
+
+void Statement::collectExpressions(std::vector<Expression*>& exps) const {}
+int Statement::getDefinedVarId() const { return -1; }
+bool Statement::getJumpTarget(int& targetLineIndex) const { return false; }
+bool Statement::canFallThrough() const { return true; }
+bool Statement::hasSideEffects() const { return false; }
+
 
 RemStmt::RemStmt(const std::string comment)
     : comment(comment) {}
 
-std::string RemStmt::getTreeDisplay(ProgramManager* pm)
+void RemStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "REM " << getExecutionCnt() << std::endl;
-    treeDisplay << "    " << comment << std::endl;
-    return treeDisplay.str();
+    out += "REM ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    out += comment;
+    out += "\n";
 }
 
 void RemStmt::doExecute(ProgramManager* pm) {}
@@ -36,34 +70,63 @@ void RemStmt::doResetStats() {}
 
 
 LetStmt::LetStmt(const std::string varName, Expression* expression)
-    : varName(varName), expression(expression) {}
+    : varId(SymbolTable::instance().intern(varName)), expression(expression) {}
+
+LetStmt::LetStmt(IndexExp* target, Expression* expression)
+    : varId(target->varId), target(target), expression(expression) {}
 
-std::string LetStmt::getTreeDisplay(ProgramManager* pm)
+void LetStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "LET = " << getExecutionCnt() << std::endl;
-    treeDisplay << "    " << varName << " " << pm->getVarUseCnt(varName) << std::endl;
-    treeDisplay << expression->getSyntaxTree(4) << std::endl;
-    return treeDisplay.str();
+    out += "LET = ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    out += SymbolTable::instance().nameOf(varId);
+    out += " ";
+    Expression::appendNumber(out, pm->getVarUseCnt(varId));
+    out += "\n";
+    if (target)
+    {
+        pm->writeExpressionTree(out, target->indexExp, 8);
+        out += "\n";
+    }
+    pm->writeExpressionTree(out, expression, 4);
+    out += "\n";
 }
 
 void LetStmt::doExecute(ProgramManager* pm)
 {
-    pm->setVarValue(varName, expression);
+    if (target)
+        pm->setArrayValue(target, expression);
+    else
+        pm->setVarValue(varId, expression);
 }
 
 void LetStmt::doResetStats() {}
 
+void LetStmt::collectExpressions(std::vector<Expression*>& exps) const
+{
+    if (target)
+        exps.push_back(target);
+    exps.push_back(expression);
+}
+
+// 给数组元素赋值不会覆盖整个数组，不作为对变量的定义
+int LetStmt::getDefinedVarId() const { return target ? -1 : varId; }
+
+// 数组内容不参与死循环检测的状态比较
+bool LetStmt::hasSideEffects() const { return target != nullptr; }
+
 
 PrintStmt::PrintStmt(Expression* expression)
     : expression(expression) {}
 
-std::string PrintStmt::getTreeDisplay(ProgramManager* pm)
+void PrintStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "PRINT " << getExecutionCnt() << std::endl;
-    treeDisplay << expression->getSyntaxTree(4) << std::endl;
-    return treeDisplay.str();
+    out += "PRINT ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n";
+    pm->writeExpressionTree(out, expression, 4);
+    out += "\n";
 }
 
 void PrintStmt::doExecute(ProgramManager* pm)
@@ -74,35 +137,47 @@ void PrintStmt::doExecute(ProgramManager* pm)
 
 void PrintStmt::doResetStats() {}
 
+void PrintStmt::collectExpressions(std::vector<Expression*>& exps) const
+{
+    exps.push_back(expression);
+}
+
+bool PrintStmt::hasSideEffects() const { return true; }
+
 
 InputStmt::InputStmt(const std::string varName)
-    : varName(varName) {}
+    : varId(SymbolTable::instance().intern(varName)) {}
 
-std::string InputStmt::getTreeDisplay(ProgramManager* pm)
+void InputStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "INPUT " << getExecutionCnt() << std::endl;
-    treeDisplay << "    " << varName << std::endl;
-    return treeDisplay.str();
+    out += "INPUT ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    out += SymbolTable::instance().nameOf(varId);
+    out += "\n";
 }
 
 void InputStmt::doExecute(ProgramManager* pm)
 {
-    pm->inputVar(varName);
+    pm->inputVar(varId);
 }
 
 void InputStmt::doResetStats() {}
 
+int InputStmt::getDefinedVarId() const { return varId; }
+bool InputStmt::hasSideEffects() const { return true; }
+
 
 GotoStmt::GotoStmt(const int targetLineIndex)
     : targetLineIndex(targetLineIndex) {}
 
-std::string GotoStmt::getTreeDisplay(ProgramManager* pm)
+void GotoStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "GOTO " << getExecutionCnt() << std::endl;
-    treeDisplay << "    " << targetLineIndex << std::endl;
-    return treeDisplay.str();
+    out += "GOTO ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    Expression::appendNumber(out, targetLineIndex);
+    out += "\n";
 }
 
 void GotoStmt::doExecute(ProgramManager* pm)
@@ -112,28 +187,48 @@ void GotoStmt::doExecute(ProgramManager* pm)
 
 void GotoStmt::doResetStats() {}
 
+bool GotoStmt::getJumpTarget(int& targetLineIndex) const
+{
+    targetLineIndex = this->targetLineIndex;
+    return true;
+}
+
+bool GotoStmt::canFallThrough() const { return false; }
+
 
 IfStmt::IfStmt(Expression* leftExp, Expression* rightExp, const ComparisonType comp, const int targetLineIndex)
     : leftExp(leftExp), rightExp(rightExp), comp(comp), targetLineIndex(targetLineIndex) {}
 
-std::string IfStmt::getTreeDisplay(ProgramManager* pm)
+void IfStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "IF THEN " << getTrueCnt() << " " << getFalseCnt() << std::endl;
-    treeDisplay << leftExp->getSyntaxTree(4) << std::endl;
+    out += "IF THEN ";
+    Expression::appendNumber(out, getTrueCnt());
+    out += " ";
+    Expression::appendNumber(out, getFalseCnt());
+    out += "\n";
+    pm->writeExpressionTree(out, leftExp, 4);
+    out += "\n";
     switch (comp)
     {
-        case EQUAL: treeDisplay << "    =" << std::endl; break;
-        case LESS_THAN: treeDisplay << "    <" << std::endl; break;
-        case GREATER_THAN: treeDisplay << "    >" << std::endl; break;
-        default: treeDisplay << "???" << std::endl; break;
+        case EQUAL: out += "    =\n"; break;
+        case LESS_THAN: out += "    <\n"; break;
+        case GREATER_THAN: out += "    >\n"; break;
+        default: out += "???\n"; break;
     }
-    treeDisplay << rightExp->getSyntaxTree(4) << std::endl;
-    treeDisplay << "    " << targetLineIndex << std::endl;
-    return treeDisplay.str();
+    pm->writeExpressionTree(out, rightExp, 4);
+    out += "\n    ";
+    Expression::appendNumber(out, targetLineIndex);
+    out += "\n";
 }
 
 void IfStmt::doExecute(ProgramManager* pm)
+{
+    if (test(pm))
+        pm->gotoLine(targetLineIndex);
+}
+
+// 只求值、比较和计数，不跳转；轨迹执行时用结果检查守卫
+bool IfStmt::test(ProgramManager* pm)
 {
     int leftExpValue = pm->getExpressionValue(leftExp);
     int rightExpValue = pm->getExpressionValue(rightExp);
@@ -146,28 +241,48 @@ void IfStmt::doExecute(ProgramManager* pm)
         default: break;
     }
     if (satisfied)
-    {
         trueCnt++;
-        pm->gotoLine(targetLineIndex);
-    }
     else
-    {
         falseCnt++;
-    }
+    return satisfied;
 }
 
 int IfStmt::getTrueCnt() { return trueCnt; }
 int IfStmt::getFalseCnt() { return falseCnt; }
 void IfStmt::doResetStats() { trueCnt = falseCnt = 0; }
 
+void IfStmt::doSaveState(std::vector<int>& out) const
+{
+    out.push_back(trueCnt);
+    out.push_back(falseCnt);
+}
+
+void IfStmt::doLoadState(const int*& in)
+{
+    trueCnt = *in++;
+    falseCnt = *in++;
+}
+
+void IfStmt::collectExpressions(std::vector<Expression*>& exps) const
+{
+    exps.push_back(leftExp);
+    exps.push_back(rightExp);
+}
+
+bool IfStmt::getJumpTarget(int& targetLineIndex) const
+{
+    targetLineIndex = this->targetLineIndex;
+    return true;
+}
+
 
 EndStmt::EndStmt() {}
 
-std::string EndStmt::getTreeDisplay(ProgramManager* pm)
+void EndStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
 {
-    std::stringstream treeDisplay;
-    treeDisplay << "END " << getExecutionCnt() << std::endl;
-    return treeDisplay.str();
+    out += "END ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n";
 }
 
 void EndStmt::doExecute(ProgramManager* pm)
@@ -176,3 +291,293 @@ void EndStmt::doExecute(ProgramManager* pm)
 }
 
 void EndStmt::doResetStats() {}
+
+bool EndStmt::canFallThrough() const { return false; }
+bool EndStmt::hasSideEffects() const { return true; }
+
+
+ForStmt::ForStmt(const std::string varName, Expression* startExp, Expression* endExp, Expression* stepExp)
+    : varId(SymbolTable::instance().intern(varName)), startExp(startExp), endExp(endExp), stepExp(stepExp) {}
+
+void ForStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
+{
+    out += "FOR ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    out += SymbolTable::instance().nameOf(varId);
+    out += " ";
+    Expression::appendNumber(out, pm->getVarUseCnt(varId));
+    out += "\n";
+    pm->writeExpressionTree(out, startExp, 4);
+    out += "\n";
+    pm->writeExpressionTree(out, endExp, 4);
+    out += "\n";
+    if (stepExp)
+    {
+        pm->writeExpressionTree(out, stepExp, 4);
+        out += "\n";
+    }
+}
+
+void ForStmt::doExecute(ProgramManager* pm)
+{
+    if (nextLineIndex == -1)
+        throw "FOR statement with no matching NEXT";
+
+    int startValue = pm->getExpressionValue(startExp);
+    endValue = pm->getExpressionValue(endExp);
+    stepValue = stepExp ? pm->getExpressionValue(stepExp) : 1;
+    if (stepValue == 0)
+        throw "FOR statement with a zero STEP";
+
+    pm->setVarValue(varId, startValue);
+    if (stepValue > 0 ? startValue > endValue : startValue < endValue)
+    {
+        boundsVerified = false;
+        pm->gotoLineAfter(nextLineIndex);
+        return;
+    }
+
+    // 循环变量只会在[low, high]内取值，据此一次性检查循环体内所有被外提的数组下标
+    long long low = stepValue > 0 ? startValue : endValue;
+    long long high = stepValue > 0 ? endValue : startValue;
+    boundsVerified = true;
+    for (const auto& guard : boundsGuards)
+    {
+        int size = pm->getArraySize(guard.arrayVarId);
+        boundsVerified = boundsVerified && low + guard.minOffset >= 0 && high + guard.maxOffset < size;
+    }
+}
+
+void ForStmt::doResetStats() {}
+
+void ForStmt::doSaveState(std::vector<int>& out) const
+{
+    out.push_back(endValue);
+    out.push_back(stepValue);
+    out.push_back(boundsVerified);
+}
+
+void ForStmt::doLoadState(const int*& in)
+{
+    endValue = *in++;
+    stepValue = *in++;
+    boundsVerified = *in++;
+}
+
+void ForStmt::collectExpressions(std::vector<Expression*>& exps) const
+{
+    exps.push_back(startExp);
+    exps.push_back(endExp);
+    if (stepExp)
+        exps.push_back(stepExp);
+}
+
+int ForStmt::getDefinedVarId() const { return varId; }
+
+// 循环次数为零时越过NEXT
+bool ForStmt::getJumpTarget(int& targetLineIndex) const
+{
+    targetLineIndex = exitLineIndex;
+    return exitLineIndex != -1;
+}
+
+
+NextStmt::NextStmt(const std::string varName)
+    : varId(varName.empty() ? -1 : SymbolTable::instance().intern(varName)) {}
+
+void NextStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
+{
+    out += "NEXT ";
+    Expression::appendNumber(out, getLoopCnt());
+    out += " ";
+    Expression::appendNumber(out, getExitCnt());
+    out += "\n";
+    int loopVarId = getDefinedVarId();
+    if (loopVarId != -1)
+    {
+        out += "    ";
+        out += SymbolTable::instance().nameOf(loopVarId);
+        out += "\n";
+    }
+}
+
+// 自增、比较和回跳合并在同一条语句中完成
+void NextStmt::doExecute(ProgramManager* pm)
+{
+    if (advance(pm))
+        pm->gotoLine(bodyLineIndex);
+}
+
+// 返回是否继续循环，回跳由调用者完成。自增在long long中进行：
+// 超出int范围时必然越过终值，循环结束，变量保持最后一次的值
+bool NextStmt::advance(ProgramManager* pm)
+{
+    if (!loop)
+        throw "NEXT statement with no matching FOR";
+
+    long long value = (long long)pm->getVarValue(loop->varId) + loop->stepValue;
+    if (value >= INT_MIN && value <= INT_MAX)
+        pm->setVarValue(loop->varId, (int)value);
+    if (loop->stepValue > 0 ? value <= loop->endValue : value >= loop->endValue)
+    {
+        loopCnt++;
+        return true;
+    }
+    exitCnt++;
+    return false;
+}
+
+int NextStmt::getLoopCnt() { return loopCnt; }
+int NextStmt::getExitCnt() { return exitCnt; }
+void NextStmt::doResetStats() { loopCnt = exitCnt = 0; }
+
+void NextStmt::doSaveState(std::vector<int>& out) const
+{
+    out.push_back(loopCnt);
+    out.push_back(exitCnt);
+}
+
+void NextStmt::doLoadState(const int*& in)
+{
+    loopCnt = *in++;
+    exitCnt = *in++;
+}
+
+int NextStmt::getDefinedVarId() const { return loop ? loop->varId : varId; }
+
+bool NextStmt::getJumpTarget(int& targetLineIndex) const
+{
+    targetLineIndex = bodyLineIndex;
+    return loop != nullptr;
+}
+
+
+GosubStmt::GosubStmt(const int targetLineIndex)
+    : targetLineIndex(targetLineIndex) {}
+
+void GosubStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
+{
+    out += "GOSUB ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    Expression::appendNumber(out, targetLineIndex);
+    out += "\n";
+}
+
+void GosubStmt::doExecute(ProgramManager* pm)
+{
+    pm->callSubroutine(targetLineIndex);
+}
+
+void GosubStmt::doResetStats() {}
+
+bool GosubStmt::getJumpTarget(int& targetLineIndex) const
+{
+    targetLineIndex = this->targetLineIndex;
+    return true;
+}
+
+// 下一行只能经由RETURN到达，分析时由ProgramAnalysis连接返回点
+bool GosubStmt::canFallThrough() const { return false; }
+bool GosubStmt::hasSideEffects() const { return true; }
+
+
+ReturnStmt::ReturnStmt() {}
+
+void ReturnStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
+{
+    out += "RETURN ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n";
+}
+
+void ReturnStmt::doExecute(ProgramManager* pm)
+{
+    pm->returnFromSubroutine();
+}
+
+void ReturnStmt::doResetStats() {}
+
+bool ReturnStmt::canFallThrough() const { return false; }
+bool ReturnStmt::hasSideEffects() const { return true; }
+
+
+DimStmt::DimStmt(const std::string varName, Expression* sizeExp)
+    : varId(SymbolTable::instance().intern(varName)), sizeExp(sizeExp) {}
+
+void DimStmt::writeTreeDisplay(std::string& out, ProgramManager* pm)
+{
+    out += "DIM ";
+    Expression::appendNumber(out, getExecutionCnt());
+    out += "\n    ";
+    out += SymbolTable::instance().nameOf(varId);
+    out += "\n";
+    pm->writeExpressionTree(out, sizeExp, 4);
+    out += "\n";
+}
+
+// DIM A(n)的合法下标为0到n
+void DimStmt::doExecute(ProgramManager* pm)
+{
+    int maxIndex = pm->getExpressionValue(sizeExp);
+    if (maxIndex < 0)
+        throw "DIM statement with a negative size";
+    pm->dimArray(varId, maxIndex + 1);
+}
+
+void DimStmt::doResetStats() {}
+
+void DimStmt::collectExpressions(std::vector<Expression*>& exps) const
+{
+    exps.push_back(sizeExp);
+}
+
+int DimStmt::getDefinedVarId() const { return varId; }
+bool DimStmt::hasSideEffects() const { return true; }
+
+
+
+// 只拥有嵌套的陷阱语句，原语句仍属于程序
+TrapStmt::TrapStmt(Statement* original)
+    : ownsOriginal(dynamic_cast<TrapStmt*>(original) != nullptr), original(original) {}
+
+TrapStmt::~TrapStmt()
+{
+    if (ownsOriginal)
+        delete original;
+}
+
+void TrapStmt::writeTreeDisplay(std::string& out, ProgramManager* pm) { original->writeTreeDisplay(out, pm); }
+void TrapStmt::doResetStats() { original->resetStats(); }
+void TrapStmt::doSaveState(std::vector<int>& out) const { original->saveState(out); }
+void TrapStmt::doLoadState(const int*& in) { original->loadState(in); }
+void TrapStmt::collectExpressions(std::vector<Expression*>& exps) const { original->collectExpressions(exps); }
+int TrapStmt::getDefinedVarId() const { return original->getDefinedVarId(); }
+bool TrapStmt::getJumpTarget(int& targetLineIndex) const { return original->getJumpTarget(targetLineIndex); }
+bool TrapStmt::canFallThrough() const { return original->canFallThrough(); }
+bool TrapStmt::hasSideEffects() const { return original->hasSideEffects(); }
+
+
+BreakpointStmt::BreakpointStmt(Statement* original)
+    : TrapStmt(original) {}
+
+void BreakpointStmt::doExecute(ProgramManager* pm)
+{
+    if (!pm->trapBreakpoint(this))
+        original->execute(pm);
+}
+
+
+WatchpointStmt::WatchpointStmt(Statement* original)
+    : TrapStmt(original) {}
+
+void WatchpointStmt::doExecute(ProgramManager* pm)
+{
+    int varId = getDefinedVarId();
+    int oldValue, newValue;
+    bool defined = pm->peekVarValue(varId, oldValue);
+    original->execute(pm);
+    if (pm->peekVarValue(varId, newValue) && (!defined || oldValue != newValue))
+        pm->trapWatchpoint(varId);
+}
@@ -2,10 +2,12 @@
 #define STATEMENT_H
 
 #include <string>
+#include <vector>
 
 
 class ProgramManager;
 class Expression;
+class IndexExp;
 
 class Statement
 {
@@ -13,15 +15,25 @@ private:
     int executionCnt = 0;
 
 public:
-    std::string rawCodeWithIndex;
     virtual ~Statement() = default;
 
-    virtual std::string getTreeDisplay(ProgramManager* pm) = 0;
+    std::string getTreeDisplay(ProgramManager* pm);
+    virtual void writeTreeDisplay(std::string& out, ProgramManager* pm) = 0;
     void execute(ProgramManager* pm);
+    void countExecution();
     virtual void doExecute(ProgramManager* pm) = 0;
     int getExecutionCnt();
     void resetStats();
     virtual void doResetStats() = 0;
+    void saveState(std::vector<int>& out) const;
+    void loadState(const int*& in);
+    virtual void doSaveState(std::vector<int>& out) const;
+    virtual void doLoadState(const int*& in);
+    virtual void collectExpressions(std::vector<Expression*>& exps) const;
+    virtual int getDefinedVarId() const;
+    virtual bool getJumpTarget(int& targetLineIndex) const;
+    virtual bool canFallThrough() const;
+    virtual bool hasSideEffects() const;
 };
 
 
@@ -31,7 +43,7 @@ public:
     std::string comment;
 
     RemStmt(const std::string comment);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
 };
@@ -40,14 +52,20 @@ public:
 class LetStmt : public Statement
 {
 public:
-    std::string varName;
+    int varId;
+    // 给数组元素赋值时非空
+    IndexExp* target = nullptr;
     Expression* expression;
 
 public:
     LetStmt(const std::string varName, Expression* expression);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    LetStmt(IndexExp* target, Expression* expression);
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    int getDefinedVarId() const override;
+    bool hasSideEffects() const override;
 };
 
 
@@ -57,21 +75,25 @@ public:
     Expression* expression;
 
     PrintStmt(Expression* expression);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    bool hasSideEffects() const override;
 };
 
 
 class InputStmt : public Statement
 {
 public:
-    std::string varName;
+    int varId;
 
     InputStmt(const std::string varName);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
+    int getDefinedVarId() const override;
+    bool hasSideEffects() const override;
 };
 
 
@@ -81,9 +103,11 @@ public:
     int targetLineIndex;
 
     GotoStmt(const int targetLineIndex);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
+    bool getJumpTarget(int& targetLineIndex) const override;
+    bool canFallThrough() const override;
 };
 
 
@@ -108,11 +132,16 @@ private:
 
 public:
     IfStmt(Expression* leftExp, Expression* rightExp, const ComparisonType comp, const int targetLineIndex);
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
+    bool test(ProgramManager* pm);
     int getTrueCnt();
     int getFalseCnt();
     void doResetStats() override;
+    void doSaveState(std::vector<int>& out) const override;
+    void doLoadState(const int*& in) override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    bool getJumpTarget(int& targetLineIndex) const override;
 };
 
 
@@ -120,9 +149,156 @@ class EndStmt : public Statement
 {
 public:
     EndStmt();
-    std::string getTreeDisplay(ProgramManager* pm) override;
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
     void doExecute(ProgramManager* pm) override;
     void doResetStats() override;
+    bool canFallThrough() const override;
+    bool hasSideEffects() const override;
+};
+
+
+class ForStmt : public Statement
+{
+public:
+    // 循环体内下标为“循环变量+常数”的数组访问，在进入循环时统一检查边界
+    struct BoundsGuard
+    {
+        int arrayVarId;
+        int minOffset;
+        int maxOffset;
+    };
+
+    int varId;
+    Expression* startExp;
+    Expression* endExp;
+    Expression* stepExp;
+    // 匹配的NEXT所在行及其下一行，由ProgramManager在运行前连接，-1表示没有
+    int nextLineIndex = -1;
+    int exitLineIndex = -1;
+    // 进入循环时求出的终值和步长，供NEXT使用
+    int endValue = 0;
+    int stepValue = 1;
+    std::vector<BoundsGuard> boundsGuards;
+    bool boundsVerified = false;
+
+    ForStmt(const std::string varName, Expression* startExp, Expression* endExp, Expression* stepExp);
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doExecute(ProgramManager* pm) override;
+    void doResetStats() override;
+    void doSaveState(std::vector<int>& out) const override;
+    void doLoadState(const int*& in) override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    int getDefinedVarId() const override;
+    bool getJumpTarget(int& targetLineIndex) const override;
+};
+
+
+class NextStmt : public Statement
+{
+public:
+    // 省略变量名时为-1，使用匹配的FOR的变量
+    int varId;
+    ForStmt* loop = nullptr;
+    int bodyLineIndex = -1;
+
+private:
+    int loopCnt = 0;
+    int exitCnt = 0;
+
+public:
+    NextStmt(const std::string varName);
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doExecute(ProgramManager* pm) override;
+    bool advance(ProgramManager* pm);
+    int getLoopCnt();
+    int getExitCnt();
+    void doResetStats() override;
+    void doSaveState(std::vector<int>& out) const override;
+    void doLoadState(const int*& in) override;
+    int getDefinedVarId() const override;
+    bool getJumpTarget(int& targetLineIndex) const override;
+};
+
+
+class GosubStmt : public Statement
+{
+public:
+    int targetLineIndex;
+
+    GosubStmt(const int targetLineIndex);
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doExecute(ProgramManager* pm) override;
+    void doResetStats() override;
+    bool getJumpTarget(int& targetLineIndex) const override;
+    bool canFallThrough() const override;
+    bool hasSideEffects() const override;
+};
+
+
+class ReturnStmt : public Statement
+{
+public:
+    ReturnStmt();
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doExecute(ProgramManager* pm) override;
+    void doResetStats() override;
+    bool canFallThrough() const override;
+    bool hasSideEffects() const override;
+};
+
+
+class DimStmt : public Statement
+{
+public:
+    int varId;
+    Expression* sizeExp;
+
+    DimStmt(const std::string varName, Expression* sizeExp);
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doExecute(ProgramManager* pm) override;
+    void doResetStats() override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    int getDefinedVarId() const override;
+    bool hasSideEffects() const override;
+};
+
+
+// 调试器使用的陷阱语句：替换程序中某一行，其余行为都转发给原语句
+class TrapStmt : public Statement
+{
+private:
+    bool ownsOriginal;
+
+public:
+    Statement* original;
+
+    TrapStmt(Statement* original);
+    ~TrapStmt();
+    void writeTreeDisplay(std::string& out, ProgramManager* pm) override;
+    void doResetStats() override;
+    void doSaveState(std::vector<int>& out) const override;
+    void doLoadState(const int*& in) override;
+    void collectExpressions(std::vector<Expression*>& exps) const override;
+    int getDefinedVarId() const override;
+    bool getJumpTarget(int& targetLineIndex) const override;
+    bool canFallThrough() const override;
+    bool hasSideEffects() const override;
+};
+
+
+class BreakpointStmt : public TrapStmt
+{
+public:
+    BreakpointStmt(Statement* original);
+    void doExecute(ProgramManager* pm) override;
+};
+
+
+class WatchpointStmt : public TrapStmt
+{
+public:
+    WatchpointStmt(Statement* original);
+    void doExecute(ProgramManager* pm) override;
 };
 
 
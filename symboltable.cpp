@@ -0,0 +1,43 @@
+#include "symboltable.h"
+
+SymbolTable::SymbolTable() {}
+
+SymbolTable& SymbolTable::instance()
+{
+    static SymbolTable table;
+    return table;
+}
+
+int SymbolTable::intern(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = ids.find(name);
+    if (it != ids.end())
+        return it->second;
+
+    names.push_back(name);
+    int id = names.size() - 1;
+    ids.emplace(name, id);
+    return id;
+}
+
+// 未驻留过的名字返回-1
+int SymbolTable::find(const std::string& name) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = ids.find(name);
+    return it == ids.end() ? -1 : it->second;
+}
+
+// deque在尾部追加时不会使已有元素的引用失效
+const std::string& SymbolTable::nameOf(int id) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return names[id];
+}
+
+int SymbolTable::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return names.size();
+}
@@ -0,0 +1,27 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 全局的标识符驻留表：每个不同的变量名在加载时映射为一个紧凑的整数ID
+class SymbolTable
+{
+private:
+    std::unordered_map<std::string, int> ids;
+    std::deque<std::string> names;
+    mutable std::mutex mutex;
+
+    SymbolTable();
+
+public:
+    static SymbolTable& instance();
+    int intern(const std::string& name);
+    int find(const std::string& name) const;
+    const std::string& nameOf(int id) const;
+    int size() const;
+};
+
+#endif // SYMBOLTABLE_H
@@ -0,0 +1,17 @@
+#ifndef SYSTEMUTILS_H
+#define SYSTEMUTILS_H
+
+#include <string>
+
+/*
+ * 与操作系统相关的少数调用，<windows.h>只在systemutils.cpp中包含，
+ * 它定义的min、max等宏不会影响解释器的其它文件
+ */
+
+// 进程的内存峰值（KB），取不到时为0
+long long getPeakMemoryKB();
+
+// 用fromFile原子地替换toFile，toFile已存在时也不会出现两者都缺失的时刻
+bool replaceFile(const std::string& fromFile, const std::string& toFile);
+
+#endif // SYSTEMUTILS_H
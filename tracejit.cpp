@@ -0,0 +1,128 @@
+#include "tracejit.h"
+
+#include "programstore.h"
+#include "statement.h"
+
+TraceJit::TraceJit(const ProgramStore& program)
+    : program(program), backEdgeCnts(program.size(), 0), traces(program.size(), nullptr),
+      blacklisted(program.size(), 0) {}
+
+TraceJit::~TraceJit()
+{
+    for (auto trace : traces)
+        delete trace;
+}
+
+// 返回true表示调用者需要在这一步执行完后调用recordStep或进入轨迹
+bool TraceJit::onBackEdge(size_t targetPos)
+{
+    if (targetPos >= traces.size())
+        return false;
+    if (traces[targetPos])
+        return true;
+    if (recordingHeader != NO_HEADER || blacklisted[targetPos])
+        return false;
+    if (++backEdgeCnts[targetPos] < HOT_LOOP_THRESHOLD)
+        return false;
+
+    recordingHeader = targetPos;
+    recordingStarted = false;
+    recording.clear();
+    return true;
+}
+
+bool TraceJit::isRecording() const { return recordingHeader != NO_HEADER; }
+
+// 记录刚执行完的一步，pos是这条语句的位置，nextPos是它的实际去向；返回是否继续记录
+bool TraceJit::recordStep(size_t pos, size_t nextPos)
+{
+    // 第一步是跳回循环头的那条语句本身，只用来确认确实到达了循环头
+    if (!recordingStarted)
+    {
+        if (nextPos != recordingHeader)
+        {
+            stopRecording(false);
+            return false;
+        }
+        recordingStarted = true;
+        return true;
+    }
+
+    TraceStep step = {SKIP, pos, program.statementAt(pos), -1, nullptr, false};
+    bool fallsThrough = nextPos == pos + 1;
+    if (dynamic_cast<RemStmt*>(step.statement) && fallsThrough)
+    {
+        step.kind = SKIP;
+    }
+    else if (LetStmt* letStmt = dynamic_cast<LetStmt*>(step.statement))
+    {
+        step.kind = letStmt->target ? EXECUTE : ASSIGN;
+        step.varId = letStmt->varId;
+        step.expression = letStmt->expression;
+    }
+    else if (dynamic_cast<PrintStmt*>(step.statement) && fallsThrough)
+    {
+        step.kind = EXECUTE;
+    }
+    else if (dynamic_cast<GotoStmt*>(step.statement))
+    {
+        step.kind = JUMP;
+    }
+    else if (dynamic_cast<IfStmt*>(step.statement))
+    {
+        step.kind = GUARD_IF;
+        step.taken = !fallsThrough;
+    }
+    else if (dynamic_cast<NextStmt*>(step.statement))
+    {
+        step.kind = GUARD_NEXT;
+        step.taken = !fallsThrough;
+    }
+    else
+    {
+        stopRecording(true);
+        return false;
+    }
+    recording.push_back(step);
+
+    if (nextPos == recordingHeader)
+    {
+        Trace* trace = new Trace;
+        trace->headerPos = recordingHeader;
+        trace->steps.swap(recording);
+        traces[recordingHeader] = trace;
+        traceCnt++;
+        stopRecording(false);
+        return false;
+    }
+    if (recording.size() >= MAX_TRACE_LENGTH)
+    {
+        stopRecording(true);
+        return false;
+    }
+    return true;
+}
+
+// 执行中断（等待输入、暂停或出错）时丢弃记录了一半的轨迹，之后可以重新尝试
+void TraceJit::abortRecording()
+{
+    if (isRecording())
+        stopRecording(false);
+}
+
+const TraceJit::Trace* TraceJit::traceAt(size_t pos) const
+{
+    return pos < traces.size() ? traces[pos] : nullptr;
+}
+
+int TraceJit::getTraceCnt() const { return traceCnt; }
+
+void TraceJit::stopRecording(bool blacklist)
+{
+    if (blacklist)
+        blacklisted[recordingHeader] = 1;
+    backEdgeCnts[recordingHeader] = 0;
+    recordingHeader = NO_HEADER;
+    recordingStarted = false;
+    recording.clear();
+}
@@ -0,0 +1,77 @@
+#ifndef TRACEJIT_H
+#define TRACEJIT_H
+
+#include <string>
+#include <vector>
+
+class ProgramStore;
+class Statement;
+class Expression;
+
+/*
+ * 跟踪热循环：GOTO、IF和NEXT每跳回一次循环头就计数一次，超过阈值后记录下一次从循环头
+ * 出发、再回到循环头所经过的语句，编成一条轨迹。之后再跳回循环头时改走轨迹：
+ * 变量赋值直接写入运行环境，GOTO不再查找行号，IF和NEXT成为守卫，
+ * 走向与记录时不同就从实际的去向回到逐条解释。
+ * 轨迹只包含LET、PRINT、REM、GOTO、IF和NEXT，遇到其他语句或过长时放弃，该循环头不再尝试。
+ */
+class TraceJit
+{
+public:
+    typedef enum
+    {
+        SKIP = 0,
+        ASSIGN,
+        EXECUTE,
+        JUMP,
+        GUARD_IF,
+        GUARD_NEXT
+    } StepKind;
+
+    struct TraceStep
+    {
+        StepKind kind;
+        size_t pos;
+        Statement* statement;
+        // ASSIGN的目标变量和值
+        int varId;
+        Expression* expression;
+        // 守卫记录时的走向
+        bool taken;
+    };
+
+    struct Trace
+    {
+        size_t headerPos;
+        std::vector<TraceStep> steps;
+    };
+
+private:
+    static const int HOT_LOOP_THRESHOLD = 64;
+    static const size_t MAX_TRACE_LENGTH = 256;
+    static const size_t NO_HEADER = (size_t)-1;
+
+    const ProgramStore& program;
+    std::vector<int> backEdgeCnts;
+    std::vector<Trace*> traces;
+    std::vector<char> blacklisted;
+    size_t recordingHeader = NO_HEADER;
+    bool recordingStarted = false;
+    std::vector<TraceStep> recording;
+    int traceCnt = 0;
+
+public:
+    TraceJit(const ProgramStore& program);
+    ~TraceJit();
+    bool onBackEdge(size_t targetPos);
+    bool isRecording() const;
+    bool recordStep(size_t pos, size_t nextPos);
+    void abortRecording();
+    const Trace* traceAt(size_t pos) const;
+    int getTraceCnt() const;
+
+private:
+    void stopRecording(bool blacklist);
+};
+
+#endif // TRACEJIT_H
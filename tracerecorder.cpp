@@ -0,0 +1,284 @@
+#include "tracerecorder.h"
+
+#include <iterator>
+
+static const char TRACE_MAGIC[] = "QBTRACE1";
+static const size_t TRACE_MAGIC_LENGTH = 8;
+
+static uint64_t zigzagEncode(long long value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static long long zigzagDecode(uint64_t value)
+{
+    return (long long)(value >> 1) ^ -(long long)(value & 1);
+}
+
+
+TraceRecorder::TraceRecorder() {}
+
+TraceRecorder::~TraceRecorder()
+{
+    close();
+}
+
+bool TraceRecorder::open(const std::string& fileName, const std::string& source)
+{
+    close();
+    file.open(fileName, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    stepCnt = pendingRun = pendingRepeat = 0;
+    lastSegmentRun = -1;
+    lastSegmentDelta = 0;
+    skipStep = false;
+    buffer.clear();
+    buffer.reserve(FLUSH_SIZE + 16);
+
+    buffer.insert(buffer.end(), TRACE_MAGIC, TRACE_MAGIC + TRACE_MAGIC_LENGTH);
+    uint64_t length = source.size();
+    while (length >= 0x80)
+    {
+        buffer.push_back((char)(length | 0x80));
+        length >>= 7;
+    }
+    buffer.push_back((char)length);
+    buffer.insert(buffer.end(), source.begin(), source.end());
+    return true;
+}
+
+void TraceRecorder::close()
+{
+    if (!file.is_open())
+        return;
+
+    flushSegment();
+    flushBuffer();
+    file.close();
+}
+
+bool TraceRecorder::isOpen() const
+{
+    return file.is_open();
+}
+
+// 顺序执行只累加计数；跳转与上一个片段相同时只累加重复次数
+void TraceRecorder::recordStep(size_t pos, size_t nextPos)
+{
+    if (skipStep)
+    {
+        skipStep = false;
+        return;
+    }
+
+    stepCnt++;
+    if (nextPos == pos + 1)
+    {
+        pendingRun++;
+        return;
+    }
+
+    long long delta = (long long)nextPos - (long long)(pos + 1);
+    if (pendingRun == lastSegmentRun && delta == lastSegmentDelta)
+    {
+        pendingRepeat++;
+        pendingRun = 0;
+        return;
+    }
+
+    flushSegment();
+    writeToken(TraceReader::JUMP, zigzagEncode(delta));
+    lastSegmentRun = pendingRun;
+    lastSegmentDelta = delta;
+    pendingRun = 0;
+}
+
+void TraceRecorder::recordInput(int value)
+{
+    flushSegment();
+    pendingRun = 0;
+    lastSegmentRun = -1;
+    writeToken(TraceReader::INPUT, zigzagEncode(value));
+}
+
+// 断点拦下的语句并没有执行，不计入轨迹
+void TraceRecorder::skipNextStep()
+{
+    skipStep = true;
+}
+
+long long TraceRecorder::getStepCnt() const
+{
+    return stepCnt;
+}
+
+void TraceRecorder::flushSegment()
+{
+    if (pendingRepeat > 0)
+    {
+        writeToken(TraceReader::REPEAT, pendingRepeat);
+        pendingRepeat = 0;
+    }
+    if (pendingRun > 0)
+        writeToken(TraceReader::RUN, pendingRun);
+}
+
+void TraceRecorder::writeToken(int type, uint64_t value)
+{
+    uint64_t token = (value << 2) | type;
+    while (token >= 0x80)
+    {
+        buffer.push_back((char)(token | 0x80));
+        token >>= 7;
+    }
+    buffer.push_back((char)token);
+
+    if (buffer.size() >= FLUSH_SIZE)
+        flushBuffer();
+}
+
+void TraceRecorder::flushBuffer()
+{
+    file.write(buffer.data(), buffer.size());
+    buffer.clear();
+}
+
+
+TraceReader::TraceReader() {}
+
+bool TraceReader::open(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (data.size() < TRACE_MAGIC_LENGTH || !std::equal(TRACE_MAGIC, TRACE_MAGIC + TRACE_MAGIC_LENGTH, data.begin()))
+        return false;
+
+    size_t offset = TRACE_MAGIC_LENGTH;
+    uint64_t length;
+    if (!readVarint(offset, length) || length > data.size() - offset)
+        return false;
+    source.assign(data.begin() + offset, data.begin() + offset + length);
+    tokensBegin = offset + length;
+
+    // 预先取出所有输入，回放时一次性放进输入队列
+    inputs.clear();
+    rewind();
+    TokenType type;
+    uint64_t value;
+    while (readToken(type, value))
+    {
+        if (type == INPUT)
+            inputs.push_back((int)zigzagDecode(value));
+    }
+    rewind();
+    return true;
+}
+
+const std::string& TraceReader::getSource() const { return source; }
+const std::vector<int>& TraceReader::getInputs() const { return inputs; }
+
+// 给出下一步执行后应到达的位置，轨迹结束时返回false
+bool TraceReader::nextStep(size_t& expectedNextPos)
+{
+    while (true)
+    {
+        if (state.runLeft > 0)
+        {
+            state.runLeft--;
+            expectedNextPos = ++state.pos;
+            state.step++;
+            return true;
+        }
+
+        if (state.inRepeatJump)
+        {
+            state.inRepeatJump = false;
+            state.pos = state.pos + 1 + state.lastSegmentDelta;
+            expectedNextPos = state.pos;
+            state.step++;
+            return true;
+        }
+
+        if (state.repeatLeft > 0)
+        {
+            state.repeatLeft--;
+            state.runLeft = state.lastSegmentRun;
+            state.inRepeatJump = true;
+            continue;
+        }
+
+        TokenType type;
+        uint64_t value;
+        if (!readToken(type, value))
+            return false;
+
+        switch (type)
+        {
+            case RUN:
+                state.runLeft = value;
+                state.prevRun = value;
+                break;
+
+            case JUMP:
+                state.lastSegmentRun = state.prevRun >= 0 ? state.prevRun : 0;
+                state.lastSegmentDelta = zigzagDecode(value);
+                state.prevRun = -1;
+                state.pos = state.pos + 1 + state.lastSegmentDelta;
+                expectedNextPos = state.pos;
+                state.step++;
+                return true;
+
+            case INPUT:
+                state.prevRun = -1;
+                break;
+
+            case REPEAT:
+                state.repeatLeft = value;
+                state.prevRun = -1;
+                break;
+        }
+    }
+}
+
+bool TraceReader::isFinished() const
+{
+    return state.offset >= data.size() && state.runLeft == 0 && state.repeatLeft == 0 && !state.inRepeatJump;
+}
+
+long long TraceReader::getStep() const { return state.step; }
+const TraceReader::State& TraceReader::getState() const { return state; }
+void TraceReader::setState(const State& newState) { state = newState; }
+
+void TraceReader::rewind()
+{
+    state = State();
+    state.offset = tokensBegin;
+}
+
+bool TraceReader::readVarint(size_t& offset, uint64_t& value) const
+{
+    value = 0;
+    for (int shift = 0; offset < data.size() && shift < 64; shift += 7)
+    {
+        uint8_t byte = data[offset++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool TraceReader::readToken(TokenType& type, uint64_t& value)
+{
+    uint64_t token;
+    if (!readVarint(state.offset, token))
+        return false;
+    type = (TokenType)(token & 3);
+    value = token >> 2;
+    return true;
+}
@@ -0,0 +1,100 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+
+/*
+ * 执行轨迹的二进制格式：
+ *   "QBTRACE1"，程序源码长度（varint）和源码，之后是一串varint记号。
+ * 每个记号的低两位是类型，其余位是参数：
+ *   RUN n      连续n步都顺序执行到下一行
+ *   JUMP d     一步跳转，目标位置 = 当前位置 + 1 + d（d为zigzag编码）
+ *   INPUT v    INPUT读入的值（zigzag编码）
+ *   REPEAT n   把上一个“RUN + JUMP”片段再重复n次，紧凑地表示循环
+ * 位置是语句在程序中的下标而不是行号，顺序执行的步骤只占计数。
+ */
+class TraceRecorder
+{
+private:
+    static const size_t FLUSH_SIZE = 1 << 16;
+
+    std::ofstream file;
+    std::vector<char> buffer;
+    long long stepCnt = 0;
+    long long pendingRun = 0;
+    long long pendingRepeat = 0;
+    long long lastSegmentRun = -1;
+    long long lastSegmentDelta = 0;
+    bool skipStep = false;
+
+public:
+    TraceRecorder();
+    ~TraceRecorder();
+    bool open(const std::string& fileName, const std::string& source);
+    void close();
+    bool isOpen() const;
+    void recordStep(size_t pos, size_t nextPos);
+    void recordInput(int value);
+    void skipNextStep();
+    long long getStepCnt() const;
+
+private:
+    void flushSegment();
+    void writeToken(int type, uint64_t value);
+    void flushBuffer();
+};
+
+
+class TraceReader
+{
+public:
+    typedef enum
+    {
+        RUN = 0,
+        JUMP,
+        INPUT,
+        REPEAT
+    } TokenType;
+
+    // 读取位置，保存下来即可从快照处继续校验
+    struct State
+    {
+        size_t offset = 0;
+        size_t pos = 0;
+        long long step = 0;
+        long long runLeft = 0;
+        long long repeatLeft = 0;
+        bool inRepeatJump = false;
+        long long lastSegmentRun = 0;
+        long long lastSegmentDelta = 0;
+        long long prevRun = -1;
+    };
+
+private:
+    std::vector<uint8_t> data;
+    size_t tokensBegin = 0;
+    std::string source;
+    std::vector<int> inputs;
+    State state;
+
+public:
+    TraceReader();
+    bool open(const std::string& fileName);
+    const std::string& getSource() const;
+    const std::vector<int>& getInputs() const;
+    bool nextStep(size_t& expectedNextPos);
+    bool isFinished() const;
+    long long getStep() const;
+    const State& getState() const;
+    void setState(const State& newState);
+    void rewind();
+
+private:
+    bool readVarint(size_t& offset, uint64_t& value) const;
+    bool readToken(TokenType& type, uint64_t& value);
+};
+
+#endif // TRACERECORDER_H